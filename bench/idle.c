@@ -0,0 +1,245 @@
+
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "chttp.h"
+
+
+/* the memory an idle keep-alive connection costs the server, as resident
+ * set growth divided by the number of connections. the server runs in
+ * a child process of its own for each setting of slim_idle, so neither
+ * measurement inherits the other's heap. the connections are measured
+ * once accepted and again once each has been answered a request
+ *
+ * usage: idle [-n connections] [-p port]
+ */
+
+#define _IDLE_DEFAULT_CONNECTIONS 10000
+#define _IDLE_DEFAULT_PORT 18081
+#define _IDLE_SETTLE_TIME 100000 /* in microseconds */
+
+
+static const char idle_request [] = "GET / HTTP/1.1\r\nHost: idle\r\n\r\n";
+
+
+static size_t idle_resident(void)
+{
+  unsigned long size, resident = 0;
+  FILE * file;
+
+  file = fopen("/proc/self/statm", "r");
+  if (!file)
+    return 0;
+  if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  fclose(file);
+
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static HTTPResponse * idle_handler(HTTPRequest * request, void * context)
+{
+  HTTPResponse * ret;
+  HTTPContent content;
+
+  (void) request;
+  (void) context;
+
+  content.length = 2;
+  content.data = malloc(content.length);
+  assert(content.data);
+  memcpy(content.data, "ok", content.length);
+
+  ret = http_response_new();
+  http_message_set_content((HTTPMessage *) ret, content);
+
+  return ret;
+}
+
+static void * idle_server_run(void * context)
+{
+  HTTPServer * server = (HTTPServer *) context;
+
+  if (!http_server_run(server))
+    fprintf(stderr, "idle: server: %s\n", http_server_get_error(server));
+
+  return NULL;
+}
+
+/* reads one response, which is known to end with its two byte content */
+static bool idle_read_response(int fd)
+{
+  char buffer [0x400], * end;
+  size_t length = 0;
+  ssize_t received;
+
+  for (;;)
+  {
+    received = read(fd, &buffer[length], sizeof(buffer) - length - 1);
+    if (received <= 0)
+      return false;
+    length += received;
+    buffer[length] = 0;
+
+    end = strstr(buffer, "\r\n\r\n");
+    if (end && (size_t) (end - buffer) + 6 <= length)
+      return true;
+    if (length == sizeof(buffer) - 1)
+      return false;
+  }
+}
+
+static int idle_measure(uint32_t count, uint16_t port, bool slim)
+{
+  size_t base, accepted, answered;
+  HTTPServerSettings settings;
+  struct sockaddr_in address;
+  HTTPServer * server;
+  pthread_t thread;
+  int * fds;
+
+  server = http_server_new(idle_handler, NULL);
+  settings = http_server_get_default_settings();
+  settings.slim_idle = slim;
+  if (settings.max_connections < count)
+    settings.max_connections = count;
+  http_server_set_settings(server, settings);
+
+  if (!http_server_listen(server, "127.0.0.1", port))
+  {
+    fprintf(stderr, "idle: cannot listen: %s\n", http_server_get_error(server));
+    return 1;
+  }
+  pthread_create(&thread, NULL, idle_server_run, server);
+
+  fds = (int *) malloc(sizeof(int) * count);
+  assert(fds);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  usleep(_IDLE_SETTLE_TIME);
+  base = idle_resident();
+
+  for (uint32_t k = 0; k < count; k++)
+  {
+    fds[k] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (
+      fds[k] < 0 ||
+      connect(fds[k], (struct sockaddr *) &address, sizeof(address)) != 0
+      )
+    {
+      fprintf(stderr, "idle: cannot connect: %s\n", strerror(errno));
+      return 1;
+    }
+  }
+
+  while (http_server_get_connection_count(server) < count)
+    usleep(1000);
+  usleep(_IDLE_SETTLE_TIME);
+  accepted = idle_resident();
+
+  for (uint32_t k = 0; k < count; k++)
+  {
+    if (
+      write(fds[k], idle_request, sizeof(idle_request) - 1) !=
+        sizeof(idle_request) - 1 ||
+      !idle_read_response(fds[k])
+      )
+    {
+      fprintf(stderr, "idle: request failed\n");
+      return 1;
+    }
+  }
+
+  usleep(_IDLE_SETTLE_TIME);
+  answered = idle_resident();
+
+  printf(
+      "slim_idle %-5s %8.0f B/connection accepted, %8.0f after a request\n",
+      slim ? "on" : "off",
+      (double) (accepted - base) / count,
+      (double) (answered - base) / count
+      );
+
+  for (uint32_t k = 0; k < count; k++)
+    close(fds[k]);
+  free(fds);
+
+  http_server_stop(server);
+  pthread_join(thread, NULL);
+  http_server_destroy(server);
+
+  return 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+  uint32_t count = _IDLE_DEFAULT_CONNECTIONS;
+  uint16_t port = _IDLE_DEFAULT_PORT;
+  struct rlimit limit;
+  int option, status, ret = 0;
+  pid_t child;
+
+  while ((option = getopt(argc, argv, "n:p:")) != -1)
+  {
+    switch (option)
+    {
+      case 'n':
+        count = strtoul(optarg, NULL, 10);
+        break;
+      case 'p':
+        port = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n connections] [-p port]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* both ends of every connection are in this process */
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < 2 * (rlim_t) count + 0x100)
+    {
+      count = (limit.rlim_cur - 0x100) / 2;
+      fprintf(stderr, "idle: descriptors allow only %u connections\n", count);
+    }
+  }
+
+  printf("%u idle connections\n", count);
+  fflush(stdout);
+
+  for (int slim = 0; slim < 2; slim++)
+  {
+    child = fork();
+    if (child == 0)
+      return idle_measure(count, port + slim, slim);
+
+    if (child < 0 || waitpid(child, &status, 0) < 0 || status != 0)
+      ret = 1;
+  }
+
+  return ret;
+}
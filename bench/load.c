@@ -0,0 +1,922 @@
+
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chttp.h"
+
+
+/* a loopback load generator. it keeps -c keep-alive connections to a
+ * server (by default a reference HTTPServer it starts itself), spread over
+ * -t threads, each with an epoll loop of its own. requests are rendered
+ * once with an HTTPWriter and responses are framed as the server frames
+ * requests, then parsed with an HTTPReader
+ *
+ * closed loop (the default), every connection keeps -p requests in flight
+ * and sends the next as soon as a response comes back. open loop (-R),
+ * requests are sent on a fixed schedule adding up to the given rate, as
+ * wrk2 does, and latency is measured from when a request was due rather
+ * than when it went out, so a stalled server is charged for the requests
+ * it kept from being sent. closed loop results are also reported with
+ * HdrHistogram's correction for that, against their mean latency
+ *
+ * usage: load [-c connections] [-t threads] [-d seconds] [-R rate]
+ *             [-p depth] [-s server threads] [-a address:port] [-x]
+ *             [path]
+ *
+ *   -x  drives a server already listening at -a instead of starting one
+ */
+
+#define _LOAD_DEFAULT_ADDRESS "127.0.0.1"
+#define _LOAD_DEFAULT_PORT 18080
+#define _LOAD_BUFFER_LENGTH 0x4000
+#define _LOAD_EVENT_COUNT 0x100
+
+/* the histogram keeps three significant digits: values below 2048 are
+ * exact, and every doubling above is split into 1024 equal buckets
+ */
+#define _LOAD_SUB_BUCKET_BITS 10
+#define _LOAD_SUB_BUCKET_COUNT (1 << _LOAD_SUB_BUCKET_BITS)
+#define _LOAD_BUCKET_COUNT 40
+#define _LOAD_HISTOGRAM_LENGTH \
+  (2 * _LOAD_SUB_BUCKET_COUNT + _LOAD_BUCKET_COUNT * _LOAD_SUB_BUCKET_COUNT)
+
+
+struct LoadSettings;
+typedef struct LoadSettings LoadSettings;
+struct LoadHistogram;
+typedef struct LoadHistogram LoadHistogram;
+struct LoadThread;
+typedef struct LoadThread LoadThread;
+struct LoadConnection;
+typedef struct LoadConnection LoadConnection;
+struct LoadBuffer;
+typedef struct LoadBuffer LoadBuffer;
+
+struct LoadSettings
+{
+  uint32_t connections, threads, depth, server_threads;
+  uint64_t duration; /* in nanoseconds */
+  double rate; /* requests per second overall; 0 for a closed loop */
+  struct sockaddr_in address;
+  bool external;
+  char * path;
+};
+
+/* latencies in microseconds */
+struct LoadHistogram
+{
+  uint64_t counts [_LOAD_HISTOGRAM_LENGTH];
+  uint64_t total, max;
+  double sum;
+};
+
+struct LoadThread
+{
+  pthread_t thread;
+  LoadSettings * settings;
+  int epoll_fd;
+
+  LoadConnection * connections;
+  uint32_t connection_count;
+
+  const char * request; /* shared by all threads */
+  size_t request_length;
+
+  LoadHistogram histogram;
+  uint64_t responses, errors, failures;
+};
+
+struct LoadConnection
+{
+  LoadThread * thread;
+  int fd;
+  bool dead;
+
+  HTTPReader * reader;
+  uint64_t * intended; /* of the requests in flight, oldest first */
+  uint32_t in_flight, first;
+  uint64_t next_due, interval; /* for an open loop */
+
+  char * input;
+  size_t input_start, input_length, input_capacity;
+  size_t message_start, message_end; /* served to the reader */
+
+  char * output;
+  size_t output_start, output_length, output_capacity;
+};
+
+struct LoadBuffer
+{
+  char * data;
+  size_t length, capacity;
+};
+
+
+static uint64_t load_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+static size_t load_histogram_index(uint64_t value)
+{
+  uint32_t shift;
+
+  if (value < 2 * _LOAD_SUB_BUCKET_COUNT)
+    return value;
+
+  shift = 63 - __builtin_clzll(value) - _LOAD_SUB_BUCKET_BITS;
+  if (shift > _LOAD_BUCKET_COUNT)
+    return _LOAD_HISTOGRAM_LENGTH - 1;
+
+  return 2 * _LOAD_SUB_BUCKET_COUNT +
+    (shift - 1) * _LOAD_SUB_BUCKET_COUNT +
+    (value >> shift) - _LOAD_SUB_BUCKET_COUNT;
+}
+
+/* the highest value that would land at `index' */
+static uint64_t load_histogram_value(size_t index)
+{
+  uint32_t shift;
+  uint64_t sub;
+
+  if (index < 2 * _LOAD_SUB_BUCKET_COUNT)
+    return index;
+
+  index -= 2 * _LOAD_SUB_BUCKET_COUNT;
+  shift = index / _LOAD_SUB_BUCKET_COUNT + 1;
+  sub = index % _LOAD_SUB_BUCKET_COUNT + _LOAD_SUB_BUCKET_COUNT;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+static void load_histogram_add(
+    LoadHistogram * histogram,
+    uint64_t value,
+    uint64_t count
+    )
+{
+  histogram->counts[load_histogram_index(value)] += count;
+  histogram->total += count;
+  histogram->sum += (double) value * count;
+  if (value > histogram->max)
+    histogram->max = value;
+}
+
+static void load_histogram_merge(LoadHistogram * to, LoadHistogram * from)
+{
+  for (size_t k = 0; k < _LOAD_HISTOGRAM_LENGTH; k++)
+    to->counts[k] += from->counts[k];
+  to->total += from->total;
+  to->sum += from->sum;
+  if (from->max > to->max)
+    to->max = from->max;
+}
+
+/* as HdrHistogram's copyCorrectedForCoordinatedOmission: a value longer
+ * than `interval' stands in for the samples that would have been taken
+ * meanwhile, had the sender not been held up
+ */
+static void load_histogram_correct(
+    LoadHistogram * to,
+    LoadHistogram * from,
+    uint64_t interval
+    )
+{
+  uint64_t value, missing;
+
+  for (size_t k = 0; k < _LOAD_HISTOGRAM_LENGTH; k++)
+  {
+    if (!from->counts[k])
+      continue;
+
+    value = load_histogram_value(k);
+    if (value > from->max)
+      value = from->max;
+    load_histogram_add(to, value, from->counts[k]);
+
+    if (interval == 0 || value <= interval)
+      continue;
+
+    for (missing = value - interval; missing >= interval; missing -= interval)
+      load_histogram_add(to, missing, from->counts[k]);
+  }
+}
+
+static uint64_t load_histogram_percentile(
+    LoadHistogram * histogram,
+    double percentile
+    )
+{
+  uint64_t target, seen = 0;
+
+  if (!histogram->total)
+    return 0;
+
+  target = (uint64_t) ceil(histogram->total * percentile / 100);
+  if (target == 0)
+    target = 1;
+
+  for (size_t k = 0; k < _LOAD_HISTOGRAM_LENGTH; k++)
+  {
+    seen += histogram->counts[k];
+    if (seen >= target)
+      return load_histogram_value(k) < histogram->max ?
+        load_histogram_value(k) : histogram->max;
+  }
+
+  return histogram->max;
+}
+
+static void load_histogram_print(LoadHistogram * histogram, const char * title)
+{
+  static const double percentiles [] = { 50, 75, 90, 99, 99.9, 99.99 };
+
+  printf("%s (microseconds)\n", title);
+  printf("  mean   %10.1f\n", histogram->sum / histogram->total);
+  for (size_t k = 0; k < sizeof(percentiles) / sizeof(double); k++)
+    printf(
+        "  p%-6g%10lu\n",
+        percentiles[k],
+        (unsigned long) load_histogram_percentile(histogram, percentiles[k])
+        );
+  printf("  max    %10lu\n", (unsigned long) histogram->max);
+}
+
+
+static void load_reserve(char ** buffer, size_t * capacity, size_t required)
+{
+  if (*capacity >= required)
+    return;
+
+  if (*capacity == 0)
+    *capacity = _LOAD_BUFFER_LENGTH;
+  while (*capacity < required)
+    *capacity *= 2;
+
+  *buffer = (char *) realloc(*buffer, *capacity);
+  assert(*buffer);
+}
+
+static ssize_t load_read_message(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    )
+{
+  LoadConnection * conn = (LoadConnection *) context;
+  size_t remaining = conn->message_end - conn->message_start;
+
+  (void) fd;
+
+  if (length > remaining)
+    length = remaining;
+
+  memcpy(data, &conn->input[conn->message_start], length);
+  conn->message_start += length;
+
+  return length;
+}
+
+static ssize_t load_render_output(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  LoadBuffer * buffer = (LoadBuffer *) context;
+
+  (void) fd;
+
+  load_reserve(&buffer->data, &buffer->capacity, buffer->length + length);
+  memcpy(&buffer->data[buffer->length], data, length);
+  buffer->length += length;
+
+  return length;
+}
+
+static void load_fail(LoadConnection * conn)
+{
+  if (conn->dead)
+    return;
+
+  conn->dead = true;
+  conn->thread->failures++;
+  epoll_ctl(conn->thread->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+}
+
+static void load_flush(LoadConnection * conn)
+{
+  ssize_t sent;
+
+  while (conn->output_start < conn->output_length)
+  {
+    sent = send(
+        conn->fd,
+        &conn->output[conn->output_start],
+        conn->output_length - conn->output_start,
+        MSG_NOSIGNAL
+        );
+
+    if (sent > 0)
+      conn->output_start += sent;
+    else if (sent < 0 && errno == EINTR)
+      continue;
+    else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    else
+    {
+      load_fail(conn);
+      return;
+    }
+  }
+
+  conn->output_start = 0;
+  conn->output_length = 0;
+}
+
+/* queues a request due at `intended' */
+static void load_send(LoadConnection * conn, uint64_t intended)
+{
+  LoadThread * thread = conn->thread;
+  uint32_t depth = thread->settings->depth;
+
+  conn->intended[(conn->first + conn->in_flight) % depth] = intended;
+  conn->in_flight++;
+
+  load_reserve(
+      &conn->output,
+      &conn->output_capacity,
+      conn->output_length + thread->request_length
+      );
+  memcpy(
+      &conn->output[conn->output_length],
+      thread->request,
+      thread->request_length
+      );
+  conn->output_length += thread->request_length;
+}
+
+/* sends what is due, returning when the next request will be (or
+ * UINT64_MAX if that depends on a response)
+ */
+static uint64_t load_pump(LoadConnection * conn, uint64_t now, uint64_t end)
+{
+  uint32_t depth = conn->thread->settings->depth;
+
+  if (conn->dead)
+    return UINT64_MAX;
+
+  if (!conn->interval)
+  {
+    while (conn->in_flight < depth && now < end)
+      load_send(conn, now);
+  }
+  else
+  {
+    while (conn->in_flight < depth && conn->next_due <= now)
+    {
+      if (conn->next_due >= end)
+        break;
+      load_send(conn, conn->next_due);
+      conn->next_due += conn->interval;
+    }
+  }
+
+  load_flush(conn);
+
+  if (!conn->interval || conn->in_flight == depth || conn->next_due >= end)
+    return UINT64_MAX;
+  return conn->next_due;
+}
+
+/* the length of the response at input_start, or 0 if it is incomplete */
+static size_t load_frame(LoadConnection * conn)
+{
+  const char * start = &conn->input[conn->input_start], * end;
+  size_t available = conn->input_length - conn->input_start;
+  unsigned long long content_length = 0;
+  size_t header_length;
+
+  end = (const char *) memmem(start, available, "\r\n\r\n", 4);
+  if (!end)
+    return 0;
+
+  header_length = end - start + 4;
+  http_utils_scan_content_length(start, header_length, &content_length);
+
+  if (available < header_length + content_length)
+    return 0;
+
+  return header_length + content_length;
+}
+
+static void load_receive(LoadConnection * conn)
+{
+  LoadThread * thread = conn->thread;
+  HTTPMessage * message;
+  uint64_t now, latency;
+  size_t length;
+  ssize_t received;
+
+  for (;;)
+  {
+    if (conn->input_start == conn->input_length)
+    {
+      conn->input_start = 0;
+      conn->input_length = 0;
+    }
+
+    load_reserve(
+        &conn->input,
+        &conn->input_capacity,
+        conn->input_length + _LOAD_BUFFER_LENGTH
+        );
+
+    received = recv(
+        conn->fd,
+        &conn->input[conn->input_length],
+        conn->input_capacity - conn->input_length,
+        0
+        );
+
+    if (received > 0)
+      conn->input_length += received;
+    else if (received < 0 && errno == EINTR)
+      continue;
+    else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    else
+    {
+      load_fail(conn);
+      return;
+    }
+  }
+
+  now = load_now();
+
+  while ((length = load_frame(conn)))
+  {
+    conn->message_start = conn->input_start;
+    conn->message_end = conn->input_start + length;
+    conn->input_start += length;
+
+    message = http_reader_next(conn->reader);
+    if (!message || !conn->in_flight)
+    {
+      if (message)
+        http_message_destroy(message);
+      load_fail(conn);
+      return;
+    }
+
+    if (http_response_get_status_code((HTTPResponse *) message) >= 400)
+      thread->errors++;
+    http_message_free_content(message);
+    http_message_destroy(message);
+
+    latency = now - conn->intended[conn->first];
+    conn->first = (conn->first + 1) % thread->settings->depth;
+    conn->in_flight--;
+
+    load_histogram_add(&thread->histogram, latency / 1000, 1);
+    thread->responses++;
+  }
+}
+
+static bool load_connect(LoadConnection * conn)
+{
+  LoadSettings * settings = conn->thread->settings;
+  struct epoll_event event;
+  int one = 1;
+
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (conn->fd < 0)
+    return false;
+
+  if (connect(
+        conn->fd,
+        (struct sockaddr *) &settings->address,
+        sizeof(settings->address)
+        ) != 0)
+    return false;
+
+  setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+  event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  event.data.ptr = conn;
+
+  return epoll_ctl(conn->thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event)
+    == 0;
+}
+
+static void * load_thread_run(void * context)
+{
+  LoadThread * thread = (LoadThread *) context;
+  LoadSettings * settings = thread->settings;
+  struct epoll_event events [_LOAD_EVENT_COUNT];
+  uint64_t start, end, now, due, next;
+  LoadConnection * conn;
+  int count, timeout;
+  uint32_t live;
+
+  start = load_now();
+  end = start + settings->duration;
+
+  for (uint32_t k = 0; k < thread->connection_count; k++)
+  {
+    conn = &thread->connections[k];
+    if (conn->interval)
+      /* spread the connections' schedules over an interval */
+      conn->next_due = start + conn->interval * k / thread->connection_count;
+  }
+
+  for (;;)
+  {
+    now = load_now();
+    next = UINT64_MAX;
+    live = 0;
+
+    for (uint32_t k = 0; k < thread->connection_count; k++)
+    {
+      conn = &thread->connections[k];
+      due = load_pump(conn, now, end);
+      if (due < next)
+        next = due;
+      if (!conn->dead && (conn->in_flight || (now < end && conn->interval)))
+        live++;
+    }
+
+    if (now >= end || live == 0)
+      break;
+
+    if (next == UINT64_MAX)
+      timeout = (end - now + 999999) / 1000000;
+    else
+      timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+
+    count = epoll_wait(thread->epoll_fd, events, _LOAD_EVENT_COUNT, timeout);
+    for (int k = 0; k < count; k++)
+    {
+      conn = (LoadConnection *) events[k].data.ptr;
+      if (events[k].events & (EPOLLERR | EPOLLHUP))
+        load_fail(conn);
+      else
+      {
+        if (events[k].events & EPOLLIN)
+          load_receive(conn);
+        if (events[k].events & EPOLLOUT && !conn->dead)
+          load_flush(conn);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+static HTTPResponse * load_reference_handler(
+    HTTPRequest * request,
+    void * context
+    )
+{
+  static const char body [] = "hello, world\n";
+  HTTPResponse * ret;
+  HTTPContent content;
+
+  (void) request;
+  (void) context;
+
+  content.length = sizeof(body) - 1;
+  content.data = malloc(content.length);
+  assert(content.data);
+  memcpy(content.data, body, content.length);
+
+  ret = http_response_new();
+  http_response_set_header(ret, "Content-Type", "text/plain");
+  http_message_set_content((HTTPMessage *) ret, content);
+
+  return ret;
+}
+
+static void * load_server_run(void * context)
+{
+  HTTPServer * server = (HTTPServer *) context;
+
+  if (!http_server_run(server))
+    fprintf(stderr, "load: server: %s\n", http_server_get_error(server));
+
+  return NULL;
+}
+
+/* renders the request once, for every connection to copy */
+static LoadBuffer load_render_request(LoadSettings * settings)
+{
+  LoadBuffer ret = { NULL, 0, 0 };
+  char host [INET_ADDRSTRLEN + 8];
+  HTTPRequest * request;
+  HTTPWriter * writer;
+
+  snprintf(
+      host,
+      sizeof(host),
+      "%s:%u",
+      inet_ntoa(settings->address.sin_addr),
+      ntohs(settings->address.sin_port)
+      );
+
+  request = http_request_new();
+  http_request_set_method(request, HTTP_METHOD_GET);
+  http_request_set_target(request, settings->path);
+  http_request_set_version(request, HTTP_VERSION_1_1);
+  http_request_set_header(request, "Host", host);
+  http_request_set_header(request, "User-Agent", "chttp-load");
+
+  writer = http_writer_new();
+  http_writer_set_write_function(writer, load_render_output, &ret);
+  http_writer_render(writer, (HTTPMessage *) request, -1);
+  assert(!http_writer_has_error(writer));
+
+  http_writer_destroy(writer);
+  http_request_destroy(request);
+
+  return ret;
+}
+
+static void load_usage(const char * name)
+{
+  fprintf(
+      stderr,
+      "usage: %s [-c connections] [-t threads] [-d seconds] [-R rate]\n"
+      "       [-p depth] [-s server threads] [-a address:port] [-x] [path]\n",
+      name
+      );
+  exit(1);
+}
+
+static void load_parse_address(const char * value, struct sockaddr_in * out)
+{
+  char address [INET_ADDRSTRLEN];
+  const char * colon;
+  size_t length;
+
+  colon = strrchr(value, ':');
+  length = colon ? (size_t) (colon - value) : strlen(value);
+  if (length >= sizeof(address))
+    length = sizeof(address) - 1;
+
+  memcpy(address, value, length);
+  address[length] = 0;
+
+  if (inet_pton(AF_INET, address, &out->sin_addr) != 1)
+  {
+    fprintf(stderr, "load: bad address `%s'\n", value);
+    exit(1);
+  }
+  if (colon)
+    out->sin_port = htons(atoi(colon + 1));
+}
+
+
+int main(int argc, char ** argv)
+{
+  LoadHistogram * histogram, * corrected;
+  HTTPServerSettings server_settings;
+  uint64_t responses = 0, errors = 0, failures = 0;
+  HTTPServer * server = NULL;
+  pthread_t server_thread;
+  LoadSettings settings;
+  LoadThread * threads;
+  LoadConnection * conn;
+  LoadBuffer request;
+  struct rlimit limit;
+  double seconds;
+  int option;
+
+  memset(&settings, 0, sizeof(settings));
+  settings.connections = 100;
+  settings.threads = 2;
+  settings.depth = 1;
+  settings.server_threads = 2;
+  settings.duration = 10 * 1000000000ULL;
+  settings.address.sin_family = AF_INET;
+  settings.address.sin_port = htons(_LOAD_DEFAULT_PORT);
+  inet_pton(AF_INET, _LOAD_DEFAULT_ADDRESS, &settings.address.sin_addr);
+  settings.path = "/";
+
+  while ((option = getopt(argc, argv, "c:t:d:R:p:s:a:x")) != -1)
+  {
+    switch (option)
+    {
+      case 'c':
+        settings.connections = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        settings.threads = strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        settings.duration = strtod(optarg, NULL) * 1e9;
+        break;
+      case 'R':
+        settings.rate = strtod(optarg, NULL);
+        break;
+      case 'p':
+        settings.depth = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        settings.server_threads = strtoul(optarg, NULL, 10);
+        break;
+      case 'a':
+        load_parse_address(optarg, &settings.address);
+        break;
+      case 'x':
+        settings.external = true;
+        break;
+      default:
+        load_usage(argv[0]);
+    }
+  }
+  if (optind < argc)
+    settings.path = argv[optind];
+
+  if (!settings.connections || !settings.threads || !settings.depth)
+    load_usage(argv[0]);
+  if (settings.threads > settings.connections)
+    settings.threads = settings.connections;
+
+  /* a descriptor per connection, on both ends */
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  if (!settings.external)
+  {
+    server = http_server_new(load_reference_handler, NULL);
+    server_settings = http_server_get_default_settings();
+    server_settings.thread_count = settings.server_threads;
+    if (server_settings.max_connections < settings.connections)
+      server_settings.max_connections = settings.connections;
+    http_server_set_settings(server, server_settings);
+
+    if (!http_server_listen(
+          server,
+          inet_ntoa(settings.address.sin_addr),
+          ntohs(settings.address.sin_port)
+          ))
+    {
+      fprintf(
+          stderr,
+          "load: cannot listen: %s\n",
+          http_server_get_error(server)
+          );
+      return 1;
+    }
+    pthread_create(&server_thread, NULL, load_server_run, server);
+  }
+
+  request = load_render_request(&settings);
+
+  threads = (LoadThread *) calloc(settings.threads, sizeof(LoadThread));
+  assert(threads);
+
+  for (uint32_t k = 0; k < settings.threads; k++)
+  {
+    threads[k].settings = &settings;
+    threads[k].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    threads[k].request = request.data;
+    threads[k].request_length = request.length;
+    threads[k].connection_count = settings.connections / settings.threads +
+      (k < settings.connections % settings.threads);
+    threads[k].connections = (LoadConnection *)
+      calloc(threads[k].connection_count, sizeof(LoadConnection));
+    assert(threads[k].connections);
+
+    for (uint32_t j = 0; j < threads[k].connection_count; j++)
+    {
+      conn = &threads[k].connections[j];
+      conn->thread = &threads[k];
+      conn->reader = http_reader_new(-1);
+      http_reader_set_read_function(conn->reader, load_read_message, conn);
+      conn->intended = (uint64_t *) calloc(settings.depth, sizeof(uint64_t));
+      assert(conn->intended);
+      if (settings.rate > 0)
+        conn->interval = 1e9 * settings.connections / settings.rate;
+
+      if (!load_connect(conn))
+      {
+        fprintf(stderr, "load: cannot connect: %s\n", strerror(errno));
+        return 1;
+      }
+    }
+  }
+
+  printf(
+      "%u connections on %u threads, %s loop%s, depth %u, %.1f s\n",
+      settings.connections,
+      settings.threads,
+      settings.rate > 0 ? "open" : "closed",
+      settings.rate > 0 ? " at a fixed rate" : "",
+      settings.depth,
+      settings.duration / 1e9
+      );
+
+  for (uint32_t k = 0; k < settings.threads; k++)
+    pthread_create(&threads[k].thread, NULL, load_thread_run, &threads[k]);
+
+  histogram = (LoadHistogram *) calloc(1, sizeof(LoadHistogram));
+  corrected = (LoadHistogram *) calloc(1, sizeof(LoadHistogram));
+  assert(histogram && corrected);
+
+  for (uint32_t k = 0; k < settings.threads; k++)
+  {
+    pthread_join(threads[k].thread, NULL);
+    load_histogram_merge(histogram, &threads[k].histogram);
+    responses += threads[k].responses;
+    errors += threads[k].errors;
+    failures += threads[k].failures;
+  }
+
+  seconds = settings.duration / 1e9;
+  printf(
+      "%lu responses, %lu errors, %lu connections failed\n",
+      (unsigned long) responses,
+      (unsigned long) errors,
+      (unsigned long) failures
+      );
+  printf("throughput     %10.1f requests/s\n", responses / seconds);
+  if (settings.rate > 0)
+    printf("target         %10.1f requests/s\n", settings.rate);
+
+  if (histogram->total)
+  {
+    if (settings.rate > 0)
+      load_histogram_print(histogram, "latency from schedule");
+    else
+    {
+      load_histogram_print(histogram, "latency");
+      load_histogram_correct(
+          corrected,
+          histogram,
+          (uint64_t) (histogram->sum / histogram->total)
+          );
+      load_histogram_print(corrected, "latency, corrected");
+    }
+  }
+
+  for (uint32_t k = 0; k < settings.threads; k++)
+  {
+    for (uint32_t j = 0; j < threads[k].connection_count; j++)
+    {
+      conn = &threads[k].connections[j];
+      close(conn->fd);
+      http_reader_destroy(conn->reader);
+      free(conn->intended);
+      free(conn->input);
+      free(conn->output);
+    }
+    close(threads[k].epoll_fd);
+    free(threads[k].connections);
+  }
+  free(threads);
+  free(histogram);
+  free(corrected);
+  free(request.data);
+
+  if (server)
+  {
+    http_server_stop(server);
+    pthread_join(server_thread, NULL);
+    http_server_destroy(server);
+  }
+
+  return 0;
+}
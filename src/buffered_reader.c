@@ -2,7 +2,7 @@
 #include <assert.h>
 #include <baselib/baselib.h>
 #include <errno.h>
-#include <time.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -17,8 +17,25 @@
 struct BufferedReader
 {
   int fd;
+  HTTPReadFunction read;
+  void * read_context;
+  HTTPWaitFunction wait;
+  void * wait_context;
   char data [_BUFFERED_READER_BUFFER_LENGTH];
   size_t ptr_diff, data_length;
+
+  /* a memory source, read in place instead of through `read' */
+  const char * source;
+  size_t source_length, source_offset;
+
+  /* receives whatever `read' returns, if set */
+  HTTPCapture * capture;
+  uint64_t capture_connection;
+
+  HTTPAllocator allocator; /* of the lines read and their assembly */
+
+  /* set (by http_wait_now_ns) when a line's first byte is in hand, if 0 */
+  uint64_t * first_byte_time;
 };
 
 static void buffered_reader_forward_buffer(BufferedReader * reader, size_t i)
@@ -33,23 +50,83 @@ static void buffered_reader_forward_buffer(BufferedReader * reader, size_t i)
 }
 
 static void buffered_reader_accumulate(
+    BufferedReader * reader,
     char ** buffer_ptr, size_t * buffer_length_ptr, size_t increase
     )
 {
   *buffer_length_ptr += increase;
-  if (*buffer_ptr)
-    *buffer_ptr = realloc(*buffer_ptr, *buffer_length_ptr);
-  else
-    *buffer_ptr = malloc(*buffer_length_ptr);
+  *buffer_ptr = http_allocator_realloc(
+      &reader->allocator,
+      *buffer_ptr,
+      *buffer_length_ptr
+      );
+}
+
+static void buffered_reader_mark_first_byte(BufferedReader * reader)
+{
+  if (reader->first_byte_time && !*reader->first_byte_time)
+    *reader->first_byte_time = http_wait_now_ns();
+}
+
+/* `read', recording what it returns (the end of input included) */
+static ssize_t buffered_reader_receive(
+    BufferedReader * reader,
+    char * data,
+    size_t data_length
+    )
+{
+  ssize_t ret;
+
+  ret = reader->read(reader->fd, data, data_length, reader->read_context);
+
+  if (reader->capture && ret >= 0)
+    http_capture_record(
+        reader->capture,
+        reader->capture_connection,
+        data,
+        ret
+        );
+
+  return ret;
 }
 
 BufferedReader * buffered_reader_new(int fd)
 {
-  BufferedReader * reader = (BufferedReader *) malloc(sizeof(BufferedReader));
+  BufferedReader * reader;
+
+  reader = (BufferedReader *) chttp_malloc(sizeof(BufferedReader));
+  assert(reader);
 
   reader->fd = fd;
+  reader->read = http_io_read;
+  reader->read_context = NULL;
+  reader->wait = http_wait_poll;
+  reader->wait_context = NULL;
   reader->ptr_diff = 0;
   reader->data_length = 0;
+  reader->source = NULL;
+  reader->source_length = 0;
+  reader->source_offset = 0;
+  reader->capture = NULL;
+  reader->capture_connection = 0;
+  reader->allocator = chttp_get_allocator();
+  reader->first_byte_time = NULL;
+  return reader;
+}
+
+/* reads `data' in place; it must outlive the reader */
+BufferedReader * buffered_reader_new_from_buffer(
+    const char * data,
+    size_t data_length
+    )
+{
+  BufferedReader * reader = buffered_reader_new(-1);
+
+  assert(data || data_length == 0);
+
+  reader->source = data;
+  reader->source_length = data_length;
+
   return reader;
 }
 
@@ -57,16 +134,124 @@ void buffered_reader_destroy(BufferedReader * reader)
 {
   assert(reader);
 
-  free(reader);
+  chttp_free(reader);
+}
+
+void buffered_reader_set_read_function(
+    BufferedReader * reader,
+    HTTPReadFunction read,
+    void * context
+    )
+{
+  assert(reader);
+
+  reader->read = read ? read : http_io_read;
+  reader->read_context = read ? context : NULL;
+}
+
+void buffered_reader_set_wait_function(
+    BufferedReader * reader,
+    HTTPWaitFunction wait,
+    void * context
+    )
+{
+  assert(reader);
+
+  reader->wait = wait ? wait : http_wait_poll;
+  reader->wait_context = wait ? context : NULL;
+}
+
+void buffered_reader_set_capture(
+    BufferedReader * reader,
+    HTTPCapture * capture,
+    uint64_t connection
+    )
+{
+  assert(reader);
+
+  reader->capture = capture;
+  reader->capture_connection = connection;
+}
+
+/* has `*time' set to when the first byte of a line is in hand, whenever
+ * it is zero then. NULL stops it
+ */
+void buffered_reader_set_first_byte_time(
+    BufferedReader * reader,
+    uint64_t * time
+    )
+{
+  assert(reader);
+
+  reader->first_byte_time = time;
+}
+
+/* the allocator of lines read from then on; they are freed through it */
+void buffered_reader_set_allocator(
+    BufferedReader * reader,
+    HTTPAllocator allocator
+    )
+{
+  assert(reader);
+
+  reader->allocator = allocator;
+}
+
+/* waits (up to `timeout' milliseconds) for the underlying descriptor to
+ * become readable. buffered data counts as readable
+ */
+int buffered_reader_wait(BufferedReader * reader, int timeout)
+{
+  assert(reader);
+
+  if (reader->data_length || reader->source)
+    return 1;
+
+  return reader->wait(reader->fd, POLLIN, timeout, reader->wait_context);
 }
 
 bool buffered_reader_buffer_is_empty(BufferedReader * reader)
 {
   assert(reader);
 
+  if (reader->source)
+    return reader->source_offset == reader->source_length;
+
   return reader->data_length == 0;
 }
 
+bool buffered_reader_is_memory(BufferedReader * reader)
+{
+  assert(reader);
+
+  return reader->source != NULL;
+}
+
+/* points `out_ptr' at up to `max' bytes of a memory source and consumes
+ * them, returning how many
+ */
+size_t buffered_reader_view(
+    BufferedReader * reader,
+    size_t max,
+    const char ** out_ptr
+    )
+{
+  size_t ret;
+
+  assert(reader);
+  assert(reader->source);
+  assert(out_ptr);
+
+  ret = reader->source_length - reader->source_offset;
+  if (ret > max)
+    ret = max;
+
+  *out_ptr = &reader->source[reader->source_offset];
+  reader->source_offset += ret;
+
+  return ret;
+}
+
 
 ssize_t buffered_reader_read(
     BufferedReader * reader,
@@ -74,11 +259,19 @@ ssize_t buffered_reader_read(
     size_t data_length
     )
 {
+  const char * source;
+
   assert(reader);
 
-  if (reader->data_length == 0)
+  if (reader->source)
+  {
+    data_length = buffered_reader_view(reader, data_length, &source);
+    memcpy(data, source, data_length);
+    return data_length;
+  }
+  else if (reader->data_length == 0)
   {
-    return read(reader->fd, data, data_length);
+    return buffered_reader_receive(reader, data, data_length);
   }
   else
   {
@@ -92,10 +285,63 @@ ssize_t buffered_reader_read(
   }
 }
 
+/* buffered_reader_read_line for memory sources: the line is found in
+ * place and copied out once
+ */
+static BufferedReaderError buffered_reader_read_source_line(
+  BufferedReader * reader,
+  size_t max,
+  char ** out_ptr,
+  size_t * out_consumed
+  )
+{
+  const char * start = &reader->source[reader->source_offset];
+  size_t k, available = reader->source_length - reader->source_offset;
+  char last = '\0', c;
+
+  if (available)
+    buffered_reader_mark_first_byte(reader);
+
+  for (k = 0; k < available; k++)
+  {
+    if (k > max)
+      return BUFFERED_READER_ERROR_LINE_TOO_LONG;
+
+    c = start[k];
+    if (c == '\n')
+    {
+      if (last == '\r')
+        break;
+      return BUFFERED_READER_ERROR_ENCOUNTERED_CC;
+    }
+    else if ((c < 0x20 && c != '\r') || last == '\r')
+      return BUFFERED_READER_ERROR_ENCOUNTERED_CC;
+
+    last = c;
+  }
+
+  if (k == available)
+    return BUFFERED_READER_ERROR_END_OF_STREAM;
+
+  *out_ptr = (char *) http_allocator_malloc(&reader->allocator, k);
+  assert(*out_ptr);
+  memcpy(*out_ptr, start, k - 1);
+  (*out_ptr)[k - 1] = '\0';
+
+  reader->source_offset += k + 1;
+  *out_consumed = k + 1;
+
+  return BUFFERED_READER_ERROR_NONE;
+}
+
+/* sets `out_consumed' to the bytes the line took from the stream, its
+ * terminator included
+ */
 BufferedReaderError buffered_reader_read_line(
   BufferedReader * reader,
   size_t max,
   char ** out_ptr,
+  size_t * out_consumed,
   uint32_t wait_time
   )
 {
@@ -103,11 +349,28 @@ BufferedReaderError buffered_reader_read_line(
   char * buffer = NULL, last = '\0', c;
   ssize_t receive_length;
   size_t copy_start, buffer_size = 0, read_size = 0, line_length = 0;
-  time_t start_time = time(NULL);
+  uint64_t deadline;
+  int ready;
+
+  if (reader->source)
+    return buffered_reader_read_source_line(
+        reader,
+        max,
+        out_ptr,
+        out_consumed
+        );
+
+  deadline = http_wait_now() + wait_time;
 
   if (reader->data_length)
   {
-    buffered_reader_accumulate(&buffer, &buffer_size, reader->data_length);
+    buffered_reader_mark_first_byte(reader);
+    buffered_reader_accumulate(
+        reader,
+        &buffer,
+        &buffer_size,
+        reader->data_length
+        );
     memcpy(buffer, &reader->data[reader->ptr_diff], reader->data_length);
   }
 
@@ -133,9 +396,9 @@ BufferedReaderError buffered_reader_read_line(
       last = c;
     }
 
-    if (!line_length)
+    if (!line_length && !err)
     {
-      if (start_time + wait_time < time(NULL))
+      if (http_wait_now() > deadline)
       {
         err = BUFFERED_READER_ERROR_TIMEOUT;
         continue;
@@ -143,28 +406,48 @@ BufferedReaderError buffered_reader_read_line(
 
       copy_start = buffer_size;
       buffered_reader_accumulate(
+          reader,
           &buffer,
           &buffer_size,
           _BUFFERED_READER_BUFFER_LENGTH
           );
       
       errno = 0;
-      receive_length = read(
-          reader->fd,
+      receive_length = buffered_reader_receive(
+          reader,
           &buffer[copy_start],
           _BUFFERED_READER_BUFFER_LENGTH
           );
 
       if (receive_length <= 0)
       {
-        if (errno != EWOULDBLOCK && errno != EAGAIN && errno != 0)
+        buffer_size -= _BUFFERED_READER_BUFFER_LENGTH;
+
+        if (receive_length == 0)
+          err = BUFFERED_READER_ERROR_END_OF_STREAM;
+        else if (errno == EINTR)
+          continue;
+        else if (errno != EWOULDBLOCK && errno != EAGAIN)
           err = BUFFERED_READER_ERROR_READ_FAILED;
         else
-          buffer_size -= _BUFFERED_READER_BUFFER_LENGTH;
-
+        {
+          ready = reader->wait(
+              reader->fd,
+              POLLIN,
+              http_wait_remaining(deadline),
+              reader->wait_context
+              );
+          if (ready == 0)
+            err = BUFFERED_READER_ERROR_TIMEOUT;
+          else if (ready < 0)
+            err = BUFFERED_READER_ERROR_READ_FAILED;
+        }
       }
       else
+      {
+        buffered_reader_mark_first_byte(reader);
         buffer_size -= _BUFFERED_READER_BUFFER_LENGTH - receive_length;
+      }
     }
   }
   while (!line_length && !err);
@@ -172,7 +455,8 @@ BufferedReaderError buffered_reader_read_line(
   if (!err)
   {
     buffer[line_length - 1] = '\0';
-    *out_ptr = strings_clone(buffer);
+    *out_ptr = http_allocator_clone(&reader->allocator, buffer);
+    *out_consumed = line_length + 1;
     reader->ptr_diff = 0;
 
     if (line_length + 1 == buffer_size)
@@ -185,7 +469,7 @@ BufferedReaderError buffered_reader_read_line(
     }
   }
 
-  free(buffer);
+  http_allocator_free(&reader->allocator, buffer);
 
   return err;
 }
@@ -6,6 +6,11 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "http_allocator.h"
+#include "http_capture.h"
+#include "http_io.h"
+#include "http_wait.h"
+
 enum BufferedReaderError
 {
   BUFFERED_READER_ERROR_NONE = 0,
@@ -13,6 +18,7 @@ enum BufferedReaderError
   BUFFERED_READER_ERROR_LINE_TOO_LONG = 2,
   BUFFERED_READER_ERROR_ENCOUNTERED_CC = 3,
   BUFFERED_READER_ERROR_READ_FAILED = 4,
+  BUFFERED_READER_ERROR_END_OF_STREAM = 5,
 };
 typedef enum BufferedReaderError BufferedReaderError;
 
@@ -21,9 +27,44 @@ struct BufferedReader;
 typedef struct BufferedReader BufferedReader;
 
 BufferedReader * buffered_reader_new(int fd);
+BufferedReader * buffered_reader_new_from_buffer(
+    const char * data,
+    size_t data_length
+    );
 void buffered_reader_destroy(BufferedReader * reader);
 
+void buffered_reader_set_read_function(
+    BufferedReader * reader,
+    HTTPReadFunction read,
+    void * context
+    );
+void buffered_reader_set_wait_function(
+    BufferedReader * reader,
+    HTTPWaitFunction wait,
+    void * context
+    );
+void buffered_reader_set_capture(
+    BufferedReader * reader,
+    HTTPCapture * capture,
+    uint64_t connection
+    );
+void buffered_reader_set_first_byte_time(
+    BufferedReader * reader,
+    uint64_t * time
+    );
+void buffered_reader_set_allocator(
+    BufferedReader * reader,
+    HTTPAllocator allocator
+    );
+int buffered_reader_wait(BufferedReader * reader, int timeout);
+
 bool buffered_reader_buffer_is_empty(BufferedReader * reader);
+bool buffered_reader_is_memory(BufferedReader * reader);
+size_t buffered_reader_view(
+    BufferedReader * reader,
+    size_t max,
+    const char ** out_ptr
+    );
 
 ssize_t buffered_reader_read(
     BufferedReader * reader,
@@ -34,7 +75,8 @@ BufferedReaderError buffered_reader_read_line(
   BufferedReader * reader,
   size_t max,
   char ** out_ptr,
-  uint32_t wait_time
+  size_t * out_consumed,
+  uint32_t wait_time /* in milliseconds */
   );
 
 
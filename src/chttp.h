@@ -8,17 +8,37 @@
 #define CHTTP_VERSION "0.5.1"
 
 
+#include "http_access_log.h"
+#include "http_allocator.h"
+#include "http_bulk.h"
+#include "http_cache.h"
+#include "http_capture.h"
 #include "http_content.h"
 #include "http_cookie.h"
+#include "http_cookie_token.h"
+#include "http_fiber.h"
+#include "http_io.h"
 #include "http_message.h"
+#include "http_metrics.h"
 #include "http_method.h"
+#include "http_mpsc_queue.h"
 #include "http_request.h"
+#include "http_replay.h"
 #include "http_response.h"
 #include "http_reader.h"
+#include "http_reader_error.h"
+#include "http_server.h"
+#include "http_spsc_ring.h"
 #include "http_status_code.h"
+#include "http_timer_wheel.h"
+#include "http_transport.h"
+#include "http_uring.h"
 #include "http_utils.h"
 #include "http_version.h"
+#include "http_wait.h"
+#include "http_worker_pool.h"
 #include "http_writer.h"
+#include "http_writer_error.h"
 
 #endif
 
@@ -0,0 +1,500 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_access_log.h"
+
+
+#define _HTTP_ACCESS_LOG_CACHE_LINE 64
+#define _HTTP_ACCESS_LOG_RING_COUNT 0x40 /* threads recording at a time */
+#define _HTTP_ACCESS_LOG_RING_LENGTH 0x40000 /* a power of two */
+#define _HTTP_ACCESS_LOG_LINE_LENGTH 0x800
+#define _HTTP_ACCESS_LOG_INTERVAL 10 /* between writes, in milliseconds */
+
+
+struct HTTPAccessLogRing;
+typedef struct HTTPAccessLogRing HTTPAccessLogRing;
+
+/* the bytes of the lines of one thread at a time. as in HTTPSPSCRing, the
+ * recording thread owns `tail' and the log's thread `head', each on a
+ * cache line of its own. a ring outlives the thread which claimed it,
+ * and is claimed again by the next thread to need one
+ */
+struct HTTPAccessLogRing
+{
+  char * data;
+  bool owned; /* by a thread which has not yet exited */
+
+  _Alignas(_HTTP_ACCESS_LOG_CACHE_LINE) uint32_t head;
+
+  _Alignas(_HTTP_ACCESS_LOG_CACHE_LINE) uint32_t tail;
+  uint32_t cached_head; /* the recording thread's copy */
+};
+
+struct HTTPAccessLog
+{
+  int fd;
+  pthread_t thread;
+  pthread_key_t key; /* each thread's ring */
+  pthread_mutex_t lock;
+  pthread_cond_t changed; /* on the monotonic clock */
+  bool stopping, failed;
+  uint64_t dropped;
+
+  /* claimed as threads first record; the rest are NULL */
+  HTTPAccessLogRing * rings [_HTTP_ACCESS_LOG_RING_COUNT];
+};
+
+
+static HTTPAccessLogRing * http_access_log_ring_new(void)
+{
+  HTTPAccessLogRing * ret;
+
+  ret = (HTTPAccessLogRing *) aligned_alloc(
+      _HTTP_ACCESS_LOG_CACHE_LINE,
+      sizeof(HTTPAccessLogRing)
+      );
+  assert(ret);
+
+  ret->data = (char *) malloc(_HTTP_ACCESS_LOG_RING_LENGTH);
+  assert(ret->data);
+
+  ret->owned = true;
+  ret->head = 0;
+  ret->tail = 0;
+  ret->cached_head = 0;
+
+  return ret;
+}
+
+static void http_access_log_ring_destroy(HTTPAccessLogRing * ring)
+{
+  free(ring->data);
+  free(ring);
+}
+
+/* run as each thread which claimed a ring exits */
+static void http_access_log_ring_release(void * value)
+{
+  HTTPAccessLogRing * ring = (HTTPAccessLogRing *) value;
+
+  __atomic_store_n(&ring->owned, false, __ATOMIC_RELEASE);
+}
+
+/* a ring for the calling thread: one released by an exited thread, or a
+ * new one. NULL if as many threads as there can be rings hold one
+ */
+static HTTPAccessLogRing * http_access_log_claim_ring(HTTPAccessLog * log)
+{
+  HTTPAccessLogRing * ring, * none;
+  bool owned;
+
+  for (size_t k = 0; k < _HTTP_ACCESS_LOG_RING_COUNT; k++)
+  {
+    ring = __atomic_load_n(&log->rings[k], __ATOMIC_ACQUIRE);
+    if (!ring)
+    {
+      ring = http_access_log_ring_new();
+      none = NULL;
+      if (
+        __atomic_compare_exchange_n(
+            &log->rings[k],
+            &none,
+            ring,
+            false,
+            __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE
+            )
+        )
+        return ring;
+
+      /* another thread took the slot first */
+      http_access_log_ring_destroy(ring);
+      ring = none;
+    }
+
+    owned = false;
+    if (
+      __atomic_compare_exchange_n(
+          &ring->owned,
+          &owned,
+          true,
+          false,
+          __ATOMIC_ACQUIRE,
+          __ATOMIC_RELAXED
+          )
+      )
+      return ring;
+  }
+
+  return NULL;
+}
+
+/* recording thread only; false if the ring has too little room */
+static bool http_access_log_ring_push(
+    HTTPAccessLogRing * ring,
+    const char * line,
+    uint32_t length
+    )
+{
+  uint32_t tail, offset, part;
+
+  tail = ring->tail;
+  if (_HTTP_ACCESS_LOG_RING_LENGTH - (tail - ring->cached_head) < length)
+  {
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (_HTTP_ACCESS_LOG_RING_LENGTH - (tail - ring->cached_head) < length)
+      return false;
+  }
+
+  offset = tail & (_HTTP_ACCESS_LOG_RING_LENGTH - 1);
+  part = _HTTP_ACCESS_LOG_RING_LENGTH - offset;
+  if (part > length)
+    part = length;
+
+  memcpy(&ring->data[offset], line, part);
+  memcpy(ring->data, &line[part], length - part);
+  __atomic_store_n(&ring->tail, tail + length, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+/* copies as much of `target' as fits `size' bytes into `out', with what
+ * would split its field or its line, or pass for something it is not,
+ * written as \xNN
+ */
+static void http_access_log_escape(
+    char * out,
+    size_t size,
+    const char * target
+    )
+{
+  static const char digits [] = "0123456789abcdef";
+  unsigned char c;
+  size_t k = 0;
+
+  for (; *target; target++)
+  {
+    c = (unsigned char) *target;
+    if (c > ' ' && c < 0x7f && c != '\\')
+    {
+      if (k + 1 >= size)
+        break;
+      out[k++] = c;
+    }
+    else
+    {
+      if (k + 4 >= size)
+        break;
+      out[k++] = '\\';
+      out[k++] = 'x';
+      out[k++] = digits[c >> 4];
+      out[k++] = digits[c & 0xf];
+    }
+  }
+
+  out[k] = 0;
+}
+
+static uint32_t http_access_log_format(
+    char * line,
+    const HTTPAccessLogRecord * record
+    )
+{
+  char target [_HTTP_ACCESS_LOG_LINE_LENGTH];
+  struct timespec now;
+  struct tm time;
+  int length;
+
+  if (record->target)
+    http_access_log_escape(target, sizeof(target), record->target);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  gmtime_r(&now.tv_sec, &time);
+
+  length = snprintf(
+      line,
+      _HTTP_ACCESS_LOG_LINE_LENGTH,
+      "%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ %s %s %d %llu %llu %llu %llu\n",
+      time.tm_year + 1900,
+      time.tm_mon + 1,
+      time.tm_mday,
+      time.tm_hour,
+      time.tm_min,
+      time.tm_sec,
+      now.tv_nsec / 1000000L,
+      record->method ? http_method_get_string(record->method) : "-",
+      record->target ? target : "-",
+      (int) record->status_code,
+      (unsigned long long) record->content_length,
+      (unsigned long long) (record->parse_time / 1000),
+      (unsigned long long) (record->handle_time / 1000),
+      (unsigned long long) (record->render_time / 1000)
+      );
+  assert(length > 0);
+
+  /* cut short, keeping the line a line */
+  if (length >= _HTTP_ACCESS_LOG_LINE_LENGTH)
+  {
+    length = _HTTP_ACCESS_LOG_LINE_LENGTH - 1;
+    line[length - 1] = '\n';
+  }
+
+  return length;
+}
+
+/* writes all of `iov', giving up on the first failure */
+static void http_access_log_write(
+    HTTPAccessLog * log,
+    struct iovec * iov,
+    int count
+    )
+{
+  ssize_t written;
+
+  while (count > 0 && !log->failed)
+  {
+    written = writev(log->fd, iov, count);
+    if (written < 0)
+    {
+      if (errno != EINTR)
+        log->failed = true;
+      continue;
+    }
+
+    while (count > 0 && (size_t) written >= iov->iov_len)
+    {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = (char *) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
+/* log's thread only; writes out every ring in one go. once the log has
+ * failed, the rings are emptied all the same
+ */
+static void http_access_log_drain(HTTPAccessLog * log)
+{
+  struct iovec iov [2 * _HTTP_ACCESS_LOG_RING_COUNT];
+  uint32_t tails [_HTTP_ACCESS_LOG_RING_COUNT];
+  uint32_t head, offset, length, part;
+  HTTPAccessLogRing * rings [_HTTP_ACCESS_LOG_RING_COUNT], * ring;
+  size_t ring_count;
+  int count = 0;
+
+  /* rings are claimed in order, so those there are come first */
+  for (
+    ring_count = 0;
+    ring_count < _HTTP_ACCESS_LOG_RING_COUNT;
+    ring_count++
+    )
+  {
+    rings[ring_count] =
+      __atomic_load_n(&log->rings[ring_count], __ATOMIC_ACQUIRE);
+    if (!rings[ring_count])
+      break;
+  }
+
+  for (size_t k = 0; k < ring_count; k++)
+  {
+    ring = rings[k];
+
+    head = ring->head;
+    tails[k] = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    length = tails[k] - head;
+    if (!length)
+      continue;
+
+    offset = head & (_HTTP_ACCESS_LOG_RING_LENGTH - 1);
+    part = _HTTP_ACCESS_LOG_RING_LENGTH - offset;
+    if (part > length)
+      part = length;
+
+    iov[count].iov_base = &ring->data[offset];
+    iov[count].iov_len = part;
+    count++;
+    if (length > part)
+    {
+      iov[count].iov_base = ring->data;
+      iov[count].iov_len = length - part;
+      count++;
+    }
+  }
+
+  if (!count)
+    return;
+
+  http_access_log_write(log, iov, count);
+
+  for (size_t k = 0; k < ring_count; k++)
+    __atomic_store_n(&rings[k]->head, tails[k], __ATOMIC_RELEASE);
+}
+
+static void * http_access_log_run(void * context)
+{
+  HTTPAccessLog * log = (HTTPAccessLog *) context;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&log->lock);
+
+  while (!log->stopping)
+  {
+    pthread_mutex_unlock(&log->lock);
+    http_access_log_drain(log);
+    pthread_mutex_lock(&log->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += _HTTP_ACCESS_LOG_INTERVAL * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (
+      !log->stopping &&
+      pthread_cond_timedwait(&log->changed, &log->lock, &deadline) !=
+        ETIMEDOUT
+      );
+  }
+
+  pthread_mutex_unlock(&log->lock);
+
+  http_access_log_drain(log);
+
+  return NULL;
+}
+
+
+HTTPAccessLog * http_access_log_open(const char * path)
+{
+  pthread_condattr_t attributes;
+  HTTPAccessLog * ret;
+  int fd, error;
+
+  assert(path);
+
+  fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return NULL;
+
+  ret = (HTTPAccessLog *) malloc(sizeof(HTTPAccessLog));
+  assert(ret);
+
+  ret->fd = fd;
+  ret->stopping = false;
+  ret->failed = false;
+  ret->dropped = 0;
+  memset(ret->rings, 0, sizeof(ret->rings));
+
+  if (pthread_key_create(&ret->key, http_access_log_ring_release))
+  {
+    error = errno;
+    close(fd);
+    free(ret);
+    errno = error;
+    return NULL;
+  }
+
+  pthread_mutex_init(&ret->lock, NULL);
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&ret->changed, &attributes);
+  pthread_condattr_destroy(&attributes);
+
+  error = pthread_create(&ret->thread, NULL, http_access_log_run, ret);
+  if (error)
+  {
+    pthread_cond_destroy(&ret->changed);
+    pthread_mutex_destroy(&ret->lock);
+    pthread_key_delete(ret->key);
+    close(fd);
+    free(ret);
+    errno = error;
+    return NULL;
+  }
+
+  return ret;
+}
+
+bool http_access_log_close(HTTPAccessLog * log)
+{
+  bool ret;
+
+  assert(log);
+
+  pthread_mutex_lock(&log->lock);
+  log->stopping = true;
+  pthread_cond_signal(&log->changed);
+  pthread_mutex_unlock(&log->lock);
+
+  pthread_join(log->thread, NULL);
+
+  ret = !log->failed;
+  if (close(log->fd) != 0)
+    ret = false;
+
+  pthread_key_delete(log->key);
+  for (size_t k = 0; k < _HTTP_ACCESS_LOG_RING_COUNT; k++)
+  {
+    if (log->rings[k])
+      http_access_log_ring_destroy(log->rings[k]);
+  }
+
+  pthread_cond_destroy(&log->changed);
+  pthread_mutex_destroy(&log->lock);
+  free(log);
+
+  return ret;
+}
+
+void http_access_log_record(
+    HTTPAccessLog * log,
+    const HTTPAccessLogRecord * record
+    )
+{
+  char line [_HTTP_ACCESS_LOG_LINE_LENGTH];
+  HTTPAccessLogRing * ring;
+  uint32_t length;
+
+  assert(log);
+  assert(record);
+
+  ring = (HTTPAccessLogRing *) pthread_getspecific(log->key);
+  if (!ring)
+  {
+    ring = http_access_log_claim_ring(log);
+    if (ring)
+      pthread_setspecific(log->key, ring);
+  }
+
+  length = http_access_log_format(line, record);
+  if (!ring || !http_access_log_ring_push(ring, line, length))
+    __atomic_fetch_add(&log->dropped, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t http_access_log_get_dropped(HTTPAccessLog * log)
+{
+  assert(log);
+
+  return __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+}
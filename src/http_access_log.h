@@ -0,0 +1,65 @@
+
+
+#ifndef __CHTTP_HTTP_ACCESS_LOG_H
+#define __CHTTP_HTTP_ACCESS_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http_method.h"
+#include "http_status_code.h"
+
+
+/* a log of one line per response, appended to a file. the thread which
+ * records a response formats its line into a lock-free ring of its own;
+ * a thread of the log's writes out all the rings together, in a writev
+ * every few milliseconds. recording never blocks or makes a system call:
+ * a line which does not fit its ring is dropped, and counted. lines are
+ *
+ *   <time> <method> <target> <status> <bytes> <parse> <handle> <render>
+ *
+ * the time in UTC to the millisecond (as 2026-01-31T23:59:59.999Z), the
+ * length of the response content, then the phases in microseconds. the
+ * target has its white space, control characters, backslashes and bytes
+ * past ASCII written as \xNN. a request which could not be parsed has `-'
+ * for its method and target. the lines of different threads may be
+ * written out of order
+ */
+struct HTTPAccessLog;
+typedef struct HTTPAccessLog HTTPAccessLog;
+
+struct HTTPAccessLogRecord
+{
+  HTTPMethod method; /* HTTP_METHOD_NONE if the request was not parsed */
+  const char * target; /* likewise NULL */
+  HTTPStatusCode status_code;
+  uint64_t content_length;
+  uint64_t
+    parse_time, /* all in nanoseconds */
+    handle_time,
+    render_time;
+};
+typedef struct HTTPAccessLogRecord HTTPAccessLogRecord;
+
+
+/* appends to `path', creating it if need be; NULL (with errno set) on
+ * failure
+ */
+HTTPAccessLog * http_access_log_open(const char * path);
+
+/* writes out what was recorded before. false if anything failed to be
+ * written. no thread may be recording meanwhile
+ */
+bool http_access_log_close(HTTPAccessLog * log);
+
+/* from any thread */
+void http_access_log_record(
+    HTTPAccessLog * log,
+    const HTTPAccessLogRecord * record
+    );
+
+/* the lines dropped for want of room */
+uint64_t http_access_log_get_dropped(HTTPAccessLog * log);
+
+
+#endif
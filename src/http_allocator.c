@@ -0,0 +1,124 @@
+
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_metrics.h"
+
+#include "http_allocator.h"
+
+
+static HTTPAllocator http_allocator_global = { NULL, NULL, NULL, NULL };
+
+
+void chttp_set_allocator(HTTPAllocator allocator)
+{
+  http_allocator_global = allocator;
+}
+
+HTTPAllocator chttp_get_allocator(void)
+{
+  return http_allocator_global;
+}
+
+void * chttp_malloc(size_t size)
+{
+  return http_allocator_malloc(&http_allocator_global, size);
+}
+
+void * chttp_realloc(void * data, size_t size)
+{
+  return http_allocator_realloc(&http_allocator_global, data, size);
+}
+
+void chttp_free(void * data)
+{
+  http_allocator_free(&http_allocator_global, data);
+}
+
+void * http_allocator_malloc(const HTTPAllocator * allocator, size_t size)
+{
+  assert(allocator);
+
+  http_metrics_add(HTTP_METRIC_ALLOCATIONS, 1);
+
+  if (allocator->malloc)
+    return allocator->malloc(size, allocator->context);
+  return malloc(size);
+}
+
+void * http_allocator_realloc(
+    const HTTPAllocator * allocator,
+    void * data,
+    size_t size
+    )
+{
+  assert(allocator);
+
+  if (!data)
+    http_metrics_add(HTTP_METRIC_ALLOCATIONS, 1);
+
+  if (allocator->realloc)
+    return allocator->realloc(data, size, allocator->context);
+  return realloc(data, size);
+}
+
+void http_allocator_free(const HTTPAllocator * allocator, void * data)
+{
+  assert(allocator);
+
+  if (!data)
+    return;
+  if (allocator->free)
+    allocator->free(data, allocator->context);
+  else
+    free(data);
+}
+
+char * http_allocator_clone(
+    const HTTPAllocator * allocator,
+    const char * string
+    )
+{
+  size_t length;
+  char * ret;
+
+  assert(string);
+
+  length = strlen(string);
+  ret = (char *) http_allocator_malloc(allocator, length + 1);
+  assert(ret);
+  memcpy(ret, string, length + 1);
+
+  return ret;
+}
+
+char * http_allocator_format(
+    const HTTPAllocator * allocator,
+    const char * format,
+    ...
+    )
+{
+  va_list arguments;
+  char * ret;
+  int length;
+
+  assert(format);
+
+  va_start(arguments, format);
+  length = vsnprintf(NULL, 0, format, arguments);
+  va_end(arguments);
+  assert(length >= 0);
+
+  ret = (char *) http_allocator_malloc(allocator, length + 1);
+  assert(ret);
+
+  va_start(arguments, format);
+  vsnprintf(ret, length + 1, format, arguments);
+  va_end(arguments);
+
+  return ret;
+}
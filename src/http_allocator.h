@@ -0,0 +1,55 @@
+
+
+#ifndef __CHTTP_HTTP_ALLOCATOR_H
+#define __CHTTP_HTTP_ALLOCATOR_H
+
+#include <stddef.h>
+
+
+/* where chttp gets the memory it both allocates and frees itself: its
+ * readers, writers, messages and cookies, what they own (targets, status
+ * messages, cookie fields and content) and their working buffers. the
+ * strings, lists and dictionaries handed to the caller still come from
+ * baselib, to be freed with free() as ever. a NULL function stands for
+ * the C library's own
+ */
+struct HTTPAllocator
+{
+  void * (*malloc)(size_t size, void * context);
+  void * (*realloc)(void * data, size_t size, void * context);
+  void (*free)(void * data, void * context);
+  void * context;
+};
+typedef struct HTTPAllocator HTTPAllocator;
+
+
+/* the allocator of everything made from then on without one of its own.
+ * set it before anything is made, and before other threads are started
+ */
+void chttp_set_allocator(HTTPAllocator allocator);
+HTTPAllocator chttp_get_allocator(void);
+
+void * chttp_malloc(size_t size);
+void * chttp_realloc(void * data, size_t size);
+void chttp_free(void * data);
+
+void * http_allocator_malloc(const HTTPAllocator * allocator, size_t size);
+void * http_allocator_realloc(
+    const HTTPAllocator * allocator,
+    void * data,
+    size_t size
+    );
+void http_allocator_free(const HTTPAllocator * allocator, void * data);
+
+char * http_allocator_clone(
+    const HTTPAllocator * allocator,
+    const char * string
+    );
+char * http_allocator_format(
+    const HTTPAllocator * allocator,
+    const char * format,
+    ...
+    );
+
+
+#endif
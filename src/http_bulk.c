@@ -0,0 +1,325 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http_message.h"
+#include "http_status_code.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "http_reader.h"
+#include "http_utils.h"
+#include "http_worker_pool.h"
+
+#include "http_bulk.h"
+
+
+/* the calling thread splits the stream into segments of whole messages
+ * with a scan for their ends that parses nothing, and hands the segments
+ * to a worker pool as it goes. a bounded number are in flight at once, so
+ * memory stays flat however long the stream
+ */
+
+#define _HTTP_BULK_SEGMENT_LENGTH 0x40000 /* bytes of messages per task */
+#define _HTTP_BULK_WINDOW 4 /* segments in flight per thread */
+
+struct HTTPBulkRun;
+typedef struct HTTPBulkRun HTTPBulkRun;
+struct HTTPBulkSegment;
+typedef struct HTTPBulkSegment HTTPBulkSegment;
+
+struct HTTPBulkRun
+{
+  HTTPBulkSettings settings;
+  HTTPBulkCallback callback;
+  void * context;
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished; /* a segment is done */
+};
+
+struct HTTPBulkSegment
+{
+  HTTPWorkerTask task;
+  HTTPBulkRun * run;
+  HTTPBulkSegment * next; /* submitted after this one */
+
+  const char * data;
+  size_t length;
+  uint64_t first_index, count;
+  HTTPMessage ** messages; /* parsed but not yet called back, if ordered */
+  bool done;
+};
+
+
+/* the length of the message at the start of `data', as far as its headers
+ * tell. a request without Content-Length has no content, while a response
+ * without runs to the end of the stream, as http_reader_next has it
+ */
+static size_t http_bulk_scan(const char * data, size_t length)
+{
+  unsigned long long content_length;
+  size_t header_length;
+  const char * end;
+
+  end = (const char *) memmem(data, length, "\r\n\r\n", 4);
+  if (!end)
+    return length;
+
+  header_length = end - data + 4;
+  switch (http_utils_scan_content_length(data, header_length, &content_length))
+  {
+    case -1: /* for the reader to fail on */
+      return header_length;
+    case 0:
+      if (length >= 5 && memcmp(data, "HTTP/", 5) == 0)
+        return length;
+      return header_length;
+  }
+
+  if (content_length > length - header_length)
+    return length;
+
+  return header_length + content_length;
+}
+
+/* on a worker. a message which fails to parse leaves the reader lost, so
+ * the next one starts a fresh reader at its scanned start
+ */
+static void http_bulk_segment_run(HTTPWorkerTask * task)
+{
+  HTTPBulkSegment * segment = (HTTPBulkSegment *) task;
+  HTTPBulkRun * run = segment->run;
+  HTTPReader * reader = NULL;
+  HTTPMessage * message;
+  size_t position = 0;
+
+  for (uint64_t k = 0; k < segment->count; k++)
+  {
+    if (!reader)
+    {
+      reader = http_reader_new_from_buffer(
+          &segment->data[position],
+          segment->length - position
+          );
+      http_reader_set_borrow_content(reader, run->settings.borrow_content);
+    }
+
+    message = http_reader_next(reader);
+    if (!message)
+    {
+      http_reader_destroy(reader);
+      reader = NULL;
+    }
+
+    position += http_bulk_scan(
+        &segment->data[position],
+        segment->length - position
+        );
+
+    if (run->settings.ordered)
+      segment->messages[k] = message;
+    else
+      run->callback(message, segment->first_index + k, run->context);
+  }
+
+  if (reader)
+    http_reader_destroy(reader);
+
+  pthread_mutex_lock(&run->lock);
+  segment->done = true;
+  pthread_cond_broadcast(&run->finished);
+  pthread_mutex_unlock(&run->lock);
+}
+
+/* waits for the segment, calls back for it if that is left to the calling
+ * thread, and frees it. returns the one after
+ */
+static HTTPBulkSegment * http_bulk_segment_finish(HTTPBulkSegment * segment)
+{
+  HTTPBulkRun * run = segment->run;
+  HTTPBulkSegment * ret = segment->next;
+
+  pthread_mutex_lock(&run->lock);
+  while (!segment->done)
+    pthread_cond_wait(&run->finished, &run->lock);
+  pthread_mutex_unlock(&run->lock);
+
+  if (run->settings.ordered)
+  {
+    for (uint64_t k = 0; k < segment->count; k++)
+      run->callback(
+          segment->messages[k],
+          segment->first_index + k,
+          run->context
+          );
+  }
+
+  free(segment->messages);
+  free(segment);
+
+  return ret;
+}
+
+
+HTTPBulkSettings http_bulk_get_default_settings(void)
+{
+  HTTPBulkSettings ret;
+
+  ret.thread_count = 0;
+  ret.ordered = false;
+  ret.borrow_content = false;
+
+  return ret;
+}
+
+uint64_t http_bulk_parse(
+    const char * data,
+    size_t length,
+    HTTPBulkSettings settings,
+    HTTPBulkCallback callback,
+    void * context
+    )
+{
+  HTTPBulkSegment * segment, * first = NULL, * last = NULL;
+  HTTPWorkerPool * pool;
+  HTTPBulkRun run;
+  uint32_t in_flight = 0, window;
+  uint64_t index = 0;
+  size_t position = 0, start;
+  long cpus;
+
+  assert(data || length == 0);
+  assert(callback);
+
+  if (settings.thread_count == 0)
+  {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    settings.thread_count = cpus > 0 ? cpus : 1;
+  }
+
+  run.settings = settings;
+  run.callback = callback;
+  run.context = context;
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_cond_init(&run.finished, NULL);
+
+  pool = http_worker_pool_new(settings.thread_count);
+  window = settings.thread_count * _HTTP_BULK_WINDOW;
+
+  while (position < length)
+  {
+    segment = (HTTPBulkSegment *) calloc(1, sizeof(HTTPBulkSegment));
+    assert(segment);
+
+    segment->run = &run;
+    segment->data = &data[position];
+    segment->first_index = index;
+
+    start = position;
+    do
+    {
+      position += http_bulk_scan(&data[position], length - position);
+      segment->count++;
+    }
+    while (
+      position < length &&
+      position - start < _HTTP_BULK_SEGMENT_LENGTH
+      );
+
+    segment->length = position - start;
+    index += segment->count;
+
+    if (settings.ordered)
+    {
+      segment->messages = (HTTPMessage **)
+        malloc(sizeof(HTTPMessage *) * segment->count);
+      assert(segment->messages);
+    }
+
+    if (in_flight == window)
+    {
+      first = http_bulk_segment_finish(first);
+      in_flight--;
+    }
+
+    if (first)
+      last->next = segment;
+    else
+      first = segment;
+    last = segment;
+    in_flight++;
+
+    http_worker_task_init(&segment->task, http_bulk_segment_run);
+    http_worker_pool_submit(pool, &segment->task);
+  }
+
+  while (first)
+    first = http_bulk_segment_finish(first);
+
+  http_worker_pool_destroy(pool);
+  pthread_mutex_destroy(&run.lock);
+  pthread_cond_destroy(&run.finished);
+
+  return index;
+}
+
+bool http_bulk_parse_file(
+    const char * path,
+    HTTPBulkSettings settings,
+    HTTPBulkCallback callback,
+    void * context
+    )
+{
+  struct stat status;
+  void * mapping;
+  int fd;
+
+  assert(path);
+  assert(callback);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  if (status.st_size == 0)
+  {
+    close(fd);
+    return true;
+  }
+
+  mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+
+  madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+  http_bulk_parse(
+      (const char *) mapping,
+      status.st_size,
+      settings,
+      callback,
+      context
+      );
+
+  munmap(mapping, status.st_size);
+
+  return true;
+}
@@ -0,0 +1,59 @@
+
+
+#ifndef __CHTTP_HTTP_BULK_H
+#define __CHTTP_HTTP_BULK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_message.h"
+
+
+/* called once per message of the stream, with its position in it. the
+ * message is NULL if it failed to parse. otherwise it (and its content,
+ * unless borrowed) becomes the callback's
+ */
+typedef void (*HTTPBulkCallback)(
+    HTTPMessage * message,
+    uint64_t index,
+    void * context
+    );
+
+struct HTTPBulkSettings
+{
+  uint32_t thread_count; /* parsing threads; 0 for one per CPU */
+  bool
+    ordered, /* call back on the calling thread, in stream order */
+    borrow_content; /* as per http_reader_set_borrow_content */
+};
+typedef struct HTTPBulkSettings HTTPBulkSettings;
+
+
+HTTPBulkSettings http_bulk_get_default_settings(void);
+
+/* parses the back-to-back messages in `data' on several threads, calling
+ * `callback' from those threads (in no particular order) or, if ordered,
+ * from the calling thread in order. returns the number of messages
+ */
+uint64_t http_bulk_parse(
+    const char * data,
+    size_t length,
+    HTTPBulkSettings settings,
+    HTTPBulkCallback callback,
+    void * context
+    );
+
+/* http_bulk_parse on the file at `path', mapped into memory. false (with
+ * errno set) if it cannot be mapped. borrowed content lives only until
+ * this returns
+ */
+bool http_bulk_parse_file(
+    const char * path,
+    HTTPBulkSettings settings,
+    HTTPBulkCallback callback,
+    void * context
+    );
+
+
+#endif
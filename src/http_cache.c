@@ -0,0 +1,1112 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "http_message.h"
+#include "http_method.h"
+#include "http_utils.h"
+#include "http_wait.h"
+#include "http_writer.h"
+
+#include "http_cache.h"
+
+
+#define _HTTP_CACHE_CACHE_LINE 64
+#define _HTTP_CACHE_SHARD_COUNT 0x10 /* a power of two */
+#define _HTTP_CACHE_INITIAL_BUCKET_COUNT 0x40 /* likewise */
+#define _HTTP_CACHE_UNCACHEABLE_LIFETIME 10000 /* in ms */
+
+
+struct HTTPCacheShard;
+typedef struct HTTPCacheShard HTTPCacheShard;
+struct HTTPCacheBuffer;
+typedef struct HTTPCacheBuffer HTTPCacheBuffer;
+
+/* a response, or the names of the request headers the responses to its
+ * host, path and query vary by. the latter are found under the host, path
+ * and query alone, and the former (if they vary) under those and the
+ * headers' values. with neither, it marks a host, path and query a flight
+ * ended on without anything to cache, so misses on it skip flights for a
+ * while
+ */
+struct HTTPCacheEntry
+{
+  HTTPCacheEntry * next; /* in its bucket */
+  HTTPCacheEntry * newer, * older; /* in its shard's order of use */
+  uint64_t hash;
+  char * key;
+  uint64_t expires; /* as per http_wait_now */
+  size_t size; /* counted against its shard's share of the capacity */
+  uint32_t references; /* by those holding it, not by its shard */
+  bool cached; /* it is its shard's */
+
+  /* lowercased header names, each followed by a comma; NULL if none */
+  char * vary;
+
+  /* NULL in the names of the headers a response varies by */
+  char * data;
+  size_t length, content_length;
+  size_t date_offset, date_length; /* of its Date value; 0 if none */
+  HTTPStatusCode status_code;
+
+  char * etag; /* without any W/; NULL if none */
+  char * not_modified;
+  size_t not_modified_length;
+  size_t not_modified_date_offset, not_modified_date_length;
+};
+
+struct HTTPCacheShard
+{
+  _Alignas(_HTTP_CACHE_CACHE_LINE) pthread_mutex_t lock;
+  HTTPCacheEntry ** buckets;
+  size_t bucket_count, count, size;
+  HTTPCacheEntry * newest, * oldest;
+  HTTPCacheFlight * flights;
+};
+
+struct HTTPCache
+{
+  size_t shard_capacity;
+  HTTPCacheShard shards [_HTTP_CACHE_SHARD_COUNT];
+};
+
+/* a request for a host, path and query let through while others wait on
+ * it
+ */
+struct HTTPCacheFlight
+{
+  HTTPCacheFlight * next; /* in its shard */
+  uint64_t hash;
+  char * key;
+  HTTPCacheWaiter * waiters, ** last_waiter;
+};
+
+/* what an HTTPWriter renders into */
+struct HTTPCacheBuffer
+{
+  char * data;
+  size_t length, capacity;
+};
+
+
+static uint64_t http_cache_hash(const char * key)
+{
+  uint64_t ret = 0xCBF29CE484222325ULL;
+
+  for (; *key; key++)
+    ret = (ret ^ (unsigned char) *key) * 0x100000001B3ULL;
+
+  return ret;
+}
+
+static HTTPCacheShard * http_cache_get_shard(HTTPCache * cache, uint64_t hash)
+{
+  return &cache->shards[hash & (_HTTP_CACHE_SHARD_COUNT - 1)];
+}
+
+static void http_cache_entry_free(HTTPCacheEntry * entry)
+{
+  free(entry->key);
+  free(entry->vary);
+  free(entry->data);
+  free(entry->etag);
+  free(entry->not_modified);
+  free(entry);
+}
+
+/* the next element of a comma separated list, trimmed, or NULL at its
+ * end. `*cursor' is cut up as it goes
+ */
+static char * http_cache_next_element(char ** cursor)
+{
+  char * ret, * end;
+
+  while (**cursor == ',' || isspace((unsigned char) **cursor))
+    (*cursor)++;
+  if (!**cursor)
+    return NULL;
+
+  ret = *cursor;
+  end = strchr(ret, ',');
+  if (end)
+  {
+    *cursor = end + 1;
+    *end = '\0';
+  }
+  else
+    *cursor = ret + strlen(ret);
+
+  end = ret + strlen(ret);
+  while (end > ret && isspace((unsigned char) end[-1]))
+    *--end = '\0';
+
+  return ret;
+}
+
+/* whether a Cache-Control directive is `name', with or without a value */
+static bool http_cache_directive_is(const char * directive, const char * name)
+{
+  size_t length = strlen(name);
+
+  return
+    strncasecmp(directive, name, length) == 0 &&
+    (directive[length] == '\0' || directive[length] == '=');
+}
+
+static bool http_cache_message_has_directive(
+    HTTPMessage * message,
+    const char * name
+    )
+{
+  char * value, * cursor, * directive;
+  bool ret = false;
+
+  value = http_message_get_header(message, "Cache-Control");
+  if (!value)
+    return false;
+
+  cursor = value;
+  while (!ret && (directive = http_cache_next_element(&cursor)))
+    ret = http_cache_directive_is(directive, name);
+
+  free(value);
+
+  return ret;
+}
+
+/* how long `response' stays fresh, in seconds; 0 if it may not be kept */
+static uint64_t http_cache_get_freshness(HTTPResponse * response)
+{
+  long long max_age = -1, s_maxage = -1, ret;
+  char * value, * cursor, * directive;
+  time_t expires, date;
+
+  value = http_message_get_header((HTTPMessage *) response, "Cache-Control");
+  if (value)
+  {
+    cursor = value;
+    while ((directive = http_cache_next_element(&cursor)))
+    {
+      if (
+        http_cache_directive_is(directive, "no-store") ||
+        http_cache_directive_is(directive, "no-cache") ||
+        http_cache_directive_is(directive, "private")
+        )
+      {
+        free(value);
+        return 0;
+      }
+      else if (strncasecmp(directive, "s-maxage=", 9) == 0)
+        s_maxage = strtoll(&directive[9], NULL, 10);
+      else if (strncasecmp(directive, "max-age=", 8) == 0)
+        max_age = strtoll(&directive[8], NULL, 10);
+    }
+    free(value);
+  }
+
+  if (s_maxage >= 0)
+    ret = s_maxage;
+  else if (max_age >= 0)
+    ret = max_age;
+  else
+  {
+    value = http_message_get_header((HTTPMessage *) response, "Expires");
+    if (!value)
+      return 0;
+    expires = http_utils_parse_date(value);
+    free(value);
+    if (!expires)
+      return 0;
+
+    date = http_message_get_date((HTTPMessage *) response);
+    if (!date)
+      date = time(NULL);
+    ret = (long long) expires - (long long) date;
+  }
+
+  return ret > 0 ? (uint64_t) ret : 0;
+}
+
+static bool http_cache_status_code_is_cacheable(HTTPStatusCode status_code)
+{
+  switch (status_code)
+  {
+    case HTTP_STATUS_CODE_200_OK:
+    case HTTP_STATUS_CODE_203_NON_AUTHORITATIVE_INFORMATION:
+    case HTTP_STATUS_CODE_204_NO_CONTENT:
+    case HTTP_STATUS_CODE_300_MULTIPLE_CHOICES:
+    case HTTP_STATUS_CODE_301_MOVED_PERMANENTLY:
+    case HTTP_STATUS_CODE_308_PERMANENT_REDIRECT:
+    case HTTP_STATUS_CODE_404_NOT_FOUND:
+    case HTTP_STATUS_CODE_405_METHOD_NOT_ALLOWED:
+    case HTTP_STATUS_CODE_410_GONE:
+    case HTTP_STATUS_CODE_414_URI_TOO_LONG:
+    case HTTP_STATUS_CODE_501_NOT_IMPLEMENTED:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* whether the cache may answer the request at all */
+static bool http_cache_may_answer(HTTPRequest * request)
+{
+  return
+    http_request_get_method(request) == HTTP_METHOD_GET &&
+    !http_message_has_header((HTTPMessage *) request, "Authorization") &&
+    !http_cache_message_has_directive((HTTPMessage *) request, "no-cache");
+}
+
+static int http_cache_compare_parameters(const void * a, const void * b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* appends `str' with every byte a key could be split on or mistaken at
+ * (a percent sign, a question mark, white space, control characters and
+ * whatever is not ASCII) escaped as %XX, so no two strings append alike
+ * and none appends a newline, which only ever separates a Vary key's
+ * headers
+ */
+static void http_cache_append_escaped(StringBuilder * sb, const char * str)
+{
+  unsigned char c;
+
+  for (; *str; str++)
+  {
+    c = (unsigned char) *str;
+    if (c <= ' ' || c >= 0x7f || c == '%' || c == '?')
+      string_builder_appendf(sb, "%%%02X", c);
+    else
+      string_builder_append_char(sb, c);
+  }
+}
+
+/* the host (lowercased, as it is compared regardless of case) and a
+ * space, then the path, then the query with its parameters in order, each
+ * escaped. the path is kept decoded, so escaping it again is what tells
+ * /a%3Fb apart from /a?b
+ */
+static char * http_cache_get_key(HTTPRequest * request)
+{
+  char * host, * path, * query, * parameter, * save, ** parameters;
+  StringBuilder * sb;
+  size_t count = 0;
+
+  host = http_message_get_header((HTTPMessage *) request, "Host");
+  if (!host)
+    host = strings_clone("");
+  for (char * c = host; *c; c++)
+    *c = tolower((unsigned char) *c);
+
+  path = http_request_get_path(request);
+  query = http_request_get_query(request);
+
+  parameters = (char **) malloc(sizeof(char *) * (strlen(query) / 2 + 1));
+  assert(parameters);
+
+  parameter = strtok_r(query, "&", &save);
+  while (parameter)
+  {
+    parameters[count++] = parameter;
+    parameter = strtok_r(NULL, "&", &save);
+  }
+  qsort(parameters, count, sizeof(char *), http_cache_compare_parameters);
+
+  sb = string_builder_new();
+  http_cache_append_escaped(sb, host);
+  string_builder_append_char(sb, ' ');
+  http_cache_append_escaped(sb, path);
+  for (size_t k = 0; k < count; k++)
+  {
+    string_builder_append_char(sb, k ? '&' : '?');
+    http_cache_append_escaped(sb, parameters[k]);
+  }
+
+  free(parameters);
+  free(query);
+  free(path);
+  free(host);
+
+  return string_builder_to_string_destroy(sb);
+}
+
+/* `key' followed by each header named in `vary' and its value */
+static char * http_cache_get_vary_key(
+    const char * key,
+    const char * vary,
+    HTTPRequest * request
+    )
+{
+  char * names, * cursor, * name, * value;
+  StringBuilder * sb;
+
+  sb = string_builder_new();
+  string_builder_appendf(sb, "%s", key);
+
+  names = strings_clone((char *) vary);
+  cursor = names;
+  while ((name = http_cache_next_element(&cursor)))
+  {
+    value = http_message_get_header((HTTPMessage *) request, name);
+    string_builder_appendf(sb, "\n%s:%s", name, value ? value : "");
+    free(value);
+  }
+  free(names);
+
+  return string_builder_to_string_destroy(sb);
+}
+
+/* the names in a response's Vary, or NULL if there are none. false if it
+ * varies by anything at all, and so may not be kept
+ */
+static bool http_cache_get_vary(HTTPResponse * response, char ** vary)
+{
+  char * value, * cursor, * name;
+  StringBuilder * sb;
+  bool any = false;
+
+  *vary = NULL;
+
+  value = http_message_get_header((HTTPMessage *) response, "Vary");
+  if (!value)
+    return true;
+
+  sb = string_builder_new();
+  cursor = value;
+  while ((name = http_cache_next_element(&cursor)))
+  {
+    if (strcmp(name, "*") == 0)
+      any = true;
+    for (char * c = name; *c; c++)
+      *c = tolower((unsigned char) *c);
+    string_builder_appendf(sb, "%s,", name);
+  }
+  free(value);
+
+  *vary = string_builder_to_string_destroy(sb);
+  if (any || !**vary)
+  {
+    free(*vary);
+    *vary = NULL;
+  }
+
+  return !any;
+}
+
+/* whether the request's If-None-Match matches the entity tag `etag' */
+static bool http_cache_none_match(HTTPRequest * request, const char * etag)
+{
+  char * value, * cursor, * tag;
+  bool ret = false;
+
+  value = http_message_get_header((HTTPMessage *) request, "If-None-Match");
+  if (!value)
+    return false;
+
+  cursor = value;
+  while (!ret && (tag = http_cache_next_element(&cursor)))
+  {
+    if (strncmp(tag, "W/", 2) == 0)
+      tag += 2;
+    ret = strcmp(tag, "*") == 0 || strcmp(tag, etag) == 0;
+  }
+
+  free(value);
+
+  return ret;
+}
+
+static ssize_t http_cache_buffer_write(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  HTTPCacheBuffer * buffer = (HTTPCacheBuffer *) context;
+
+  (void) fd;
+
+  if (buffer->length + length > buffer->capacity)
+  {
+    buffer->capacity = (buffer->length + length) * 2;
+    buffer->data = (char *) realloc(buffer->data, buffer->capacity);
+    assert(buffer->data);
+  }
+
+  memcpy(&buffer->data[buffer->length], data, length);
+  buffer->length += length;
+
+  return length;
+}
+
+/* where the value of the Date header in the head of the rendered message
+ * `data' starts, setting `date_length' to its length; 0 if there is none
+ */
+static size_t http_cache_find_date(
+    const char * data,
+    size_t length,
+    size_t * date_length
+    )
+{
+  const char * end, * value;
+
+  *date_length = 0;
+
+  end = (const char *) memmem(data, length, "\r\n\r\n", 4);
+  if (
+    !end ||
+    !http_utils_scan_header(data, end - data + 2, "date:", &value, date_length)
+    )
+    return 0;
+
+  return value - data;
+}
+
+/* the 304 to send in place of `response', with the headers it must keep */
+static char * http_cache_render_not_modified(
+    HTTPResponse * response,
+    size_t * length
+    )
+{
+  static char * const headers [] =
+  {
+    "Cache-Control", "Date", "ETag", "Expires", "Vary"
+  };
+  HTTPResponse * not_modified;
+  HTTPCacheBuffer buffer;
+  HTTPWriter * writer;
+  char * value;
+
+  not_modified = http_response_new();
+  http_message_set_version(
+      (HTTPMessage *) not_modified,
+      http_message_get_version((HTTPMessage *) response)
+      );
+  http_response_set_status_code(
+      not_modified,
+      HTTP_STATUS_CODE_304_NOT_MODIFIED
+      );
+
+  for (size_t k = 0; k < sizeof(headers) / sizeof(headers[0]); k++)
+  {
+    value = http_message_get_header((HTTPMessage *) response, headers[k]);
+    if (value)
+    {
+      http_message_set_header((HTTPMessage *) not_modified, headers[k], value);
+      free(value);
+    }
+  }
+
+  memset(&buffer, 0, sizeof(HTTPCacheBuffer));
+  writer = http_writer_new();
+  http_writer_set_write_function(writer, http_cache_buffer_write, &buffer);
+  http_writer_render(writer, (HTTPMessage *) not_modified, -1);
+  http_writer_destroy(writer);
+  http_response_destroy(not_modified);
+
+  *length = buffer.length;
+  return buffer.data;
+}
+
+
+/* SHARDS; all under the shard's lock */
+
+static HTTPCacheEntry * http_cache_shard_find(
+    HTTPCacheShard * shard,
+    uint64_t hash,
+    const char * key
+    )
+{
+  HTTPCacheEntry * entry;
+
+  entry = shard->buckets[hash & (shard->bucket_count - 1)];
+  for (; entry; entry = entry->next)
+  {
+    if (entry->hash == hash && strcmp(entry->key, key) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
+
+static void http_cache_shard_unlink_use(
+    HTTPCacheShard * shard,
+    HTTPCacheEntry * entry
+    )
+{
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    shard->newest = entry->older;
+
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    shard->oldest = entry->newer;
+}
+
+static void http_cache_shard_link_use(
+    HTTPCacheShard * shard,
+    HTTPCacheEntry * entry
+    )
+{
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest)
+    shard->newest->newer = entry;
+  else
+    shard->oldest = entry;
+  shard->newest = entry;
+}
+
+static void http_cache_shard_touch(
+    HTTPCacheShard * shard,
+    HTTPCacheEntry * entry
+    )
+{
+  if (shard->newest == entry)
+    return;
+
+  http_cache_shard_unlink_use(shard, entry);
+  http_cache_shard_link_use(shard, entry);
+}
+
+/* takes the entry out of the shard, freeing it unless it is held */
+static void http_cache_shard_remove(
+    HTTPCacheShard * shard,
+    HTTPCacheEntry * entry
+    )
+{
+  HTTPCacheEntry ** link;
+
+  link = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+
+  http_cache_shard_unlink_use(shard, entry);
+  shard->count--;
+  shard->size -= entry->size;
+  entry->cached = false;
+
+  if (!entry->references)
+    http_cache_entry_free(entry);
+}
+
+static void http_cache_shard_grow(HTTPCacheShard * shard)
+{
+  HTTPCacheEntry ** buckets, * entry, * next;
+  size_t bucket_count = shard->bucket_count * 2, index;
+
+  buckets = (HTTPCacheEntry **) calloc(bucket_count, sizeof(HTTPCacheEntry *));
+  assert(buckets);
+
+  for (size_t k = 0; k < shard->bucket_count; k++)
+  {
+    for (entry = shard->buckets[k]; entry; entry = next)
+    {
+      next = entry->next;
+      index = entry->hash & (bucket_count - 1);
+      entry->next = buckets[index];
+      buckets[index] = entry;
+    }
+  }
+
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_count = bucket_count;
+}
+
+/* puts the entry in the shard in place of any of the same key, then
+ * evicts the least recently used until the shard is within its share
+ */
+static void http_cache_shard_add(
+    HTTPCache * cache,
+    HTTPCacheShard * shard,
+    HTTPCacheEntry * entry
+    )
+{
+  HTTPCacheEntry * existing;
+  size_t index;
+
+  existing = http_cache_shard_find(shard, entry->hash, entry->key);
+  if (existing)
+    http_cache_shard_remove(shard, existing);
+
+  if (shard->count >= shard->bucket_count)
+    http_cache_shard_grow(shard);
+
+  index = entry->hash & (shard->bucket_count - 1);
+  entry->next = shard->buckets[index];
+  shard->buckets[index] = entry;
+
+  http_cache_shard_link_use(shard, entry);
+  shard->count++;
+  shard->size += entry->size;
+  entry->cached = true;
+
+  while (shard->size > cache->shard_capacity)
+    http_cache_shard_remove(shard, shard->oldest);
+}
+
+
+/* the fresh response cached under `key', held. if there is none but the
+ * names of the headers responses to it vary by, `vary' is set to a copy
+ */
+static HTTPCacheEntry * http_cache_get(
+    HTTPCache * cache,
+    const char * key,
+    char ** vary
+    )
+{
+  HTTPCacheEntry * ret;
+  HTTPCacheShard * shard;
+  uint64_t hash;
+
+  hash = http_cache_hash(key);
+  shard = http_cache_get_shard(cache, hash);
+
+  pthread_mutex_lock(&shard->lock);
+
+  ret = http_cache_shard_find(shard, hash, key);
+  if (ret && ret->expires <= http_wait_now())
+  {
+    http_cache_shard_remove(shard, ret);
+    ret = NULL;
+  }
+
+  if (ret)
+  {
+    http_cache_shard_touch(shard, ret);
+    if (ret->data)
+      ret->references++;
+    else
+    {
+      if (vary && ret->vary)
+        *vary = strings_clone(ret->vary);
+      ret = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  return ret;
+}
+
+
+HTTPCache * http_cache_new(size_t capacity)
+{
+  HTTPCacheShard * shard;
+  HTTPCache * ret;
+
+  ret = (HTTPCache *) aligned_alloc(_HTTP_CACHE_CACHE_LINE, sizeof(HTTPCache));
+  assert(ret);
+
+  ret->shard_capacity = capacity / _HTTP_CACHE_SHARD_COUNT;
+
+  for (size_t k = 0; k < _HTTP_CACHE_SHARD_COUNT; k++)
+  {
+    shard = &ret->shards[k];
+
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->buckets = (HTTPCacheEntry **) calloc(
+        _HTTP_CACHE_INITIAL_BUCKET_COUNT,
+        sizeof(HTTPCacheEntry *)
+        );
+    assert(shard->buckets);
+    shard->bucket_count = _HTTP_CACHE_INITIAL_BUCKET_COUNT;
+    shard->count = 0;
+    shard->size = 0;
+    shard->newest = NULL;
+    shard->oldest = NULL;
+    shard->flights = NULL;
+  }
+
+  return ret;
+}
+
+void http_cache_destroy(HTTPCache * cache)
+{
+  HTTPCacheShard * shard;
+
+  assert(cache);
+
+  for (size_t k = 0; k < _HTTP_CACHE_SHARD_COUNT; k++)
+  {
+    shard = &cache->shards[k];
+
+    while (shard->oldest)
+    {
+      assert(!shard->oldest->references);
+      http_cache_shard_remove(shard, shard->oldest);
+    }
+
+    assert(!shard->flights);
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+
+  free(cache);
+}
+
+HTTPCacheEntry * http_cache_lookup(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPCacheHit * hit
+    )
+{
+  char * key, * vary_key, * vary = NULL;
+  HTTPCacheEntry * ret;
+
+  assert(cache);
+  assert(request);
+  assert(hit);
+
+  if (!http_cache_may_answer(request))
+    return NULL;
+
+  key = http_cache_get_key(request);
+  ret = http_cache_get(cache, key, &vary);
+  if (vary)
+  {
+    vary_key = http_cache_get_vary_key(key, vary, request);
+    ret = http_cache_get(cache, vary_key, NULL);
+    free(vary_key);
+    free(vary);
+  }
+  free(key);
+
+  if (!ret)
+    return NULL;
+
+  if (ret->etag && http_cache_none_match(request, ret->etag))
+  {
+    hit->data = ret->not_modified;
+    hit->length = ret->not_modified_length;
+    hit->status_code = HTTP_STATUS_CODE_304_NOT_MODIFIED;
+    hit->content_length = 0;
+    hit->date_offset = ret->not_modified_date_offset;
+    hit->date_length = ret->not_modified_date_length;
+  }
+  else
+  {
+    hit->data = ret->data;
+    hit->length = ret->length;
+    hit->status_code = ret->status_code;
+    hit->content_length = ret->content_length;
+    hit->date_offset = ret->date_offset;
+    hit->date_length = ret->date_length;
+  }
+
+  return ret;
+}
+
+HTTPCacheEntry * http_cache_prepare(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPResponse * response
+    )
+{
+  HTTPCacheEntry * ret;
+  uint64_t freshness;
+  char * key, * vary;
+  List * cookies;
+  size_t count;
+
+  assert(cache);
+  assert(request);
+  assert(response);
+
+  if (
+    http_request_get_method(request) != HTTP_METHOD_GET ||
+    http_message_has_header((HTTPMessage *) request, "Authorization") ||
+    http_cache_message_has_directive((HTTPMessage *) request, "no-store") ||
+    !http_cache_status_code_is_cacheable(
+        http_response_get_status_code(response)
+        ) ||
+    http_message_has_header((HTTPMessage *) response, "Set-Cookie")
+    )
+    return NULL;
+
+  cookies = http_message_get_cookies((HTTPMessage *) response);
+  count = list_size(cookies);
+  list_destroy(cookies);
+  if (count)
+    return NULL;
+
+  freshness = http_cache_get_freshness(response);
+  if (!freshness || !http_cache_get_vary(response, &vary))
+    return NULL;
+
+  ret = (HTTPCacheEntry *) calloc(1, sizeof(HTTPCacheEntry));
+  assert(ret);
+
+  key = http_cache_get_key(request);
+  if (vary)
+  {
+    ret->key = http_cache_get_vary_key(key, vary, request);
+    free(key);
+  }
+  else
+    ret->key = key;
+
+  ret->hash = http_cache_hash(ret->key);
+  ret->expires = http_wait_now() + freshness * 1000ULL;
+  ret->references = 1;
+  ret->vary = vary;
+  ret->status_code = http_response_get_status_code(response);
+  ret->content_length =
+    http_message_get_content((HTTPMessage *) response).length;
+
+  ret->etag = http_message_get_header((HTTPMessage *) response, "ETag");
+  if (ret->etag)
+  {
+    if (strncmp(ret->etag, "W/", 2) == 0)
+      memmove(ret->etag, &ret->etag[2], strlen(ret->etag) - 1);
+    ret->not_modified = http_cache_render_not_modified(
+        response,
+        &ret->not_modified_length
+        );
+    ret->not_modified_date_offset = http_cache_find_date(
+        ret->not_modified,
+        ret->not_modified_length,
+        &ret->not_modified_date_length
+        );
+  }
+
+  return ret;
+}
+
+void http_cache_insert(
+    HTTPCache * cache,
+    HTTPCacheEntry * entry,
+    const char * data,
+    size_t length
+    )
+{
+  HTTPCacheEntry * names = NULL;
+  HTTPCacheShard * shard;
+
+  assert(cache);
+  assert(entry);
+  assert(data && length);
+  assert(!entry->data);
+
+  entry->data = (char *) malloc(length);
+  assert(entry->data);
+  memcpy(entry->data, data, length);
+  entry->length = length;
+  entry->date_offset =
+    http_cache_find_date(entry->data, entry->length, &entry->date_length);
+
+  entry->size =
+    sizeof(HTTPCacheEntry) +
+    strlen(entry->key) + 1 +
+    (entry->vary ? strlen(entry->vary) + 1 : 0) +
+    entry->length +
+    (entry->etag ? strlen(entry->etag) + 1 : 0) +
+    entry->not_modified_length;
+  if (entry->size > cache->shard_capacity)
+  {
+    http_cache_release(cache, entry);
+    return;
+  }
+
+  /* and the names it varies by, under its path and query */
+  if (entry->vary)
+  {
+    names = (HTTPCacheEntry *) calloc(1, sizeof(HTTPCacheEntry));
+    assert(names);
+
+    names->key = strndup(entry->key, strcspn(entry->key, "\n"));
+    assert(names->key);
+    names->hash = http_cache_hash(names->key);
+    names->expires = entry->expires;
+    names->vary = strings_clone(entry->vary);
+    names->size =
+      sizeof(HTTPCacheEntry) +
+      strlen(names->key) + 1 +
+      strlen(names->vary) + 1;
+
+    shard = http_cache_get_shard(cache, names->hash);
+    pthread_mutex_lock(&shard->lock);
+    http_cache_shard_add(cache, shard, names);
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  shard = http_cache_get_shard(cache, entry->hash);
+  pthread_mutex_lock(&shard->lock);
+  http_cache_shard_add(cache, shard, entry);
+  pthread_mutex_unlock(&shard->lock);
+
+  http_cache_release(cache, entry);
+}
+
+void http_cache_release(HTTPCache * cache, HTTPCacheEntry * entry)
+{
+  HTTPCacheShard * shard;
+  bool unused;
+
+  assert(cache);
+  assert(entry);
+
+  shard = http_cache_get_shard(cache, entry->hash);
+
+  pthread_mutex_lock(&shard->lock);
+  assert(entry->references);
+  entry->references--;
+  unused = !entry->references && !entry->cached;
+  pthread_mutex_unlock(&shard->lock);
+
+  if (unused)
+    http_cache_entry_free(entry);
+}
+
+bool http_cache_begin_flight(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPCacheWaiter * waiter,
+    HTTPCacheFlight ** flight
+    )
+{
+  HTTPCacheFlight * existing;
+  HTTPCacheEntry * marked;
+  HTTPCacheShard * shard;
+  uint64_t hash;
+  char * key;
+
+  assert(cache);
+  assert(request);
+  assert(waiter);
+  assert(flight);
+
+  *flight = NULL;
+  if (!http_cache_may_answer(request))
+    return true;
+
+  key = http_cache_get_key(request);
+  hash = http_cache_hash(key);
+  shard = http_cache_get_shard(cache, hash);
+
+  pthread_mutex_lock(&shard->lock);
+
+  marked = http_cache_shard_find(shard, hash, key);
+  if (
+    marked && !marked->data && !marked->vary &&
+    marked->expires > http_wait_now()
+    )
+  {
+    pthread_mutex_unlock(&shard->lock);
+    free(key);
+    return true;
+  }
+
+  for (existing = shard->flights; existing; existing = existing->next)
+  {
+    if (existing->hash == hash && strcmp(existing->key, key) == 0)
+      break;
+  }
+
+  if (existing)
+  {
+    waiter->next = NULL;
+    *existing->last_waiter = waiter;
+    existing->last_waiter = &waiter->next;
+  }
+  else
+  {
+    *flight = (HTTPCacheFlight *) malloc(sizeof(HTTPCacheFlight));
+    assert(*flight);
+
+    (*flight)->hash = hash;
+    (*flight)->key = key;
+    (*flight)->waiters = NULL;
+    (*flight)->last_waiter = &(*flight)->waiters;
+    (*flight)->next = shard->flights;
+    shard->flights = *flight;
+  }
+
+  pthread_mutex_unlock(&shard->lock);
+
+  if (existing)
+    free(key);
+
+  return !existing;
+}
+
+/* wakes those waiting, in the order they came. should nothing have been
+ * cached for the flight, marks its key, so those woken (and later misses)
+ * are let through together rather than one flight at a time
+ */
+void http_cache_end_flight(HTTPCache * cache, HTTPCacheFlight * flight)
+{
+  HTTPCacheWaiter * waiter, * next;
+  HTTPCacheEntry * cached, * mark;
+  HTTPCacheFlight ** link;
+  HTTPCacheShard * shard;
+
+  assert(cache);
+  assert(flight);
+
+  shard = http_cache_get_shard(cache, flight->hash);
+
+  pthread_mutex_lock(&shard->lock);
+  link = &shard->flights;
+  while (*link != flight)
+    link = &(*link)->next;
+  *link = flight->next;
+
+  cached = http_cache_shard_find(shard, flight->hash, flight->key);
+  if (!cached || cached->expires <= http_wait_now())
+  {
+    mark = (HTTPCacheEntry *) calloc(1, sizeof(HTTPCacheEntry));
+    assert(mark);
+
+    mark->key = flight->key;
+    flight->key = NULL;
+    mark->hash = flight->hash;
+    mark->expires = http_wait_now() + _HTTP_CACHE_UNCACHEABLE_LIFETIME;
+    mark->size = sizeof(HTTPCacheEntry) + strlen(mark->key) + 1;
+    http_cache_shard_add(cache, shard, mark);
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  for (waiter = flight->waiters; waiter; waiter = next)
+  {
+    next = waiter->next; /* it may be gone once woken */
+    waiter->wake(waiter);
+  }
+
+  free(flight->key);
+  free(flight);
+}
+
+size_t http_cache_get_size(HTTPCache * cache)
+{
+  size_t ret = 0;
+
+  assert(cache);
+
+  for (size_t k = 0; k < _HTTP_CACHE_SHARD_COUNT; k++)
+  {
+    pthread_mutex_lock(&cache->shards[k].lock);
+    ret += cache->shards[k].size;
+    pthread_mutex_unlock(&cache->shards[k].lock);
+  }
+
+  return ret;
+}
@@ -0,0 +1,116 @@
+
+
+#ifndef __CHTTP_HTTP_CACHE_H
+#define __CHTTP_HTTP_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "http_request.h"
+#include "http_response.h"
+#include "http_status_code.h"
+
+
+/* a shared cache of responses to GET requests, each kept as the bytes it
+ * was rendered to, so a hit costs a copy rather than a handler call. it
+ * is keyed by host, path, query (its parameters sorted) and the request
+ * headers the response names in Vary, and split into shards, each under a
+ * lock of its own, holding what it was most recently used within its share
+ * of the capacity. a response is only kept for as long as its Cache-Control
+ * (s-maxage or max-age) or Expires says it is fresh, never if it says
+ * no-store, no-cache or private, and never if it sets cookies. a response
+ * with an ETag is also kept as the 304 to send when a request's
+ * If-None-Match matches it
+ */
+struct HTTPCache;
+typedef struct HTTPCache HTTPCache;
+
+struct HTTPCacheEntry;
+typedef struct HTTPCacheEntry HTTPCacheEntry;
+
+struct HTTPCacheFlight;
+typedef struct HTTPCacheFlight HTTPCacheFlight;
+
+struct HTTPCacheWaiter;
+typedef struct HTTPCacheWaiter HTTPCacheWaiter;
+
+/* intrusive; embed it in whatever waits on a flight */
+struct HTTPCacheWaiter
+{
+  HTTPCacheWaiter * next;
+  void (*wake)(HTTPCacheWaiter * waiter);
+};
+
+struct HTTPCacheHit
+{
+  const char * data; /* the rendered response; the entry's */
+  size_t length;
+  HTTPStatusCode status_code;
+  size_t content_length;
+
+  /* of the value of its Date header, stale by now, which whoever sends it
+   * is to replace with the current date; 0 if it has none
+   */
+  size_t date_offset, date_length;
+};
+typedef struct HTTPCacheHit HTTPCacheHit;
+
+
+/* `capacity' in bytes, of the entries and what they keep */
+HTTPCache * http_cache_new(size_t capacity);
+
+/* no entry may still be held */
+void http_cache_destroy(HTTPCache * cache);
+
+/* the fresh entry for `request', if there is one, filling in `hit'. the
+ * entry is held, and its data valid, until released
+ */
+HTTPCacheEntry * http_cache_lookup(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPCacheHit * hit
+    );
+
+/* an entry for `response' to `request', held but not yet in the cache,
+ * or NULL if it may not be cached. call before rendering the response
+ */
+HTTPCacheEntry * http_cache_prepare(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPResponse * response
+    );
+
+/* puts a prepared entry in the cache with `data', its response rendered,
+ * and releases it
+ */
+void http_cache_insert(
+    HTTPCache * cache,
+    HTTPCacheEntry * entry,
+    const char * data,
+    size_t length
+    );
+
+void http_cache_release(HTTPCache * cache, HTTPCacheEntry * entry);
+
+/* lets one request at a time through to be answered for each host, path
+ * and query (keyed as the cache is) which the cache missed on, so a
+ * response about to be cached is only made once. true if `request' may go
+ * on: it then leads `*flight' (NULL if the cache would never answer it, or
+ * if a flight for it recently ended with nothing cached), which must be
+ * ended once its response is cached, or is known not to be. false if
+ * another request leads a flight for it: `waiter' then waits, to be woken
+ * (from the thread ending the flight) to look the request up again
+ */
+bool http_cache_begin_flight(
+    HTTPCache * cache,
+    HTTPRequest * request,
+    HTTPCacheWaiter * waiter,
+    HTTPCacheFlight ** flight
+    );
+void http_cache_end_flight(HTTPCache * cache, HTTPCacheFlight * flight);
+
+/* the bytes currently counted against the capacity */
+size_t http_cache_get_size(HTTPCache * cache);
+
+
+#endif
@@ -0,0 +1,244 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_capture.h"
+
+
+#define _HTTP_CAPTURE_MAGIC "CHTTPCAP"
+#define _HTTP_CAPTURE_VERSION 1
+#define _HTTP_CAPTURE_HEADER_LENGTH (8 + sizeof(uint32_t))
+#define _HTTP_CAPTURE_RECORD_HEADER_LENGTH \
+  (2 * sizeof(uint64_t) + sizeof(uint32_t))
+#define _HTTP_CAPTURE_BUFFER_LENGTH 0x10000
+
+struct HTTPCapture
+{
+  FILE * file;
+  pthread_mutex_t lock;
+  uint64_t next_connection;
+  bool failed;
+};
+
+struct HTTPCaptureFile
+{
+  const char * data;
+  size_t length, offset;
+};
+
+
+static uint64_t http_capture_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+HTTPCapture * http_capture_open(const char * path)
+{
+  HTTPCapture * ret;
+  uint32_t version = _HTTP_CAPTURE_VERSION;
+  FILE * file;
+
+  assert(path);
+
+  file = fopen(path, "we");
+  if (!file)
+    return NULL;
+
+  ret = (HTTPCapture *) malloc(sizeof(HTTPCapture));
+  assert(ret);
+
+  ret->file = file;
+  pthread_mutex_init(&ret->lock, NULL);
+  ret->next_connection = 1;
+  ret->failed = false;
+
+  setvbuf(file, NULL, _IOFBF, _HTTP_CAPTURE_BUFFER_LENGTH);
+  if (
+    fwrite(_HTTP_CAPTURE_MAGIC, 8, 1, file) != 1 ||
+    fwrite(&version, sizeof(version), 1, file) != 1
+    )
+    ret->failed = true;
+
+  return ret;
+}
+
+bool http_capture_close(HTTPCapture * capture)
+{
+  bool ret;
+
+  assert(capture);
+
+  ret = !capture->failed;
+  if (fclose(capture->file) != 0)
+    ret = false;
+
+  pthread_mutex_destroy(&capture->lock);
+  free(capture);
+
+  return ret;
+}
+
+uint64_t http_capture_new_connection(HTTPCapture * capture)
+{
+  assert(capture);
+
+  return __atomic_fetch_add(&capture->next_connection, 1, __ATOMIC_RELAXED);
+}
+
+void http_capture_record(
+    HTTPCapture * capture,
+    uint64_t connection,
+    const void * data,
+    size_t length
+    )
+{
+  uint64_t time;
+  uint32_t part;
+  FILE * file;
+
+  assert(capture);
+  assert(data || length == 0);
+
+  file = capture->file;
+
+  pthread_mutex_lock(&capture->lock);
+
+  /* stamped under the lock, so the file stays in time order */
+  time = http_capture_now();
+
+  do
+  {
+    part = length > UINT32_MAX ? UINT32_MAX : length;
+
+    if (
+      fwrite_unlocked(&connection, sizeof(connection), 1, file) != 1 ||
+      fwrite_unlocked(&time, sizeof(time), 1, file) != 1 ||
+      fwrite_unlocked(&part, sizeof(part), 1, file) != 1 ||
+      (part && fwrite_unlocked(data, part, 1, file) != 1)
+      )
+      capture->failed = true;
+
+    data = (const char *) data + part;
+    length -= part;
+  }
+  while (length);
+
+  pthread_mutex_unlock(&capture->lock);
+}
+
+
+HTTPCaptureFile * http_capture_file_open(const char * path)
+{
+  HTTPCaptureFile * ret;
+  struct stat status;
+  uint32_t version;
+  void * mapping;
+  int fd;
+
+  assert(path);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  if ((size_t) status.st_size < _HTTP_CAPTURE_HEADER_LENGTH)
+  {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  memcpy(&version, (const char *) mapping + 8, sizeof(version));
+  if (
+    memcmp(mapping, _HTTP_CAPTURE_MAGIC, 8) != 0 ||
+    version != _HTTP_CAPTURE_VERSION
+    )
+  {
+    munmap(mapping, status.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+  ret = (HTTPCaptureFile *) malloc(sizeof(HTTPCaptureFile));
+  assert(ret);
+
+  ret->data = (const char *) mapping;
+  ret->length = status.st_size;
+  ret->offset = _HTTP_CAPTURE_HEADER_LENGTH;
+
+  return ret;
+}
+
+void http_capture_file_close(HTTPCaptureFile * file)
+{
+  assert(file);
+
+  munmap((void *) file->data, file->length);
+  free(file);
+}
+
+bool http_capture_file_next(HTTPCaptureFile * file, HTTPCaptureRecord * record)
+{
+  const char * header;
+
+  assert(file);
+  assert(record);
+
+  if (file->length - file->offset < _HTTP_CAPTURE_RECORD_HEADER_LENGTH)
+    return false;
+
+  header = &file->data[file->offset];
+  memcpy(&record->connection, header, sizeof(uint64_t));
+  memcpy(&record->time, header + sizeof(uint64_t), sizeof(uint64_t));
+  memcpy(&record->length, header + 2 * sizeof(uint64_t), sizeof(uint32_t));
+
+  if (
+    file->length - file->offset - _HTTP_CAPTURE_RECORD_HEADER_LENGTH <
+    record->length
+    )
+    return false;
+
+  record->data = header + _HTTP_CAPTURE_RECORD_HEADER_LENGTH;
+  file->offset += _HTTP_CAPTURE_RECORD_HEADER_LENGTH + record->length;
+
+  return true;
+}
+
+void http_capture_file_rewind(HTTPCaptureFile * file)
+{
+  assert(file);
+
+  file->offset = _HTTP_CAPTURE_HEADER_LENGTH;
+}
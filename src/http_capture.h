@@ -0,0 +1,60 @@
+
+
+#ifndef __CHTTP_HTTP_CAPTURE_H
+#define __CHTTP_HTTP_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* a recording of the raw bytes received on any number of connections. the
+ * file is an 8 byte magic ("CHTTPCAP") and a 32 bit version followed by
+ * records of a 64 bit connection number, a 64 bit monotonic timestamp in
+ * microseconds and a 32 bit length, then that many bytes, all in host byte
+ * order. a record of length zero marks the end of its connection's input
+ */
+struct HTTPCapture;
+typedef struct HTTPCapture HTTPCapture;
+
+struct HTTPCaptureFile;
+typedef struct HTTPCaptureFile HTTPCaptureFile;
+
+struct HTTPCaptureRecord
+{
+  uint64_t connection;
+  uint64_t time; /* in microseconds */
+  const char * data; /* into the file's mapping */
+  uint32_t length;
+};
+typedef struct HTTPCaptureRecord HTTPCaptureRecord;
+
+
+/* truncates or creates `path'; NULL (with errno set) on failure */
+HTTPCapture * http_capture_open(const char * path);
+
+/* false if anything failed to be written */
+bool http_capture_close(HTTPCapture * capture);
+
+/* numbers a new connection; the first is 1 */
+uint64_t http_capture_new_connection(HTTPCapture * capture);
+
+/* from any thread */
+void http_capture_record(
+    HTTPCapture * capture,
+    uint64_t connection,
+    const void * data,
+    size_t length
+    );
+
+
+/* NULL (with errno set) if `path' cannot be mapped or is no capture */
+HTTPCaptureFile * http_capture_file_open(const char * path);
+void http_capture_file_close(HTTPCaptureFile * file);
+
+/* false at the end; a truncated last record counts as the end */
+bool http_capture_file_next(HTTPCaptureFile * file, HTTPCaptureRecord * record);
+void http_capture_file_rewind(HTTPCaptureFile * file);
+
+
+#endif
@@ -3,8 +3,10 @@
 #include <baselib/baselib.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include "http_allocator.h"
 #include "http_utils.h"
 #include "http_version.h"
 
@@ -25,9 +27,37 @@ struct HTTPCookie
   bool httponly;
 };
 
+static char * http_cookie_clone_range(char * str, size_t length)
+{
+  char * ret;
+
+  assert(str || !length);
+
+  ret = (char *) chttp_malloc(sizeof(char) * (length + 1));
+  assert(ret);
+
+  memcpy(ret, str, length);
+  ret[length] = '\0';
+
+  return ret;
+}
+
+/* a field of the cookie's own; NULL stays NULL */
+static char * http_cookie_clone_string(const char * str)
+{
+  HTTPAllocator allocator;
+
+  if (!str)
+    return NULL;
+
+  allocator = chttp_get_allocator();
+  return http_allocator_clone(&allocator, str);
+}
+
 HTTPCookie * http_cookie_new()
 {
-  HTTPCookie * ret = (HTTPCookie *) malloc(sizeof(HTTPCookie));
+  HTTPCookie * ret = (HTTPCookie *) chttp_malloc(sizeof(HTTPCookie));
+  assert(ret);
 
   ret->name = NULL;
   ret->value = NULL;
@@ -45,12 +75,12 @@ void http_cookie_destroy(HTTPCookie * cookie)
 {
   assert(cookie);
 
-  free(cookie->name);
-  free(cookie->value);
-  free(cookie->domain);
-  free(cookie->path);
-  free(cookie->extension);
-  free(cookie);
+  chttp_free(cookie->name);
+  chttp_free(cookie->value);
+  chttp_free(cookie->domain);
+  chttp_free(cookie->path);
+  chttp_free(cookie->extension);
+  chttp_free(cookie);
 
 }
 
@@ -62,13 +92,11 @@ HTTPCookie * http_cookie_clone(HTTPCookie * original)
 
   ret = http_cookie_new();
 
-  ret->name = original->name ? strings_clone(original->name) : NULL;
-  ret->value = original->value ? strings_clone(original->value) : NULL;
-  ret->domain = original->domain ? strings_clone(original->domain) : NULL;
-  ret->path = original->path ? strings_clone(original->path) : NULL;
-  ret->extension = original->extension ?
-                     strings_clone(original->extension) :
-                     NULL;
+  ret->name = http_cookie_clone_string(original->name);
+  ret->value = http_cookie_clone_string(original->value);
+  ret->domain = http_cookie_clone_string(original->domain);
+  ret->path = http_cookie_clone_string(original->path);
+  ret->extension = http_cookie_clone_string(original->extension);
   ret->expiry = original->expiry;
   ret->max_age = original->max_age;
   ret->secure = original->secure;
@@ -151,14 +179,31 @@ bool http_cookie_has_extension(HTTPCookie * cookie)
 void http_cookie_set_name(HTTPCookie * cookie, char * name)
 {
   assert(cookie);
-  free(cookie->name);
-  cookie->name = name ? strings_clone(name) : NULL;
+  chttp_free(cookie->name);
+  cookie->name = http_cookie_clone_string(name);
 }
 void http_cookie_set_value(HTTPCookie * cookie, char * value)
 {
   assert(cookie);
-  free(cookie->value);
-  cookie->value = value ? strings_clone(value) : NULL;
+  chttp_free(cookie->value);
+  cookie->value = http_cookie_clone_string(value);
+}
+
+void http_cookie_set_name_range(HTTPCookie * cookie, char * name, size_t length)
+{
+  assert(cookie);
+  chttp_free(cookie->name);
+  cookie->name = http_cookie_clone_range(name, length);
+}
+void http_cookie_set_value_range(
+    HTTPCookie * cookie,
+    char * value,
+    size_t length
+    )
+{
+  assert(cookie);
+  chttp_free(cookie->value);
+  cookie->value = http_cookie_clone_range(value, length);
 }
 
 void http_cookie_set_expiry(HTTPCookie * cookie, time_t expiry)
@@ -175,14 +220,30 @@ void http_cookie_set_max_age(HTTPCookie * cookie, uint32_t max_age)
 void http_cookie_set_domain(HTTPCookie * cookie, char * domain)
 {
   assert(cookie);
-  free(cookie->domain);
-  cookie->domain = domain ? strings_clone(domain) : NULL;
+  chttp_free(cookie->domain);
+  cookie->domain = http_cookie_clone_string(domain);
 }
 void http_cookie_set_path(HTTPCookie * cookie, char * path)
 {
   assert(cookie);
-  free(cookie->path);
-  cookie->path = path ? strings_clone(path) : NULL;
+  chttp_free(cookie->path);
+  cookie->path = http_cookie_clone_string(path);
+}
+void http_cookie_set_domain_range(
+    HTTPCookie * cookie,
+    char * domain,
+    size_t length
+    )
+{
+  assert(cookie);
+  chttp_free(cookie->domain);
+  cookie->domain = http_cookie_clone_range(domain, length);
+}
+void http_cookie_set_path_range(HTTPCookie * cookie, char * path, size_t length)
+{
+  assert(cookie);
+  chttp_free(cookie->path);
+  cookie->path = http_cookie_clone_range(path, length);
 }
 void http_cookie_set_secure(HTTPCookie * cookie, bool secure)
 {
@@ -197,8 +258,8 @@ void http_cookie_set_httponly(HTTPCookie * cookie, bool httponly)
 void http_cookie_set_extension(HTTPCookie * cookie, char * extension)
 {
   assert(cookie);
-  free(cookie->extension);
-  cookie->extension = extension ? strings_clone(extension) : NULL;
+  chttp_free(cookie->extension);
+  cookie->extension = http_cookie_clone_string(extension);
 }
 
 
@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <time.h>
 
 #include "http_version.h"
@@ -40,11 +41,23 @@ bool http_cookie_has_extension(HTTPCookie * cookie);
 
 void http_cookie_set_name(HTTPCookie * cookie, char * name);
 void http_cookie_set_value(HTTPCookie * cookie, char * value);
+void http_cookie_set_name_range(HTTPCookie * cookie, char * name, size_t length);
+void http_cookie_set_value_range(
+    HTTPCookie * cookie,
+    char * value,
+    size_t length
+    );
 
 void http_cookie_set_expiry(HTTPCookie * cookie, time_t expiry);
 void http_cookie_set_max_age(HTTPCookie * cookie, uint32_t max_age);
 void http_cookie_set_domain(HTTPCookie * cookie, char * domain);
 void http_cookie_set_path(HTTPCookie * cookie, char * path);
+void http_cookie_set_domain_range(
+    HTTPCookie * cookie,
+    char * domain,
+    size_t length
+    );
+void http_cookie_set_path_range(HTTPCookie * cookie, char * path, size_t length);
 void http_cookie_set_secure(HTTPCookie * cookie, bool secure);
 void http_cookie_set_httponly(HTTPCookie * cookie, bool httponly);
 void http_cookie_set_extension(HTTPCookie * cookie, char * extension);
@@ -0,0 +1,23 @@
+
+
+#ifndef __CHTTP_HTTP_COOKIE_TOKEN_H
+#define __CHTTP_HTTP_COOKIE_TOKEN_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* a view over one `name=value' (or bare `name') segment of a Cookie or
+ * Set-Cookie header. the pointers reference the tokenized string itself
+ * and are not null-terminated
+ */
+struct HTTPCookieToken
+{
+  char * name, * value;
+  size_t name_length, value_length;
+  bool has_value;
+};
+typedef struct HTTPCookieToken HTTPCookieToken;
+
+
+#endif
+
@@ -0,0 +1,462 @@
+
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "http_metrics.h"
+#include "http_timer_wheel.h"
+#include "http_wait.h"
+
+#include "http_fiber.h"
+
+
+#define _HTTP_FIBER_STACK_SIZE 0x10000
+#define _HTTP_FIBER_SPARE_COUNT 0x100 /* finished fibers kept for reuse */
+#define _HTTP_FIBER_EVENT_COUNT 0x100
+#define _HTTP_FIBER_TIMER_RESOLUTION 10 /* in milliseconds */
+
+
+struct HTTPFiber;
+typedef struct HTTPFiber HTTPFiber;
+
+struct HTTPFiber
+{
+  HTTPFiberScheduler * scheduler;
+  HTTPFiber * next; /* in the run queue or among the spares */
+  HTTPFiber * live_next, * live_prev;
+
+  ucontext_t context;
+  char * stack; /* a guard page, then the stack proper */
+  size_t stack_length;
+
+  HTTPFiberFunction function;
+  void * function_context;
+
+  HTTPTimer timer;
+  int wait_fd; /* registered with the scheduler's epoll, while waiting */
+  int wait_result;
+  bool finished;
+};
+
+struct HTTPFiberScheduler
+{
+  ucontext_t context;
+  size_t stack_size;
+  size_t page_size;
+
+  int epoll_fd, stop_fd;
+  HTTPTimerWheel * timer_wheel;
+
+  HTTPFiber * current;
+  HTTPFiber * ready, * ready_last; /* the run queue, first in first out */
+  HTTPFiber * live; /* every fiber not yet finished */
+  HTTPFiber * spare;
+  uint32_t fiber_count, spare_count;
+  bool running;
+};
+
+
+static __thread HTTPFiberScheduler * http_fiber_scheduler_current = NULL;
+
+
+static void http_fiber_make_ready(HTTPFiber * fiber)
+{
+  HTTPFiberScheduler * scheduler = fiber->scheduler;
+
+  fiber->next = NULL;
+  if (scheduler->ready_last)
+    scheduler->ready_last->next = fiber;
+  else
+    scheduler->ready = fiber;
+  scheduler->ready_last = fiber;
+}
+
+static HTTPFiber * http_fiber_next_ready(HTTPFiberScheduler * scheduler)
+{
+  HTTPFiber * ret = scheduler->ready;
+
+  if (ret)
+  {
+    scheduler->ready = ret->next;
+    if (!scheduler->ready)
+      scheduler->ready_last = NULL;
+  }
+
+  return ret;
+}
+
+static void http_fiber_timer_fired(HTTPTimer * timer, void * context)
+{
+  HTTPFiber * fiber = (HTTPFiber *) context;
+
+  (void) timer;
+
+  if (fiber->wait_fd >= 0)
+    epoll_ctl(fiber->scheduler->epoll_fd, EPOLL_CTL_DEL, fiber->wait_fd, NULL);
+
+  fiber->wait_result = 0;
+  http_fiber_make_ready(fiber);
+}
+
+static void http_fiber_free(HTTPFiber * fiber)
+{
+  munmap(fiber->stack, fiber->stack_length);
+  free(fiber);
+}
+
+/* every fiber starts here; the scheduler's context is its uc_link, so
+ * returning switches back to the scheduler
+ */
+static void http_fiber_entry(void)
+{
+  HTTPFiber * fiber = http_fiber_scheduler_current->current;
+
+  fiber->function(fiber->function_context);
+  fiber->finished = true;
+}
+
+static void http_fiber_suspend(HTTPFiber * fiber)
+{
+  swapcontext(&fiber->context, &fiber->scheduler->context);
+}
+
+static void http_fiber_resume(HTTPFiberScheduler * scheduler, HTTPFiber * fiber)
+{
+  scheduler->current = fiber;
+  swapcontext(&scheduler->context, &fiber->context);
+  scheduler->current = NULL;
+
+  if (!fiber->finished)
+    return;
+
+  if (fiber->live_prev)
+    fiber->live_prev->live_next = fiber->live_next;
+  else
+    scheduler->live = fiber->live_next;
+  if (fiber->live_next)
+    fiber->live_next->live_prev = fiber->live_prev;
+  scheduler->fiber_count--;
+
+  if (scheduler->spare_count >= _HTTP_FIBER_SPARE_COUNT)
+  {
+    http_fiber_free(fiber);
+    return;
+  }
+
+  fiber->next = scheduler->spare;
+  scheduler->spare = fiber;
+  scheduler->spare_count++;
+}
+
+static HTTPFiber * http_fiber_new(HTTPFiberScheduler * scheduler)
+{
+  HTTPFiber * ret;
+
+  if (scheduler->spare)
+  {
+    ret = scheduler->spare;
+    scheduler->spare = ret->next;
+    scheduler->spare_count--;
+    return ret;
+  }
+
+  ret = (HTTPFiber *) malloc(sizeof(HTTPFiber));
+  assert(ret);
+
+  ret->scheduler = scheduler;
+  ret->stack_length = scheduler->page_size + scheduler->stack_size;
+  ret->stack = mmap(
+      NULL,
+      ret->stack_length,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+      -1,
+      0
+      );
+  if (ret->stack == MAP_FAILED)
+  {
+    free(ret);
+    return NULL;
+  }
+
+  /* overflowing the stack faults instead of corrupting its neighbour */
+  mprotect(ret->stack, scheduler->page_size, PROT_NONE);
+
+  http_timer_init(&ret->timer, http_fiber_timer_fired, ret);
+
+  return ret;
+}
+
+
+HTTPFiberScheduler * http_fiber_scheduler_new(size_t stack_size)
+{
+  HTTPFiberScheduler * ret;
+  struct epoll_event event;
+  long page_size;
+
+  ret = (HTTPFiberScheduler *) calloc(1, sizeof(HTTPFiberScheduler));
+  assert(ret);
+
+  page_size = sysconf(_SC_PAGESIZE);
+  ret->page_size = page_size > 0 ? page_size : 0x1000;
+
+  if (stack_size == 0)
+    stack_size = _HTTP_FIBER_STACK_SIZE;
+  ret->stack_size =
+    (stack_size + ret->page_size - 1) / ret->page_size * ret->page_size;
+
+  ret->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  ret->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(ret->epoll_fd >= 0 && ret->stop_fd >= 0);
+
+  event.events = EPOLLIN;
+  event.data.ptr = &ret->stop_fd;
+  epoll_ctl(ret->epoll_fd, EPOLL_CTL_ADD, ret->stop_fd, &event);
+
+  ret->timer_wheel = http_timer_wheel_new(_HTTP_FIBER_TIMER_RESOLUTION);
+
+  return ret;
+}
+
+/* fibers which have not finished are discarded without being resumed */
+void http_fiber_scheduler_destroy(HTTPFiberScheduler * scheduler)
+{
+  HTTPFiber * fiber;
+
+  assert(scheduler);
+  assert(!scheduler->running);
+
+  while (scheduler->live)
+  {
+    fiber = scheduler->live;
+    scheduler->live = fiber->live_next;
+    http_fiber_free(fiber);
+  }
+
+  while (scheduler->spare)
+  {
+    fiber = scheduler->spare;
+    scheduler->spare = fiber->next;
+    http_fiber_free(fiber);
+  }
+
+  http_timer_wheel_destroy(scheduler->timer_wheel);
+  close(scheduler->epoll_fd);
+  close(scheduler->stop_fd);
+  free(scheduler);
+}
+
+bool http_fiber_scheduler_run(HTTPFiberScheduler * scheduler)
+{
+  struct epoll_event events [_HTTP_FIBER_EVENT_COUNT];
+  HTTPFiberScheduler * outer;
+  HTTPFiber * fiber, * last;
+  uint64_t value;
+  int count;
+
+  assert(scheduler);
+  assert(!scheduler->running);
+
+  outer = http_fiber_scheduler_current;
+  http_fiber_scheduler_current = scheduler;
+  scheduler->running = true;
+
+  while (scheduler->running && scheduler->fiber_count)
+  {
+    /* fibers made ready during the round (by yielding, say) wait for
+     * the next one, so they cannot starve the descriptors
+     */
+    last = scheduler->ready_last;
+    while (last && (fiber = http_fiber_next_ready(scheduler)))
+    {
+      http_fiber_resume(scheduler, fiber);
+      if (fiber == last)
+        break;
+    }
+
+    if (!scheduler->fiber_count)
+      break;
+
+    count = epoll_wait(
+        scheduler->epoll_fd,
+        events,
+        _HTTP_FIBER_EVENT_COUNT,
+        scheduler->ready ?
+          0 : http_timer_wheel_next_timeout(scheduler->timer_wheel)
+        );
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      scheduler->running = false;
+      http_fiber_scheduler_current = outer;
+      return false;
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+      if (events[k].data.ptr == &scheduler->stop_fd)
+      {
+        while (read(scheduler->stop_fd, &value, sizeof(value)) > 0)
+          ;
+        scheduler->running = false;
+        continue;
+      }
+
+      fiber = (HTTPFiber *) events[k].data.ptr;
+      http_timer_wheel_cancel(scheduler->timer_wheel, &fiber->timer);
+      fiber->wait_result = 1;
+      http_fiber_make_ready(fiber);
+    }
+
+    http_timer_wheel_advance(scheduler->timer_wheel, http_wait_now());
+  }
+
+  scheduler->running = false;
+  http_fiber_scheduler_current = outer;
+
+  return true;
+}
+
+void http_fiber_scheduler_stop(HTTPFiberScheduler * scheduler)
+{
+  uint64_t value = 1;
+
+  assert(scheduler);
+
+  (void) !write(scheduler->stop_fd, &value, sizeof(value));
+}
+
+uint32_t http_fiber_scheduler_get_fiber_count(HTTPFiberScheduler * scheduler)
+{
+  assert(scheduler);
+
+  return scheduler->fiber_count;
+}
+
+bool http_fiber_spawn(
+    HTTPFiberScheduler * scheduler,
+    HTTPFiberFunction function,
+    void * context
+    )
+{
+  HTTPFiber * fiber;
+
+  assert(scheduler);
+  assert(function);
+
+  fiber = http_fiber_new(scheduler);
+  if (!fiber)
+    return false;
+
+  fiber->function = function;
+  fiber->function_context = context;
+  fiber->wait_fd = -1;
+  fiber->wait_result = 0;
+  fiber->finished = false;
+
+  getcontext(&fiber->context);
+  fiber->context.uc_stack.ss_sp = fiber->stack + scheduler->page_size;
+  fiber->context.uc_stack.ss_size = scheduler->stack_size;
+  fiber->context.uc_link = &scheduler->context;
+  makecontext(&fiber->context, http_fiber_entry, 0);
+
+  fiber->live_prev = NULL;
+  fiber->live_next = scheduler->live;
+  if (fiber->live_next)
+    fiber->live_next->live_prev = fiber;
+  scheduler->live = fiber;
+  scheduler->fiber_count++;
+
+  http_fiber_make_ready(fiber);
+
+  return true;
+}
+
+bool http_fiber_is_running(void)
+{
+  return http_fiber_scheduler_current && http_fiber_scheduler_current->current;
+}
+
+void http_fiber_yield(void)
+{
+  HTTPFiber * fiber;
+
+  assert(http_fiber_is_running());
+
+  fiber = http_fiber_scheduler_current->current;
+  http_fiber_make_ready(fiber);
+  http_fiber_suspend(fiber);
+}
+
+void http_fiber_sleep(uint32_t milliseconds)
+{
+  HTTPFiber * fiber;
+
+  assert(http_fiber_is_running());
+
+  fiber = http_fiber_scheduler_current->current;
+  http_timer_wheel_arm(
+      fiber->scheduler->timer_wheel,
+      &fiber->timer,
+      http_wait_now() + milliseconds
+      );
+  http_fiber_suspend(fiber);
+}
+
+int http_fiber_wait(int fd, short events, int timeout, void * context)
+{
+  struct epoll_event event;
+  HTTPFiberScheduler * scheduler;
+  HTTPFiber * fiber;
+
+  if (!http_fiber_is_running() || timeout == 0)
+    return http_wait_poll(fd, events, timeout, context);
+
+  scheduler = http_fiber_scheduler_current;
+  fiber = scheduler->current;
+
+  event.events = EPOLLONESHOT;
+  if (events & POLLIN)
+    event.events |= EPOLLIN | EPOLLRDHUP;
+  if (events & POLLOUT)
+    event.events |= EPOLLOUT;
+  event.data.ptr = fiber;
+
+  /* a descriptor stays registered (disarmed) between waits, and the
+   * kernel forgets it once closed
+   */
+  if (epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+  {
+    if (
+      errno != ENOENT ||
+      epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0
+      )
+      return -1;
+  }
+
+  fiber->wait_fd = fd;
+  if (timeout > 0)
+    http_timer_wheel_arm(
+        scheduler->timer_wheel,
+        &fiber->timer,
+        http_wait_now() + timeout
+        );
+
+  http_fiber_suspend(fiber);
+  fiber->wait_fd = -1;
+
+  return fiber->wait_result;
+}
@@ -0,0 +1,59 @@
+
+
+#ifndef __CHTTP_HTTP_FIBER_H
+#define __CHTTP_HTTP_FIBER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* a scheduler runs fibers on the thread calling http_fiber_scheduler_run,
+ * one at a time, each on a stack of its own. code written against
+ * blocking calls runs unchanged in a fiber as long as its descriptors are
+ * non-blocking and its waits go through http_fiber_wait, eg.
+ *
+ *   http_reader_set_wait_function(reader, http_fiber_wait, NULL);
+ *   http_writer_set_wait_function(writer, http_fiber_wait, NULL);
+ *
+ * a wait then suspends the fiber until the descriptor is ready (or the
+ * wait times out) and the scheduler runs the others meanwhile
+ */
+
+struct HTTPFiberScheduler;
+typedef struct HTTPFiberScheduler HTTPFiberScheduler;
+
+typedef void (*HTTPFiberFunction)(void * context);
+
+
+HTTPFiberScheduler * http_fiber_scheduler_new(size_t stack_size); /* or 0 */
+void http_fiber_scheduler_destroy(HTTPFiberScheduler * scheduler);
+
+/* runs until no fiber is left or until http_fiber_scheduler_stop. false
+ * if waiting for descriptors failed
+ */
+bool http_fiber_scheduler_run(HTTPFiberScheduler * scheduler);
+void http_fiber_scheduler_stop(HTTPFiberScheduler * scheduler); /* any thread */
+
+uint32_t http_fiber_scheduler_get_fiber_count(HTTPFiberScheduler * scheduler);
+
+/* on the scheduler's thread; false if no stack could be had */
+bool http_fiber_spawn(
+    HTTPFiberScheduler * scheduler,
+    HTTPFiberFunction function,
+    void * context
+    );
+
+/* in a fiber */
+bool http_fiber_is_running(void);
+void http_fiber_yield(void);
+void http_fiber_sleep(uint32_t milliseconds);
+
+/* an HTTPWaitFunction (`context' is unused). in a fiber it suspends the
+ * fiber instead of the thread; one fiber may wait on a descriptor at a
+ * time. outside of a fiber it is http_wait_poll
+ */
+int http_fiber_wait(int fd, short events, int timeout, void * context);
+
+
+#endif
@@ -0,0 +1,48 @@
+
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "http_io.h"
+
+
+/* counts a system call moving `result' bytes as `metric' */
+void http_io_count(HTTPMetric metric, ssize_t result)
+{
+  if (!http_metrics_is_enabled())
+    return;
+
+  http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+  if (result > 0)
+    http_metrics_add(metric, result);
+}
+
+ssize_t http_io_read(int fd, void * data, size_t length, void * context)
+{
+  ssize_t ret;
+
+  (void) context;
+
+  ret = read(fd, data, length);
+  http_io_count(HTTP_METRIC_BYTES_RECEIVED, ret);
+
+  return ret;
+}
+
+ssize_t http_io_write(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  ssize_t ret;
+
+  (void) context;
+
+  ret = write(fd, data, length);
+  http_io_count(HTTP_METRIC_BYTES_SENT, ret);
+
+  return ret;
+}
+
@@ -0,0 +1,41 @@
+
+
+#ifndef __CHTTP_HTTP_IO_H
+#define __CHTTP_HTTP_IO_H
+
+#include <sys/types.h>
+
+#include "http_metrics.h"
+
+
+/* stand-ins for read(2) and write(2), letting the reader and writer be
+ * pointed at something other than a raw descriptor. same return and errno
+ * conventions as the system calls
+ */
+typedef ssize_t (*HTTPReadFunction)(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    );
+typedef ssize_t (*HTTPWriteFunction)(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    );
+
+
+ssize_t http_io_read(int fd, void * data, size_t length, void * context);
+ssize_t http_io_write(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    );
+
+void http_io_count(HTTPMetric metric, ssize_t result);
+
+
+#endif
+
@@ -1,10 +1,12 @@
 
 #include <assert.h>
 #include <baselib/baselib.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "http_allocator.h"
 #include "http_content.h"
 #include "http_utils.h"
 #include "http_version.h"
@@ -16,7 +18,11 @@
 
 /* INTERNAL (declared in message_struct.h) */
 
-void http_message_init_struct(HTTPMessage * message, HTTPMessageType mt)
+void http_message_init_struct(
+    HTTPMessage * message,
+    HTTPMessageType mt,
+    HTTPAllocator allocator
+    )
 {
   message->message_type = mt;
   message->version = HTTP_VERSION_1_1;
@@ -24,6 +30,7 @@ void http_message_init_struct(HTTPMessage * message, HTTPMessageType mt)
   message->cookies = list_new(LIST_TYPE_LINKED_LIST);
   message->content.data = NULL;
   message->content.length = 0;
+  message->allocator = allocator;
 }
 
 void http_message_deinit_struct(HTTPMessage * message)
@@ -83,6 +90,12 @@ HTTPContent http_message_get_content(HTTPMessage * message)
   return message->content;
 }
 
+HTTPAllocator http_message_get_allocator(HTTPMessage * message)
+{
+  assert(message);
+  return message->allocator;
+}
+
 List * http_message_list_header_keys(HTTPMessage * message)
 {
   assert(message);
@@ -203,18 +216,17 @@ time_t http_message_get_date(HTTPMessage * message)
 
   return http_utils_parse_date(str);
 }
+/* -1 if the header is absent, or is not a single length that fits */
 ssize_t http_message_get_content_length(HTTPMessage * message)
 {
   unsigned long long int value;
-  char
-    * str = http_message_get_header_imp(message, "Content-Length"),
-    * endptr;
+  char * str = http_message_get_header_imp(message, "Content-Length");
 
-  if (!str)
-    return (ssize_t) -1;
-
-  value = strtoull(str, &endptr, 10);
-  if (!value && endptr[0] != '\0')
+  if (
+    !str ||
+    !http_utils_parse_content_length(str, strlen(str), &value) ||
+    value > SSIZE_MAX
+    )
     return (ssize_t) -1;
 
   return (ssize_t) value;
@@ -424,4 +436,14 @@ void http_message_remove_cookie(HTTPMessage * message, HTTPCookie * cookie)
   list_remove(message->cookies, ptr_to_any(cookie));
 }
 
+/* frees the content through the message's allocator, which it must have
+ * come from, and leaves the message without any
+ */
+void http_message_free_content(HTTPMessage * message)
+{
+  assert(message);
 
+  http_allocator_free(&message->allocator, message->content.data);
+  message->content.data = NULL;
+  message->content.length = 0;
+}
@@ -5,6 +5,7 @@
 #include <baselib/baselib.h>
 #include <time.h>
 
+#include "http_allocator.h"
 #include "http_content.h"
 #include "http_cookie.h"
 #include "http_version.h"
@@ -24,6 +25,10 @@ HTTPMessageType http_message_get_type(HTTPMessage * message);
 
 HTTPVersion http_message_get_version(HTTPMessage * message);
 HTTPContent http_message_get_content(HTTPMessage * message);
+/* content belongs to the message's allocator: the one it was made with,
+ * or its reader's. free it with http_message_free_content
+ */
+HTTPAllocator http_message_get_allocator(HTTPMessage * message);
 
 List * http_message_list_header_keys(HTTPMessage * message);
 bool http_message_has_header(HTTPMessage * message, char * name);
@@ -75,5 +80,7 @@ void http_message_add_cookie(HTTPMessage * message, HTTPCookie * cookie);
 void http_message_add_cookies(HTTPMessage * message, List * cookies);
 void http_message_remove_cookie(HTTPMessage * messagse, HTTPCookie * cookie);
 
+void http_message_free_content(HTTPMessage * message);
+
 #endif
 
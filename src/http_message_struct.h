@@ -4,6 +4,7 @@
 
 #include <baselib/baselib.h>
 
+#include "http_allocator.h"
 #include "http_content.h"
 #include "http_version.h"
 #include "http_message_type.h"
@@ -15,11 +16,16 @@ struct HTTPMessage
   Dictionary * headers;
   HTTPContent content;
   List * cookies;
+  HTTPAllocator allocator; /* of the message, what it owns and its content */
 
   void (*destroy)(HTTPMessage * message);
 };
 
-void http_message_init_struct(HTTPMessage * message, HTTPMessageType mt);
+void http_message_init_struct(
+    HTTPMessage * message,
+    HTTPMessageType mt,
+    HTTPAllocator allocator
+    );
 void http_message_deinit_struct(HTTPMessage * message);
 
 #endif
@@ -0,0 +1,389 @@
+
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "http_metrics.h"
+
+
+#define _HTTP_METRICS_CACHE_LINE 64
+#define _HTTP_METRICS_SHARD_COUNT 0x40
+
+/* bucket k holds durations up to 2^k microseconds; the last, the rest */
+#define _HTTP_METRICS_BUCKET_COUNT 25
+
+
+struct HTTPMetricsHistogram;
+typedef struct HTTPMetricsHistogram HTTPMetricsHistogram;
+struct HTTPMetricsShard;
+typedef struct HTTPMetricsShard HTTPMetricsShard;
+struct HTTPMetricsPrinter;
+typedef struct HTTPMetricsPrinter HTTPMetricsPrinter;
+
+struct HTTPMetricsHistogram
+{
+  uint64_t buckets [_HTTP_METRICS_BUCKET_COUNT + 1];
+  uint64_t count, sum; /* the sum in nanoseconds */
+};
+
+struct HTTPMetricsShard
+{
+  _Alignas(_HTTP_METRICS_CACHE_LINE) uint64_t counters [HTTP_METRIC_COUNT];
+  HTTPMetricsHistogram histograms [HTTP_METRIC_HISTOGRAM_COUNT];
+};
+
+/* text appended to a buffer which may be too short, counting all of it */
+struct HTTPMetricsPrinter
+{
+  char * buffer;
+  size_t buffer_length, length;
+};
+
+
+static bool http_metrics_enabled = false;
+static HTTPMetricsShard http_metrics_shards [_HTTP_METRICS_SHARD_COUNT];
+static uint32_t http_metrics_next_shard = 0;
+static __thread HTTPMetricsShard * http_metrics_shard = NULL;
+
+static const struct
+{
+  HTTPMetric metric;
+  const char * status;
+} http_metrics_parse_errors [] =
+{
+  { HTTP_METRIC_PARSE_ERRORS_400, "400" },
+  { HTTP_METRIC_PARSE_ERRORS_408, "408" },
+  { HTTP_METRIC_PARSE_ERRORS_411, "411" },
+  { HTTP_METRIC_PARSE_ERRORS_414, "414" },
+  { HTTP_METRIC_PARSE_ERRORS_417, "417" },
+  { HTTP_METRIC_PARSE_ERRORS_431, "431" },
+};
+
+static const struct
+{
+  HTTPMetric metric;
+  const char * name, * help;
+} http_metrics_counters [] =
+{
+  {
+    HTTP_METRIC_MESSAGES_PARSED,
+    "chttp_messages_parsed_total",
+    "Messages read in full."
+  },
+  {
+    HTTP_METRIC_BYTES_RECEIVED,
+    "chttp_received_bytes_total",
+    "Bytes read from descriptors and transports."
+  },
+  {
+    HTTP_METRIC_BYTES_SENT,
+    "chttp_sent_bytes_total",
+    "Bytes written to descriptors and transports."
+  },
+  {
+    HTTP_METRIC_SYSCALLS,
+    "chttp_syscalls_total",
+    "System calls issued for I/O and waiting."
+  },
+  {
+    HTTP_METRIC_ALLOCATIONS,
+    "chttp_allocations_total",
+    "Allocations made through the chttp allocator."
+  },
+};
+
+static const struct
+{
+  HTTPMetricHistogram histogram;
+  const char * name, * help;
+} http_metrics_histograms [] =
+{
+  {
+    HTTP_METRIC_HISTOGRAM_READ,
+    "chttp_read_duration_seconds",
+    "Time from beginning to read a message to its content being read."
+  },
+  {
+    HTTP_METRIC_HISTOGRAM_RESPONSE,
+    "chttp_response_duration_seconds",
+    "Time from dispatching a request to rendering its response."
+  },
+};
+
+
+static HTTPMetricsShard * http_metrics_get_shard(void)
+{
+  uint32_t index;
+
+  if (!http_metrics_shard)
+  {
+    index = __atomic_fetch_add(&http_metrics_next_shard, 1, __ATOMIC_RELAXED);
+    http_metrics_shard =
+      &http_metrics_shards[index % _HTTP_METRICS_SHARD_COUNT];
+  }
+
+  return http_metrics_shard;
+}
+
+static size_t http_metrics_get_bucket(uint64_t duration)
+{
+  uint64_t microseconds = (duration + 999) / 1000;
+  size_t ret;
+
+  if (microseconds <= 1)
+    return 0;
+
+  ret = 64 - __builtin_clzll(microseconds - 1);
+  return ret > _HTTP_METRICS_BUCKET_COUNT - 1 ?
+    _HTTP_METRICS_BUCKET_COUNT :
+    ret;
+}
+
+static uint64_t http_metrics_load(const uint64_t * value)
+{
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static void http_metrics_printf(
+    HTTPMetricsPrinter * printer,
+    const char * format,
+    ...
+    )
+{
+  va_list arguments;
+  size_t available;
+  int length;
+
+  available = printer->length < printer->buffer_length ?
+    printer->buffer_length - printer->length :
+    0;
+
+  va_start(arguments, format);
+  length = vsnprintf(
+      available ? &printer->buffer[printer->length] : NULL,
+      available,
+      format,
+      arguments
+      );
+  va_end(arguments);
+
+  if (length > 0)
+    printer->length += length;
+}
+
+static void http_metrics_print_histogram(
+    HTTPMetricsPrinter * printer,
+    HTTPMetricHistogram histogram,
+    const char * name,
+    const char * help
+    )
+{
+  uint64_t buckets [_HTTP_METRICS_BUCKET_COUNT + 1], count = 0, sum = 0;
+  HTTPMetricsHistogram * shard_histogram;
+  uint64_t cumulative = 0;
+
+  memset(buckets, 0, sizeof(buckets));
+
+  for (size_t k = 0; k < _HTTP_METRICS_SHARD_COUNT; k++)
+  {
+    shard_histogram = &http_metrics_shards[k].histograms[histogram];
+    for (size_t i = 0; i <= _HTTP_METRICS_BUCKET_COUNT; i++)
+      buckets[i] += http_metrics_load(&shard_histogram->buckets[i]);
+    count += http_metrics_load(&shard_histogram->count);
+    sum += http_metrics_load(&shard_histogram->sum);
+  }
+
+  http_metrics_printf(printer, "# HELP %s %s\n", name, help);
+  http_metrics_printf(printer, "# TYPE %s histogram\n", name);
+
+  for (size_t i = 0; i < _HTTP_METRICS_BUCKET_COUNT; i++)
+  {
+    cumulative += buckets[i];
+    http_metrics_printf(
+        printer,
+        "%s_bucket{le=\"%g\"} %llu\n",
+        name,
+        (double) (1ULL << i) / 1e6,
+        (unsigned long long) cumulative
+        );
+  }
+
+  /* shards are summed without stopping writers, so keep +Inf == count */
+  cumulative += buckets[_HTTP_METRICS_BUCKET_COUNT];
+  if (count < cumulative)
+    count = cumulative;
+
+  http_metrics_printf(
+      printer,
+      "%s_bucket{le=\"+Inf\"} %llu\n",
+      name,
+      (unsigned long long) count
+      );
+  http_metrics_printf(printer, "%s_sum %.9f\n", name, (double) sum / 1e9);
+  http_metrics_printf(
+      printer,
+      "%s_count %llu\n",
+      name,
+      (unsigned long long) count
+      );
+}
+
+
+void http_metrics_set_enabled(bool value)
+{
+  __atomic_store_n(&http_metrics_enabled, value, __ATOMIC_RELAXED);
+}
+
+bool http_metrics_is_enabled(void)
+{
+  return __atomic_load_n(&http_metrics_enabled, __ATOMIC_RELAXED);
+}
+
+void http_metrics_add(HTTPMetric metric, uint64_t value)
+{
+  assert(metric < HTTP_METRIC_COUNT);
+
+  if (!http_metrics_is_enabled())
+    return;
+
+  __atomic_fetch_add(
+      &http_metrics_get_shard()->counters[metric],
+      value,
+      __ATOMIC_RELAXED
+      );
+}
+
+void http_metrics_add_parse_error(HTTPStatusCode status_code)
+{
+  switch (status_code)
+  {
+    case HTTP_STATUS_CODE_408_REQUEST_TIMEOUT:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_408, 1);
+      break;
+    case HTTP_STATUS_CODE_411_LENGTH_REQUIRED:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_411, 1);
+      break;
+    case HTTP_STATUS_CODE_414_URI_TOO_LONG:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_414, 1);
+      break;
+    case HTTP_STATUS_CODE_417_EXPECTATION_FAILED:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_417, 1);
+      break;
+    case HTTP_STATUS_CODE_431_REQUEST_HEADER_FIELDS_TOO_LARGE:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_431, 1);
+      break;
+    default:
+      http_metrics_add(HTTP_METRIC_PARSE_ERRORS_400, 1);
+      break;
+  }
+}
+
+void http_metrics_observe(HTTPMetricHistogram histogram, uint64_t duration)
+{
+  HTTPMetricsHistogram * shard_histogram;
+
+  assert(histogram < HTTP_METRIC_HISTOGRAM_COUNT);
+
+  if (!http_metrics_is_enabled())
+    return;
+
+  shard_histogram = &http_metrics_get_shard()->histograms[histogram];
+
+  __atomic_fetch_add(
+      &shard_histogram->buckets[http_metrics_get_bucket(duration)],
+      1,
+      __ATOMIC_RELAXED
+      );
+  __atomic_fetch_add(&shard_histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shard_histogram->sum, duration, __ATOMIC_RELAXED);
+}
+
+uint64_t http_metrics_get(HTTPMetric metric)
+{
+  uint64_t ret = 0;
+
+  assert(metric < HTTP_METRIC_COUNT);
+
+  for (size_t k = 0; k < _HTTP_METRICS_SHARD_COUNT; k++)
+    ret += http_metrics_load(&http_metrics_shards[k].counters[metric]);
+
+  return ret;
+}
+
+/* zeroes every metric. counts kept meanwhile may survive it */
+void http_metrics_reset(void)
+{
+  uint64_t * values;
+  size_t count;
+
+  for (size_t k = 0; k < _HTTP_METRICS_SHARD_COUNT; k++)
+  {
+    values = (uint64_t *) &http_metrics_shards[k];
+    count = sizeof(HTTPMetricsShard) / sizeof(uint64_t);
+    for (size_t i = 0; i < count; i++)
+      __atomic_store_n(&values[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+size_t http_metrics_print(char * buffer, size_t buffer_length)
+{
+  HTTPMetricsPrinter printer;
+  size_t count;
+
+  assert(buffer || buffer_length == 0);
+
+  printer.buffer = buffer;
+  printer.buffer_length = buffer_length;
+  printer.length = 0;
+
+  if (buffer_length)
+    buffer[0] = '\0';
+
+  count = sizeof(http_metrics_counters) / sizeof(http_metrics_counters[0]);
+  for (size_t k = 0; k < count; k++)
+  {
+    http_metrics_printf(
+        &printer,
+        "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+        http_metrics_counters[k].name,
+        http_metrics_counters[k].help,
+        http_metrics_counters[k].name,
+        http_metrics_counters[k].name,
+        (unsigned long long) http_metrics_get(http_metrics_counters[k].metric)
+        );
+  }
+
+  http_metrics_printf(
+      &printer,
+      "# HELP chttp_parse_errors_total "
+        "Messages which failed to parse, by the status they call for.\n"
+      "# TYPE chttp_parse_errors_total counter\n"
+      );
+  count = sizeof(http_metrics_parse_errors) /
+    sizeof(http_metrics_parse_errors[0]);
+  for (size_t k = 0; k < count; k++)
+  {
+    http_metrics_printf(
+        &printer,
+        "chttp_parse_errors_total{status=\"%s\"} %llu\n",
+        http_metrics_parse_errors[k].status,
+        (unsigned long long)
+          http_metrics_get(http_metrics_parse_errors[k].metric)
+        );
+  }
+
+  count = sizeof(http_metrics_histograms) / sizeof(http_metrics_histograms[0]);
+  for (size_t k = 0; k < count; k++)
+    http_metrics_print_histogram(
+        &printer,
+        http_metrics_histograms[k].histogram,
+        http_metrics_histograms[k].name,
+        http_metrics_histograms[k].help
+        );
+
+  return printer.length;
+}
@@ -0,0 +1,69 @@
+
+
+#ifndef __CHTTP_HTTP_METRICS_H
+#define __CHTTP_HTTP_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_status_code.h"
+
+
+enum HTTPMetric
+{
+  HTTP_METRIC_MESSAGES_PARSED = 0,
+  HTTP_METRIC_BYTES_RECEIVED = 1,
+  HTTP_METRIC_BYTES_SENT = 2,
+  HTTP_METRIC_SYSCALLS = 3, /* reads, writes, accepts, waits and the like */
+  HTTP_METRIC_ALLOCATIONS = 4, /* through the allocator; not baselib's */
+
+  /* parse errors, by the status code they call for */
+  HTTP_METRIC_PARSE_ERRORS_400 = 5, /* and those which call for none */
+  HTTP_METRIC_PARSE_ERRORS_408 = 6,
+  HTTP_METRIC_PARSE_ERRORS_411 = 7,
+  HTTP_METRIC_PARSE_ERRORS_414 = 8,
+  HTTP_METRIC_PARSE_ERRORS_417 = 9,
+  HTTP_METRIC_PARSE_ERRORS_431 = 10,
+
+  HTTP_METRIC_COUNT = 11,
+};
+typedef enum HTTPMetric HTTPMetric;
+
+enum HTTPMetricHistogram
+{
+  /* from a reader beginning on a message to its content being read */
+  HTTP_METRIC_HISTOGRAM_READ = 0,
+  /* from the server dispatching a request to its response being rendered */
+  HTTP_METRIC_HISTOGRAM_RESPONSE = 1,
+
+  HTTP_METRIC_HISTOGRAM_COUNT = 2,
+};
+typedef enum HTTPMetricHistogram HTTPMetricHistogram;
+
+
+/* metrics are off until enabled, and cost a branch where they are kept.
+ * each thread counts into a shard of its own (up to 64, then shared), so
+ * keeping them never contends for a cache line; reading sums the shards
+ */
+void http_metrics_set_enabled(bool value);
+bool http_metrics_is_enabled(void);
+
+void http_metrics_add(HTTPMetric metric, uint64_t value);
+void http_metrics_add_parse_error(HTTPStatusCode status_code);
+void http_metrics_observe(
+    HTTPMetricHistogram histogram,
+    uint64_t duration /* in nanoseconds */
+    );
+
+uint64_t http_metrics_get(HTTPMetric metric);
+void http_metrics_reset(void);
+
+/* renders every metric in the Prometheus text exposition format. returns
+ * the length of the whole text, as snprintf does; at buffer_length or
+ * more it was cut short. `buffer' may be NULL when `buffer_length' is 0
+ */
+size_t http_metrics_print(char * buffer, size_t buffer_length);
+
+
+#endif
@@ -0,0 +1,89 @@
+
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "http_mpsc_queue.h"
+
+
+/* Vyukov's intrusive queue: producers swap themselves in as the head and
+ * then link the previous head to themselves, so a push is one atomic
+ * exchange. the consumer may briefly see a push whose link is not yet
+ * made, in which case the queue reads as empty until it is
+ */
+
+void http_mpsc_queue_init(HTTPMPSCQueue * queue)
+{
+  assert(queue);
+
+  queue->stub.next = NULL;
+  queue->head = &queue->stub;
+  queue->tail = &queue->stub;
+}
+
+void http_mpsc_queue_push(HTTPMPSCQueue * queue, HTTPMPSCNode * node)
+{
+  HTTPMPSCNode * prev;
+
+  assert(queue);
+  assert(node);
+
+  __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+HTTPMPSCNode * http_mpsc_queue_pop(HTTPMPSCQueue * queue)
+{
+  HTTPMPSCNode * tail, * next, * head;
+
+  assert(queue);
+
+  tail = queue->tail;
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &queue->stub)
+  {
+    if (!next)
+      return NULL;
+
+    queue->tail = next;
+    tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next)
+  {
+    queue->tail = next;
+    return tail;
+  }
+
+  head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+  if (tail != head)
+    return NULL; /* a push is half done */
+
+  /* `tail' is the last node; queue the stub behind it so it can go */
+  http_mpsc_queue_push(queue, &queue->stub);
+
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next)
+  {
+    queue->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+/* true only if nothing has been pushed that is yet to be popped, even a
+ * push still in progress
+ */
+bool http_mpsc_queue_is_empty(HTTPMPSCQueue * queue)
+{
+  assert(queue);
+
+  return queue->tail == &queue->stub &&
+         __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == &queue->stub;
+}
+
@@ -0,0 +1,41 @@
+
+
+#ifndef __CHTTP_HTTP_MPSC_QUEUE_H
+#define __CHTTP_HTTP_MPSC_QUEUE_H
+
+#include <stdbool.h>
+
+
+struct HTTPMPSCNode;
+typedef struct HTTPMPSCNode HTTPMPSCNode;
+
+/* intrusive node; embed it in the object being queued */
+struct HTTPMPSCNode
+{
+  HTTPMPSCNode * next;
+};
+
+/* an unbounded lock-free queue which any number of threads push onto and
+ * one thread pops from. pushing never blocks, waits or allocates. treat
+ * the members as private
+ */
+struct HTTPMPSCQueue
+{
+  HTTPMPSCNode * head; /* most recently pushed; shared by producers */
+  HTTPMPSCNode * tail; /* next to pop; the consumer's alone */
+  HTTPMPSCNode stub;
+};
+typedef struct HTTPMPSCQueue HTTPMPSCQueue;
+
+
+void http_mpsc_queue_init(HTTPMPSCQueue * queue);
+
+void http_mpsc_queue_push(HTTPMPSCQueue * queue, HTTPMPSCNode * node);
+
+/* consumer only */
+HTTPMPSCNode * http_mpsc_queue_pop(HTTPMPSCQueue * queue);
+bool http_mpsc_queue_is_empty(HTTPMPSCQueue * queue);
+
+
+#endif
+
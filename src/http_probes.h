@@ -0,0 +1,46 @@
+
+
+#ifndef __CHTTP_HTTP_PROBES_H
+#define __CHTTP_HTTP_PROBES_H
+
+
+/* static tracepoints (USDT) of the `chttp' provider, for bpftrace, perf
+ * or SystemTap. each is a single nop until a tracer attaches to it; eg.
+ *
+ *   bpftrace -e 'usdt:./libchttp.so:chttp:message__start { ... }'
+ *
+ * without <sys/sdt.h>, or built with -DCHTTP_NO_PROBES, they are nothing.
+ * the reader's probes are
+ *
+ *   message__start (reader)
+ *   header__parsed (reader, name, value)
+ *   body__complete (reader, message, content length)
+ *   error          (reader, HTTPReaderError, HTTPStatusCode, offset)
+ *
+ * and the writer's
+ *
+ *   write__start    (writer, message, fd)
+ *   write__complete (writer, fd, HTTPWriterError, bytes of the message)
+ */
+#if !defined(CHTTP_NO_PROBES) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define __CHTTP_HAS_PROBES
+#  endif
+#endif
+
+#ifdef __CHTTP_HAS_PROBES
+#  define HTTP_PROBE1(name, a) \
+  DTRACE_PROBE1(chttp, name, a)
+#  define HTTP_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(chttp, name, a, b, c)
+#  define HTTP_PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4(chttp, name, a, b, c, d)
+#else
+#  define HTTP_PROBE1(name, a) ((void) 0)
+#  define HTTP_PROBE3(name, a, b, c) ((void) 0)
+#  define HTTP_PROBE4(name, a, b, c, d) ((void) 0)
+#endif
+
+
+#endif
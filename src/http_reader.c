@@ -3,19 +3,26 @@
 #include <assert.h>
 #include <baselib/baselib.h>
 #include <errno.h>
-#include <time.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "buffered_reader.h"
 #include "http_cookie.h"
 #include "http_message.h"
+#include "http_metrics.h"
+#include "http_probes.h"
 #include "http_status_code.h"
 #include "http_response.h"
 #include "http_request.h"
 #include "http_utils.h"
 #include "http_version.h"
+#include "http_wait.h"
 #include "http_writer.h"
 
 #include "http_reader.h"
@@ -27,17 +34,34 @@ struct HTTPReader
 {
   HTTPReaderSettings settings;
 
-  char * error;
+  HTTPReaderError error;
   int error_number, output_fd;
+  size_t offset, error_offset;
   HTTPStatusCode status_code;
   BufferedReader * br;
-  bool expect_head_only;
+  bool expect_head_only, borrow_content;
+  void * mapping; /* of a reader made by http_reader_new_from_mmap */
+  size_t mapping_length;
 
   HTTPMessage * message;
   char * last_parsed_header;
   bool parsing_first_line;
-  time_t header_start_time, content_start_time;
-
+  uint64_t header_deadline, content_deadline; /* as per http_wait_now */
+  HTTPWaitFunction wait;
+  void * wait_context;
+  HTTPWriteFunction write; /* of interim responses, if not the transport's */
+  void * write_context;
+  HTTPTransport * transport;
+
+  HTTPTimerWheel * timer_wheel;
+  HTTPTimer header_timer, content_timer, idle_timer;
+  HTTPReaderTimeoutCallback timeout_callback;
+  void * timeout_context;
+
+  HTTPAllocator allocator; /* of the messages read, their content and lines */
+
+  bool timed;
+  HTTPReaderTimings timings;
 };
 
 static void http_reader_reset(HTTPReader * reader)
@@ -48,38 +72,90 @@ static void http_reader_reset(HTTPReader * reader)
     reader->message = NULL;
   }
   
-  free(reader->last_parsed_header);
-  free(reader->error);
+  http_allocator_free(&reader->allocator, reader->last_parsed_header);
 
   reader->parsing_first_line = false;
   reader->last_parsed_header = NULL;
-  reader->error = NULL;
-  reader->header_start_time = 0;
-  reader->content_start_time = 0;
+  reader->error = HTTP_READER_ERROR_NONE;
+  reader->offset = 0;
+  reader->error_offset = 0;
+  reader->header_deadline = 0;
+  reader->content_deadline = 0;
 }
 
-static uint32_t http_reader_remaining_header_read_time(HTTPReader * reader)
+static void http_reader_fail(
+    HTTPReader * reader,
+    HTTPReaderError error,
+    HTTPStatusCode status_code
+    )
 {
-  time_t now = time(NULL);
+  reader->error = error;
+  reader->error_offset = reader->offset;
+  if (status_code)
+    reader->status_code = status_code;
 
-  if (reader->header_start_time +
-      reader->settings.header_receive_timeout < now)
-  {
-    return 0;
-  }
+  HTTP_PROBE4(error, reader, error, status_code, reader->offset);
+
+  /* the input was at fault, rather than its source or the peer */
+  if (
+    status_code ||
+    (error >= HTTP_READER_ERROR_START_LINE_TOO_LONG &&
+     error != HTTP_READER_ERROR_EXPECT_CONTINUE_REJECTED &&
+     error != HTTP_READER_ERROR_WRITE_FAILED)
+    )
+    http_metrics_add_parse_error(status_code);
+}
+
+static void http_reader_timer_fired(HTTPTimer * timer, void * context)
+{
+  HTTPReader * reader = (HTTPReader *) context;
+  HTTPReaderTimer kind;
+
+  if (timer == &reader->header_timer)
+    kind = HTTP_READER_TIMER_HEADER;
+  else if (timer == &reader->content_timer)
+    kind = HTTP_READER_TIMER_CONTENT;
   else
-    return reader->settings.header_receive_timeout -
-           (now - reader->header_start_time);
+    kind = HTTP_READER_TIMER_IDLE;
+
+  if (reader->timeout_callback)
+    reader->timeout_callback(reader, kind, reader->timeout_context);
+}
+
+static void http_reader_arm_timer(
+    HTTPReader * reader,
+    HTTPTimer * timer,
+    uint64_t deadline
+    )
+{
+  if (reader->timer_wheel)
+    http_timer_wheel_arm(reader->timer_wheel, timer, deadline);
+}
+
+static void http_reader_cancel_timers(HTTPReader * reader)
+{
+  if (!reader->timer_wheel)
+    return;
+
+  http_timer_wheel_cancel(reader->timer_wheel, &reader->header_timer);
+  http_timer_wheel_cancel(reader->timer_wheel, &reader->content_timer);
+  http_timer_wheel_cancel(reader->timer_wheel, &reader->idle_timer);
+}
+
+static uint32_t http_reader_remaining_header_read_time(HTTPReader * reader)
+{
+  return http_wait_remaining(reader->header_deadline);
 }
 
 static bool http_reader_content_read_expired(HTTPReader * reader)
 {
-  time_t now = time(NULL);
-  if (reader->content_start_time +
-      reader->settings.content_receive_timeout < now)
+  if (http_wait_now() >= reader->content_deadline)
   {
-    reader->error = strings_clone("content read timed out");
-    reader->status_code = HTTP_STATUS_CODE_408_REQUEST_TIMEOUT;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_CONTENT_READ_TIMED_OUT,
+        HTTP_STATUS_CODE_408_REQUEST_TIMEOUT
+        );
     return true;
   }
   else
@@ -91,10 +167,7 @@ static void http_reader_check_fd_error(HTTPReader * reader)
   if (errno)
   {
     reader->error_number = errno;
-    reader->error = strings_format(
-        "read error: %s",
-        errors_get_errno_name(reader->error_number)
-        );
+    http_reader_fail(reader, HTTP_READER_ERROR_READ_FAILED, 0);
   }
 }
 
@@ -105,43 +178,55 @@ static char * http_reader_read_line(
 {
   char * ret = NULL;
   BufferedReaderError error;
+  size_t consumed;
 
   if (reader->error)
     return NULL;
   
   error = buffered_reader_read_line(
-    reader->br, max, &ret,
+    reader->br, max, &ret, &consumed,
     http_reader_remaining_header_read_time(reader)
     );
   switch (error)
   {
     case BUFFERED_READER_ERROR_NONE:
+      reader->offset += consumed; /* the terminator included */
       break;
     case BUFFERED_READER_ERROR_TIMEOUT:
-      reader->error = strings_clone("read timed out");
-      reader->status_code = HTTP_STATUS_CODE_408_REQUEST_TIMEOUT;
+      http_reader_fail(
+          reader,
+          HTTP_READER_ERROR_READ_TIMED_OUT,
+          HTTP_STATUS_CODE_408_REQUEST_TIMEOUT
+          );
       break;
     case BUFFERED_READER_ERROR_LINE_TOO_LONG:
       if (reader->parsing_first_line)
-      {
-        reader->error = strings_clone("start line too long");
-        reader->status_code = HTTP_STATUS_CODE_414_URI_TOO_LONG;
-      }
+        http_reader_fail(
+            reader,
+            HTTP_READER_ERROR_START_LINE_TOO_LONG,
+            HTTP_STATUS_CODE_414_URI_TOO_LONG
+            );
       else
-      {
-        reader->error = strings_clone("header line too long");
-        reader->status_code =
-          HTTP_STATUS_CODE_431_REQUEST_HEADER_FIELDS_TOO_LARGE;
-      }
+        http_reader_fail(
+            reader,
+            HTTP_READER_ERROR_HEADER_LINE_TOO_LONG,
+            HTTP_STATUS_CODE_431_REQUEST_HEADER_FIELDS_TOO_LARGE
+            );
       break;
     case BUFFERED_READER_ERROR_ENCOUNTERED_CC:
-      reader->error = strings_clone("encounted unexpected control character");
-      reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+      http_reader_fail(
+          reader,
+          HTTP_READER_ERROR_UNEXPECTED_CONTROL_CHARACTER,
+          HTTP_STATUS_CODE_400_BAD_REQUEST
+          );
+      break;
+    case BUFFERED_READER_ERROR_END_OF_STREAM:
+      http_reader_fail(reader, HTTP_READER_ERROR_END_OF_STREAM, 0);
       break;
     case BUFFERED_READER_ERROR_READ_FAILED:
       http_reader_check_fd_error(reader);
       if (!reader->error)
-        reader->error = strings_clone("unknown read error");
+        http_reader_fail(reader, HTTP_READER_ERROR_UNKNOWN_READ_ERROR, 0);
       break;
   }
 
@@ -165,7 +250,7 @@ static HTTPMessage * http_reader_parse_status_line(
   split = strings_split_up_to(line, ' ', 3);
   if (list_size(split) != 3)
   {
-    reader->error = strings_clone("malformed status line");
+    http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_STATUS_LINE, 0);
     list_destroy_and_free(split);
     return NULL;
   }
@@ -179,20 +264,26 @@ static HTTPMessage * http_reader_parse_status_line(
 
   if (version == HTTP_VERSION_NONE)
   {
-    reader->error = strings_format("malformed HTTP version: %s", version_str);
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_MALFORMED_VERSION,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
+        );
     list_destroy_and_free(split);
     return NULL;
   }
   if (status_code == 0)
   {
-    reader->error = strings_format("malformed status code: %s",status_code_str);
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_MALFORMED_STATUS_CODE,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
+        );
     list_destroy_and_free(split);
     return NULL;
   }
 
-  ret = http_response_new();
+  ret = http_response_new_with_allocator(reader->allocator);
   http_response_set_version(ret, version);
   http_response_set_status_code(ret, status_code);
   http_response_set_status_message(ret, status_message);
@@ -218,7 +309,7 @@ static HTTPMessage * http_reader_parse_request_line(
   split = strings_split_up_to(line, ' ', 3);
   if (list_size(split) != 3)
   {
-    reader->error = strings_clone("malformed request line");
+    http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_REQUEST_LINE, 0);
     list_destroy_and_free(split);
     return NULL;
   }
@@ -232,18 +323,18 @@ static HTTPMessage * http_reader_parse_request_line(
 
   if (method == HTTP_METHOD_NONE)
   {
-    reader->error = strings_format("malformed HTTP method: %s", method_str);
+    http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_METHOD, 0);
     list_destroy_and_free(split);
     return NULL;
   }
   if (version == HTTP_VERSION_NONE)
   {
-    reader->error = strings_format("malformed HTTP version: %s", version_str);
+    http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_VERSION, 0);
     list_destroy_and_free(split);
     return NULL;
   }
 
-  ret = http_request_new();
+  ret = http_request_new_with_allocator(reader->allocator);
   http_request_set_method(ret, method);
   http_request_set_target(ret, target);
   http_request_set_version(ret, version);
@@ -275,7 +366,7 @@ static void http_reader_parse_start_line(
   
   reader->parsing_first_line = false;
 
-  free(line);
+  http_allocator_free(&reader->allocator, line);
 
   reader->message = msg;
 }
@@ -288,8 +379,8 @@ static void http_reader_add_header(
   HTTPMessageType type;
   List * cookies;
 
-  free(reader->last_parsed_header);
-  reader->last_parsed_header = strings_clone(name);
+  http_allocator_free(&reader->allocator, reader->last_parsed_header);
+  reader->last_parsed_header = http_allocator_clone(&reader->allocator, name);
 
   is_cookie = strings_equals(name, "Cookie");
   is_set_cookie = strings_equals(name, "Set-Cookie");
@@ -299,7 +390,7 @@ static void http_reader_add_header(
   {
     cookies = http_utils_parse_cookie(value, false);
     if (!cookies)
-      reader->error = strings_format("malformed cookie header");
+      http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_COOKIE, 0);
     else
     {
       http_message_add_cookies(reader->message, cookies);
@@ -310,7 +401,7 @@ static void http_reader_add_header(
   {
     cookies = http_utils_parse_set_cookie(value);
     if (!cookies)
-      reader->error = strings_format("malformed Set-Cookie header");
+      http_reader_fail(reader, HTTP_READER_ERROR_MALFORMED_SET_COOKIE, 0);
     else
     {
       http_message_add_cookies(reader->message, cookies);
@@ -320,14 +411,18 @@ static void http_reader_add_header(
   else
     http_message_add_header(reader->message, name, value);
 
+  HTTP_PROBE3(header__parsed, reader, name, value);
 }
 
 static void http_reader_append_folded_header(HTTPReader * reader, char * line)
 {
   if (!reader->last_parsed_header)
   {
-    reader->error = strings_clone("folded header-data missing name");
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_FOLDED_HEADER_MISSING_NAME,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
+        );
     return;
   }
   
@@ -336,10 +431,11 @@ static void http_reader_append_folded_header(HTTPReader * reader, char * line)
     strings_equals(reader->last_parsed_header, "Cookie")
     )
   {
-    reader->error = strings_clone(
-        "folded header-data not supported for cookies"
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_FOLDED_COOKIE,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
         );
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
     return;
   }
 
@@ -362,15 +458,21 @@ static void http_reader_parse_header(HTTPReader * reader, char * line)
 
   if (!http_utils_split_about_no_trim(line, &name, &value, ':'))
   {
-    reader->error = strings_clone("malformed header");
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_MALFORMED_HEADER,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
+        );
     return;
   }
 
   if (strings_contains(name, ' '))
   {
-    reader->error = strings_clone("header contains unacceptable white-space");
-    reader->status_code = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_HEADER_WHITE_SPACE,
+        HTTP_STATUS_CODE_400_BAD_REQUEST
+        );
   }
   else
   {
@@ -390,7 +492,7 @@ static void http_reader_parse_headers(HTTPReader * reader)
 
   do
   {
-    free(line);
+    http_allocator_free(&reader->allocator, line);
     line = http_reader_read_line(
         reader,
         reader->settings.header_max_line_length
@@ -401,7 +503,7 @@ static void http_reader_parse_headers(HTTPReader * reader)
     http_reader_parse_header(reader, line);
   }
   while (!strings_is_null_or_empty(line) && !reader->error);
-  free(line);
+  http_allocator_free(&reader->allocator, line);
 }
 
 static bool http_reader_can_presume_empty_by_method(HTTPReader * reader)
@@ -442,6 +544,53 @@ static bool http_reader_can_presume_empty_by_method(HTTPReader * reader)
 
 }
 
+/* content out of a memory source: one copy straight from the source, or
+ * none when borrowing. as there, a request without a stated length has
+ * none, and anything else runs to the end of the source
+ */
+static void http_reader_take_content(
+    HTTPReader * reader,
+    ssize_t stated_content_length
+    )
+{
+  HTTPContent content;
+  const char * view;
+  size_t length;
+
+  if (
+    stated_content_length == -1 &&
+    http_message_get_type(reader->message) == HTTP_MESSAGE_TYPE_REQUEST
+    )
+    stated_content_length = 0;
+
+  length = buffered_reader_view(
+      reader->br,
+      stated_content_length == -1 ? SIZE_MAX : (size_t) stated_content_length,
+      &view
+      );
+  reader->offset += length;
+
+  if (stated_content_length != -1 && length != (size_t) stated_content_length)
+  {
+    http_reader_fail(reader, HTTP_READER_ERROR_PREMATURE_END_OF_MESSAGE, 0);
+    return;
+  }
+
+  content.length = length;
+  if (length == 0)
+    content.data = NULL;
+  else if (reader->borrow_content)
+    content.data = (char *) view;
+  else
+  {
+    content.data = (char *) http_allocator_malloc(&reader->allocator, length);
+    assert(content.data);
+    memcpy(content.data, view, length);
+  }
+
+  http_message_set_content(reader->message, content);
+}
+
 static void http_reader_read_content(HTTPReader * reader, bool static_source)
 {
   ssize_t stated_content_length, buffer_read;
@@ -455,7 +604,21 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
   if (reader->expect_head_only)
     stated_content_length = 0;
   else
+  {
     stated_content_length = http_message_get_content_length(reader->message);
+    if (
+      stated_content_length == -1 &&
+      http_message_has_header(reader->message, "Content-Length")
+      )
+    {
+      http_reader_fail(
+          reader,
+          HTTP_READER_ERROR_MALFORMED_CONTENT_LENGTH,
+          HTTP_STATUS_CODE_400_BAD_REQUEST
+          );
+      return;
+    }
+  }
   if (stated_content_length == -1 && !static_source)
   {
     if (http_reader_can_presume_empty_by_method(reader))
@@ -465,8 +628,11 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
       reader->settings.always_require_content_length
       )
     {
-      reader->error = strings_clone("'Content-Length' header is required");
-      reader->status_code = HTTP_STATUS_CODE_411_LENGTH_REQUIRED;
+      http_reader_fail(
+          reader,
+          HTTP_READER_ERROR_CONTENT_LENGTH_REQUIRED,
+          HTTP_STATUS_CODE_411_LENGTH_REQUIRED
+          );
       return;
     }
   }
@@ -475,6 +641,11 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
     http_message_set_content(reader->message, content);
     return;
   }
+  else if (buffered_reader_is_memory(reader->br))
+  {
+    http_reader_take_content(reader, stated_content_length);
+    return;
+  }
 
   do
   {
@@ -493,7 +664,11 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
           stated_content_length != content.length)
       {
         /* PREMATURE EOD */
-        reader->error = strings_clone("premature end of message");
+        http_reader_fail(
+            reader,
+            HTTP_READER_ERROR_PREMATURE_END_OF_MESSAGE,
+            0
+            );
       }
     }
     else if (buffer_read < 0)
@@ -501,20 +676,29 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
       if (errno == EAGAIN || errno == EWOULDBLOCK)
       {
         buffer_read = 1; /* ensure read continues */
+        if (
+          buffered_reader_wait(
+            reader->br,
+            http_wait_remaining(reader->content_deadline)
+            ) < 0
+          )
+          http_reader_check_fd_error(reader);
         continue;
       }
       http_reader_check_fd_error(reader);
     }
     else
     {
-      if (content.length == 0)
-        content.data = malloc(buffer_read);
-      else
-        content.data = realloc(content.data, buffer_read + content.length);
+      content.data = http_allocator_realloc(
+          &reader->allocator,
+          content.length ? content.data : NULL,
+          buffer_read + content.length
+          );
       assert(content.data);
 
       memcpy(&content.data[content.length], buffer, buffer_read);
       content.length += buffer_read;
+      reader->offset += buffer_read;
 
       if (content.length == stated_content_length)
         buffer_read = 0; /* KILLS LOOP */
@@ -524,16 +708,12 @@ static void http_reader_read_content(HTTPReader * reader, bool static_source)
          !reader->error &&
          !http_reader_content_read_expired(reader));
 
-  if (http_reader_content_read_expired(reader))
-  {
-    free(reader->error);
-    reader->error = strings_clone("content read timed out");
-  }
+  http_reader_content_read_expired(reader);
 
   if (reader->error)
   {
     if (content.length > 0)
-      free(content.data);
+      http_allocator_free(&reader->allocator, content.data);
   }
   else
     http_message_set_content(reader->message, content);
@@ -550,12 +730,21 @@ static void http_reader_send(
   assert(response);
 
   writer = http_writer_new();
+  if (reader->transport)
+    http_writer_set_transport(writer, reader->transport);
+  if (reader->write)
+    http_writer_set_write_function(
+        writer,
+        reader->write,
+        reader->write_context
+        );
+  http_writer_set_wait_function(writer, reader->wait, reader->wait_context);
   http_writer_render(writer, (HTTPMessage *) response, reader->output_fd);
 
   if (http_writer_has_error(writer))
   {
-    free(reader->error);
-    reader->error = http_writer_get_error(writer);
+    reader->error_number = http_writer_get_errno(writer);
+    http_reader_fail(reader, HTTP_READER_ERROR_WRITE_FAILED, 0);
   }
 
   http_writer_destroy(writer);
@@ -568,7 +757,7 @@ static void http_reader_send_continue(HTTPReader * reader)
 
   assert(reader);
 
-  response = http_response_new();
+  response = http_response_new_with_allocator(reader->allocator);
   http_response_set_status_code(response, HTTP_STATUS_CODE_100_CONTINUE);
   http_response_set_version(
     response, 
@@ -576,6 +765,9 @@ static void http_reader_send_continue(HTTPReader * reader)
     );
 
   http_reader_send(reader, response);
+
+  if (reader->timed && !reader->error)
+    reader->timings.continue_done = http_wait_now_ns();
 }
 
 
@@ -590,7 +782,7 @@ static void http_reader_respond_to_expect_continue(HTTPReader * reader)
   expect = http_message_get_header(reader->message, "Expect");
   if (!expect)
     return;
-  else if (!strings_equals(expect, "100-Continue"))
+  else if (!strings_equals_ignore_case(expect, "100-Continue"))
   {
     free(expect);
     return;
@@ -600,8 +792,11 @@ static void http_reader_respond_to_expect_continue(HTTPReader * reader)
 
   if (!reader->settings.allow_expect_continue)
   {
-    reader->error = strings_clone("`Expect: 100-Continue' header not allowed");
-    reader->status_code = HTTP_STATUS_CODE_417_EXPECTATION_FAILED;
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_EXPECT_CONTINUE_NOT_ALLOWED,
+        HTTP_STATUS_CODE_417_EXPECTATION_FAILED
+        );
     return;
   }
   if (!reader->settings.send_continue_callback)
@@ -617,56 +812,149 @@ static void http_reader_respond_to_expect_continue(HTTPReader * reader)
     http_reader_send_continue(reader);
   else
   {
-    reader->error = strings_clone("`Expect: 100-Continue' rejected");
+    http_reader_fail(
+        reader,
+        HTTP_READER_ERROR_EXPECT_CONTINUE_REJECTED,
+        0
+        );
     http_reader_send(reader, response);
   }
 }
 
 
-HTTPReader * http_reader_new(int fd)
+HTTPReaderSettings http_reader_get_default_settings(void)
 {
-  HTTPReader * ret = (HTTPReader *) malloc(sizeof(HTTPReader));
+  HTTPReaderSettings settings;
+
+  settings.start_line_max_length = 0x3FF;
+  settings.header_max_line_length = 0x7FF;
+  settings.max_header_count = 0x7FF;
+  settings.max_cookie_count = 0x7FF;
+
+  settings.max_get_length = 0xFFFF;
+  settings.max_post_length = 0xFFFF;
+  settings.max_put_length = 0xFFFF;
+  settings.max_connect_length = 0xFFFF;
+  settings.max_options_length = 0xFFFF;
+  settings.max_patch_length = 0xFFFF;
+
+  settings.header_receive_timeout = 15;
+  settings.content_receive_timeout = 30;
+  settings.keep_alive_timeout = 60;
+
+  settings.always_require_content_length = true;
+  settings.presume_get_empty = true;
+  settings.presume_post_empty = false;
+  settings.presume_put_empty = false;
+  settings.presume_connect_empty = true;
+  settings.presume_options_empty = true;
+  settings.presume_patch_empty = false;
+
+  settings.allow_expect_continue = false;
+  settings.send_continue_callback = NULL;
+
+  return settings;
+}
+
+static HTTPReader * http_reader_new_with(BufferedReader * br, int fd)
+{
+  HTTPReader * ret = (HTTPReader *) chttp_malloc(sizeof(HTTPReader));
   assert(ret);
 
-  ret->br = buffered_reader_new(fd);
+  ret->br = br;
+  ret->allocator = chttp_get_allocator();
+  ret->timed = false;
+  memset(&ret->timings, 0, sizeof(HTTPReaderTimings));
 
-  ret->error = NULL;
+  ret->error = HTTP_READER_ERROR_NONE;
   ret->error_number = 0;
+  ret->offset = 0;
+  ret->error_offset = 0;
   ret->output_fd = fd;
   ret->status_code = 0;
   ret->expect_head_only = false;
+  ret->borrow_content = false;
+  ret->mapping = NULL;
+  ret->mapping_length = 0;
 
   ret->message = NULL;
   ret->parsing_first_line = true;
   ret->last_parsed_header = NULL;
+  ret->header_deadline = 0;
+  ret->content_deadline = 0;
+  ret->wait = http_wait_poll;
+  ret->wait_context = NULL;
+  ret->write = NULL;
+  ret->write_context = NULL;
+  ret->transport = NULL;
+
+  ret->timer_wheel = NULL;
+  ret->timeout_callback = NULL;
+  ret->timeout_context = NULL;
+  http_timer_init(&ret->header_timer, http_reader_timer_fired, ret);
+  http_timer_init(&ret->content_timer, http_reader_timer_fired, ret);
+  http_timer_init(&ret->idle_timer, http_reader_timer_fired, ret);
   
-  ret->settings.start_line_max_length = 0x3FF;
-  ret->settings.header_max_line_length = 0x7FF;
-  ret->settings.max_header_count = 0x7FF;
-  ret->settings.max_cookie_count = 0x7FF;
-
-  ret->settings.max_get_length = 0xFFFF;
-  ret->settings.max_post_length = 0xFFFF;
-  ret->settings.max_put_length = 0xFFFF;
-  ret->settings.max_connect_length = 0xFFFF;
-  ret->settings.max_options_length = 0xFFFF;
-  ret->settings.max_patch_length = 0xFFFF;
-
-  ret->settings.header_receive_timeout = 15;
-  ret->settings.content_receive_timeout = 30;
-
-  ret->settings.always_require_content_length = true;
-  ret->settings.presume_get_empty = true;
-  ret->settings.presume_post_empty = false;
-  ret->settings.presume_put_empty = false;
-  ret->settings.presume_connect_empty = true;
-  ret->settings.presume_options_empty = true;
-  ret->settings.presume_patch_empty = false;
-  ret->settings.presume_options_empty = true;
-  ret->settings.presume_patch_empty = false;
-
-  ret->settings.allow_expect_continue = false;
-  ret->settings.send_continue_callback = NULL;
+  ret->settings = http_reader_get_default_settings();
+
+  return ret;
+}
+
+HTTPReader * http_reader_new(int fd)
+{
+  return http_reader_new_with(buffered_reader_new(fd), fd);
+}
+
+/* parses the messages in `data', in place and without system calls, as
+ * http_reader_next_from_static would. `data' must outlive the reader
+ */
+HTTPReader * http_reader_new_from_buffer(const char * data, size_t length)
+{
+  return http_reader_new_with(
+      buffered_reader_new_from_buffer(data, length),
+      -1
+      );
+}
+
+/* as http_reader_new_from_buffer, on the file at `path' mapped into
+ * memory for the reader's lifetime. NULL (with errno set) if the file
+ * cannot be mapped
+ */
+HTTPReader * http_reader_new_from_mmap(const char * path)
+{
+  HTTPReader * ret;
+  struct stat status;
+  void * mapping = NULL;
+  int fd;
+
+  assert(path);
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  if (status.st_size > 0)
+  {
+    mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      close(fd);
+      return NULL;
+    }
+    madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+
+  ret = http_reader_new_from_buffer((char *) mapping, status.st_size);
+  ret->mapping = mapping;
+  ret->mapping_length = status.st_size;
 
   return ret;
 }
@@ -675,12 +963,14 @@ void http_reader_destroy(HTTPReader * reader)
 {
   assert(reader);
 
-  free(reader->error);
-  free(reader->last_parsed_header);
+  http_allocator_free(&reader->allocator, reader->last_parsed_header);
 
+  http_reader_cancel_timers(reader);
   buffered_reader_destroy(reader->br);
+  if (reader->mapping)
+    munmap(reader->mapping, reader->mapping_length);
 
-  free(reader);
+  chttp_free(reader);
 }
 
 void http_reader_set_settings(HTTPReader * reader, HTTPReaderSettings settings)
@@ -689,6 +979,125 @@ void http_reader_set_settings(HTTPReader * reader, HTTPReaderSettings settings)
 
   reader->settings = settings;
 }
+void http_reader_set_read_function(
+    HTTPReader * reader,
+    HTTPReadFunction read,
+    void * context
+    )
+{
+  assert(reader);
+
+  buffered_reader_set_read_function(reader->br, read, context);
+}
+void http_reader_set_wait_function(
+    HTTPReader * reader,
+    HTTPWaitFunction wait,
+    void * context
+    )
+{
+  assert(reader);
+
+  reader->wait = wait ? wait : http_wait_poll;
+  reader->wait_context = wait ? context : NULL;
+  buffered_reader_set_wait_function(reader->br, wait, context);
+}
+/* writes what the reader answers by itself (100 Continue, or the response
+ * rejecting it) through `write' rather than to the descriptor or transport.
+ * NULL to go back
+ */
+void http_reader_set_write_function(
+    HTTPReader * reader,
+    HTTPWriteFunction write,
+    void * context
+    )
+{
+  assert(reader);
+
+  reader->write = write;
+  reader->write_context = write ? context : NULL;
+}
+
+/* reads and waits through `transport' (NULL to go back to the descriptor
+ * the reader was made with), answering through it too
+ */
+void http_reader_set_transport(HTTPReader * reader, HTTPTransport * transport)
+{
+  assert(reader);
+
+  reader->transport = transport;
+  http_reader_set_read_function(
+      reader,
+      transport ? http_transport_io_read : NULL,
+      transport
+      );
+  http_reader_set_wait_function(
+      reader,
+      transport ? http_transport_io_wait : NULL,
+      transport
+      );
+}
+
+/* records every read into `capture' (NULL to stop) as a connection of its
+ * own, whose number is returned. memory sources are never recorded
+ */
+uint64_t http_reader_set_capture(HTTPReader * reader, HTTPCapture * capture)
+{
+  uint64_t ret = 0;
+
+  assert(reader);
+
+  if (capture)
+    ret = http_capture_new_connection(capture);
+  buffered_reader_set_capture(reader->br, capture, ret);
+
+  return ret;
+}
+
+/* has the reader arm its header, content and keep-alive idle deadlines
+ * on `wheel', calling `callback' when one expires. the wheel must outlive
+ * the reader or be replaced first
+ */
+void http_reader_set_timer_wheel(
+    HTTPReader * reader,
+    HTTPTimerWheel * wheel,
+    HTTPReaderTimeoutCallback callback,
+    void * context
+    )
+{
+  assert(reader);
+
+  http_reader_cancel_timers(reader);
+
+  reader->timer_wheel = wheel;
+  reader->timeout_callback = callback;
+  reader->timeout_context = context;
+}
+
+/* the allocator of the messages read from then on, what they own and
+ * their content, in place of the one the reader was made with. set it
+ * between messages
+ */
+void http_reader_set_allocator(HTTPReader * reader, HTTPAllocator allocator)
+{
+  assert(reader);
+
+  http_allocator_free(&reader->allocator, reader->last_parsed_header);
+  reader->last_parsed_header = NULL;
+
+  reader->allocator = allocator;
+  buffered_reader_set_allocator(reader->br, allocator);
+}
+
+/* for memory sources: content points into the source instead of being
+ * copied. it then lives as long as the source and must not be freed
+ */
+void http_reader_set_borrow_content(HTTPReader * reader, bool value)
+{
+  assert(reader);
+
+  reader->borrow_content = value;
+}
+
 void http_reader_set_expect_head_only(HTTPReader * reader, bool value)
 {
   assert(reader);
@@ -696,16 +1105,61 @@ void http_reader_set_expect_head_only(HTTPReader * reader, bool value)
   reader->expect_head_only = value;
 }
 
+/* has the reader time the phases of each message it reads, for
+ * http_reader_get_timings. off, it does not read the clock at all
+ */
+void http_reader_set_timed(HTTPReader * reader, bool value)
+{
+  assert(reader);
+
+  reader->timed = value;
+  buffered_reader_set_first_byte_time(
+      reader->br,
+      value ? &reader->timings.first_byte : NULL
+      );
+}
+
 bool http_reader_has_error(HTTPReader * reader)
 {
   assert(reader);
-  return reader->error != NULL;
+  return reader->error != HTTP_READER_ERROR_NONE;
 }
 
 char * http_reader_get_error(HTTPReader * reader)
+{
+  char buffer [0xFF];
+
+  assert(reader);
+
+  if (!reader->error)
+    return NULL;
+
+  http_reader_print_error(reader, buffer, sizeof(buffer));
+  return strings_clone(buffer);
+}
+HTTPReaderError http_reader_get_error_code(HTTPReader * reader)
 {
   assert(reader);
-  return reader->error ? strings_clone(reader->error) : NULL;
+  return reader->error;
+}
+size_t http_reader_get_error_offset(HTTPReader * reader)
+{
+  assert(reader);
+  return reader->error_offset;
+}
+size_t http_reader_print_error(
+    HTTPReader * reader,
+    char * buffer,
+    size_t buffer_length
+    )
+{
+  assert(reader);
+  return http_reader_error_print(
+      reader->error,
+      reader->error_number,
+      buffer,
+      buffer_length
+      );
 }
 
 int http_reader_get_errno(HTTPReader * reader)
@@ -723,29 +1177,46 @@ bool http_reader_buffer_is_empty(HTTPReader * reader)
   assert(reader);
   return buffered_reader_buffer_is_empty(reader->br);
 }
+HTTPReaderTimings http_reader_get_timings(HTTPReader * reader)
+{
+  assert(reader);
+  return reader->timings;
+}
 
 void http_reader_clear_error(HTTPReader * reader)
 {
   assert(reader);
 
-  free(reader->error);
-  reader->error = NULL;
+  reader->error = HTTP_READER_ERROR_NONE;
   reader->error_number = 0;
+  reader->error_offset = 0;
   reader->status_code = 0;
 }
 
 
-static HTTPMessage * http_reader_next_imp(
+static HTTPMessage * http_reader_parse_message(
     HTTPReader * reader, 
     bool static_source
     )
 {
+  uint64_t metrics_start = 0;
   HTTPMessage * ret;
-  assert(reader);
 
   http_reader_reset(reader);
+  HTTP_PROBE1(message__start, reader);
+  if (http_metrics_is_enabled())
+    metrics_start = http_wait_now_ns();
+  if (reader->timed)
+  {
+    memset(&reader->timings, 0, sizeof(HTTPReaderTimings));
+    reader->timings.start = http_wait_now_ns();
+  }
+
+  reader->header_deadline =
+    http_wait_now() + reader->settings.header_receive_timeout * 1000ULL;
+  http_reader_cancel_timers(reader);
+  http_reader_arm_timer(reader, &reader->header_timer, reader->header_deadline);
 
-  reader->header_start_time = time(NULL);
   http_reader_parse_start_line(reader);
   if (reader->error)
     return NULL;
@@ -757,6 +1228,8 @@ static HTTPMessage * http_reader_next_imp(
     reader->message = NULL;
     return NULL;
   }
+  if (reader->timed)
+    reader->timings.headers_done = http_wait_now_ns();
 
   if (!static_source)
   {
@@ -769,7 +1242,15 @@ static HTTPMessage * http_reader_next_imp(
     }
   }
 
-  reader->content_start_time = time(NULL);
+  reader->content_deadline =
+    http_wait_now() + reader->settings.content_receive_timeout * 1000ULL;
+  http_reader_cancel_timers(reader);
+  http_reader_arm_timer(
+      reader,
+      &reader->content_timer,
+      reader->content_deadline
+      );
+
   http_reader_read_content(reader, static_source);
 
   if (reader->error)
@@ -778,12 +1259,57 @@ static HTTPMessage * http_reader_next_imp(
     reader->message = NULL;
     return NULL;
   }
+  if (reader->timed)
+    reader->timings.content_done = http_wait_now_ns();
+  HTTP_PROBE3(
+      body__complete,
+      reader,
+      reader->message,
+      http_message_get_content(reader->message).length
+      );
+  if (metrics_start)
+  {
+    http_metrics_add(HTTP_METRIC_MESSAGES_PARSED, 1);
+    http_metrics_observe(
+        HTTP_METRIC_HISTOGRAM_READ,
+        http_wait_now_ns() - metrics_start
+        );
+  }
 
   ret = reader->message;
   reader->message = NULL;
   return ret;
 }
 
+static HTTPMessage * http_reader_next_imp(
+    HTTPReader * reader, 
+    bool static_source
+    )
+{
+  HTTPMessage * ret;
+  assert(reader);
+
+  /* nothing answers a memory source */
+  if (buffered_reader_is_memory(reader->br))
+    static_source = true;
+
+  ret = http_reader_parse_message(reader, static_source);
+  http_reader_cancel_timers(reader);
+
+  if (
+    ret &&
+    reader->settings.keep_alive_timeout &&
+    http_message_is_keep_alive(ret)
+    )
+    http_reader_arm_timer(
+        reader,
+        &reader->idle_timer,
+        http_wait_now() + reader->settings.keep_alive_timeout * 1000ULL
+        );
+
+  return ret;
+}
+
 HTTPMessage * http_reader_next(HTTPReader * reader)
 {
   return http_reader_next_imp(reader, false);
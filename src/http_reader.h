@@ -3,27 +3,103 @@
 #define __CHTTP_HTTP_READER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "http_allocator.h"
+#include "http_capture.h"
+#include "http_io.h"
+#include "http_reader_error.h"
 #include "http_reader_settings.h"
+#include "http_timer_wheel.h"
+#include "http_transport.h"
+#include "http_wait.h"
 
 #include "http_message.h"
 
 struct HTTPReader;
 typedef struct HTTPReader HTTPReader;
 
+enum HTTPReaderTimer
+{
+  HTTP_READER_TIMER_HEADER = 1,
+  HTTP_READER_TIMER_CONTENT = 2,
+  HTTP_READER_TIMER_IDLE = 3,
+};
+typedef enum HTTPReaderTimer HTTPReaderTimer;
 
+typedef void (*HTTPReaderTimeoutCallback)(
+    HTTPReader * reader,
+    HTTPReaderTimer timer,
+    void * context
+    );
+
+/* when each phase of reading the last message ended, in nanoseconds as
+ * per http_wait_now_ns. a phase not reached (by error, or as there was no
+ * 100-Continue to answer) is left 0
+ */
+struct HTTPReaderTimings
+{
+  uint64_t
+    start, /* the reader began on the message */
+    first_byte, /* of its start line, in hand */
+    headers_done,
+    continue_done, /* 100-Continue answered */
+    content_done;
+};
+typedef struct HTTPReaderTimings HTTPReaderTimings;
+
+
+
+HTTPReaderSettings http_reader_get_default_settings(void);
 
 HTTPReader * http_reader_new(int fd);
+HTTPReader * http_reader_new_from_buffer(const char * data, size_t length);
+HTTPReader * http_reader_new_from_mmap(const char * path);
 void http_reader_destroy(HTTPReader * reader);
 
 void http_reader_set_settings(HTTPReader * reader, HTTPReaderSettings settings);
+void http_reader_set_read_function(
+    HTTPReader * reader,
+    HTTPReadFunction read,
+    void * context
+    );
+void http_reader_set_wait_function(
+    HTTPReader * reader,
+    HTTPWaitFunction wait,
+    void * context
+    );
+void http_reader_set_write_function(
+    HTTPReader * reader,
+    HTTPWriteFunction write,
+    void * context
+    );
+void http_reader_set_transport(HTTPReader * reader, HTTPTransport * transport);
+uint64_t http_reader_set_capture(HTTPReader * reader, HTTPCapture * capture);
+void http_reader_set_allocator(HTTPReader * reader, HTTPAllocator allocator);
+void http_reader_set_timer_wheel(
+    HTTPReader * reader,
+    HTTPTimerWheel * wheel,
+    HTTPReaderTimeoutCallback callback,
+    void * context
+    );
+void http_reader_set_borrow_content(HTTPReader * reader, bool value);
 void http_reader_set_expect_head_only(HTTPReader * reader, bool value);
+void http_reader_set_timed(HTTPReader * reader, bool value);
 
 bool http_reader_has_error(HTTPReader * reader);
 char * http_reader_get_error(HTTPReader * reader);
+HTTPReaderError http_reader_get_error_code(HTTPReader * reader);
+size_t http_reader_get_error_offset(HTTPReader * reader);
+size_t http_reader_print_error(
+    HTTPReader * reader,
+    char * buffer,
+    size_t buffer_length
+    );
 int http_reader_get_errno(HTTPReader * reader);
 HTTPStatusCode http_reader_get_status_code(HTTPReader * reader);
 bool http_reader_buffer_is_empty(HTTPReader * reader);
+HTTPReaderTimings http_reader_get_timings(HTTPReader * reader);
 
 void http_reader_clear_error(HTTPReader * reader);
 
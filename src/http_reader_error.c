@@ -0,0 +1,118 @@
+
+
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <stdio.h>
+
+#include "http_reader_error.h"
+
+
+char * http_reader_error_get_message(HTTPReaderError error)
+{
+  switch (error)
+  {
+    case HTTP_READER_ERROR_NONE:
+      return "no error";
+
+    case HTTP_READER_ERROR_READ_TIMED_OUT:
+      return "read timed out";
+    case HTTP_READER_ERROR_CONTENT_READ_TIMED_OUT:
+      return "content read timed out";
+    case HTTP_READER_ERROR_READ_FAILED:
+      return "read error";
+    case HTTP_READER_ERROR_UNKNOWN_READ_ERROR:
+      return "unknown read error";
+    case HTTP_READER_ERROR_PREMATURE_END_OF_MESSAGE:
+      return "premature end of message";
+    case HTTP_READER_ERROR_END_OF_STREAM:
+      return "end of stream";
+
+    case HTTP_READER_ERROR_START_LINE_TOO_LONG:
+      return "start line too long";
+    case HTTP_READER_ERROR_HEADER_LINE_TOO_LONG:
+      return "header line too long";
+    case HTTP_READER_ERROR_UNEXPECTED_CONTROL_CHARACTER:
+      return "encounted unexpected control character";
+
+    case HTTP_READER_ERROR_MALFORMED_STATUS_LINE:
+      return "malformed status line";
+    case HTTP_READER_ERROR_MALFORMED_REQUEST_LINE:
+      return "malformed request line";
+    case HTTP_READER_ERROR_MALFORMED_VERSION:
+      return "malformed HTTP version";
+    case HTTP_READER_ERROR_MALFORMED_STATUS_CODE:
+      return "malformed status code";
+    case HTTP_READER_ERROR_MALFORMED_METHOD:
+      return "malformed HTTP method";
+
+    case HTTP_READER_ERROR_MALFORMED_HEADER:
+      return "malformed header";
+    case HTTP_READER_ERROR_HEADER_WHITE_SPACE:
+      return "header contains unacceptable white-space";
+    case HTTP_READER_ERROR_FOLDED_HEADER_MISSING_NAME:
+      return "folded header-data missing name";
+    case HTTP_READER_ERROR_FOLDED_COOKIE:
+      return "folded header-data not supported for cookies";
+    case HTTP_READER_ERROR_MALFORMED_COOKIE:
+      return "malformed cookie header";
+    case HTTP_READER_ERROR_MALFORMED_SET_COOKIE:
+      return "malformed Set-Cookie header";
+
+    case HTTP_READER_ERROR_CONTENT_LENGTH_REQUIRED:
+      return "'Content-Length' header is required";
+    case HTTP_READER_ERROR_EXPECT_CONTINUE_NOT_ALLOWED:
+      return "`Expect: 100-Continue' header not allowed";
+    case HTTP_READER_ERROR_EXPECT_CONTINUE_REJECTED:
+      return "`Expect: 100-Continue' rejected";
+    case HTTP_READER_ERROR_WRITE_FAILED:
+      return "write error";
+    case HTTP_READER_ERROR_MALFORMED_CONTENT_LENGTH:
+      return "malformed or repeated `Content-Length' header";
+
+    default:
+      return "unspecified error";
+  }
+}
+
+/* formats the error into the caller's buffer, truncating if needed.
+ * returns the length of the (possibly truncated) string written
+ */
+size_t http_reader_error_print(
+    HTTPReaderError error,
+    int error_number,
+    char * buffer,
+    size_t buffer_length
+    )
+{
+  int length;
+
+  assert(buffer);
+  assert(buffer_length);
+
+  if (
+    error_number &&
+    (error == HTTP_READER_ERROR_READ_FAILED ||
+     error == HTTP_READER_ERROR_WRITE_FAILED)
+    )
+    length = snprintf(
+        buffer, buffer_length, "%s: %s",
+        http_reader_error_get_message(error),
+        errors_get_errno_name(error_number)
+        );
+  else
+    length = snprintf(
+        buffer, buffer_length, "%s",
+        http_reader_error_get_message(error)
+        );
+
+  if (length < 0)
+  {
+    buffer[0] = '\0';
+    return 0;
+  }
+  else if ((size_t) length >= buffer_length)
+    return buffer_length - 1;
+  else
+    return (size_t) length;
+}
+
@@ -0,0 +1,55 @@
+
+
+#ifndef __CHTTP_HTTP_READER_ERROR_H
+#define __CHTTP_HTTP_READER_ERROR_H
+
+#include <sys/types.h>
+
+
+enum HTTPReaderError
+{
+  HTTP_READER_ERROR_NONE                            =  0,
+
+  HTTP_READER_ERROR_READ_TIMED_OUT                  =  1,
+  HTTP_READER_ERROR_CONTENT_READ_TIMED_OUT          =  2,
+  HTTP_READER_ERROR_READ_FAILED                     =  3,
+  HTTP_READER_ERROR_UNKNOWN_READ_ERROR              =  4,
+  HTTP_READER_ERROR_PREMATURE_END_OF_MESSAGE        =  5,
+  HTTP_READER_ERROR_END_OF_STREAM                   =  6,
+
+  HTTP_READER_ERROR_START_LINE_TOO_LONG             = 10,
+  HTTP_READER_ERROR_HEADER_LINE_TOO_LONG            = 11,
+  HTTP_READER_ERROR_UNEXPECTED_CONTROL_CHARACTER    = 12,
+
+  HTTP_READER_ERROR_MALFORMED_STATUS_LINE           = 20,
+  HTTP_READER_ERROR_MALFORMED_REQUEST_LINE          = 21,
+  HTTP_READER_ERROR_MALFORMED_VERSION               = 22,
+  HTTP_READER_ERROR_MALFORMED_STATUS_CODE           = 23,
+  HTTP_READER_ERROR_MALFORMED_METHOD                = 24,
+
+  HTTP_READER_ERROR_MALFORMED_HEADER                = 30,
+  HTTP_READER_ERROR_HEADER_WHITE_SPACE              = 31,
+  HTTP_READER_ERROR_FOLDED_HEADER_MISSING_NAME      = 32,
+  HTTP_READER_ERROR_FOLDED_COOKIE                   = 33,
+  HTTP_READER_ERROR_MALFORMED_COOKIE                = 34,
+  HTTP_READER_ERROR_MALFORMED_SET_COOKIE            = 35,
+
+  HTTP_READER_ERROR_CONTENT_LENGTH_REQUIRED         = 40,
+  HTTP_READER_ERROR_EXPECT_CONTINUE_NOT_ALLOWED     = 41,
+  HTTP_READER_ERROR_EXPECT_CONTINUE_REJECTED        = 42,
+  HTTP_READER_ERROR_WRITE_FAILED                    = 43,
+  HTTP_READER_ERROR_MALFORMED_CONTENT_LENGTH        = 44,
+};
+typedef enum HTTPReaderError HTTPReaderError;
+
+
+char * http_reader_error_get_message(HTTPReaderError error);
+size_t http_reader_error_print(
+    HTTPReaderError error,
+    int error_number,
+    char * buffer,
+    size_t buffer_length
+    );
+
+#endif
+
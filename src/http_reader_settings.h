@@ -21,7 +21,8 @@ struct HTTPReaderSettings
     max_options_length,
     max_patch_length,
     header_receive_timeout, /* in seconds */
-    content_receive_timeout; /* also in seconds */
+    content_receive_timeout, /* also in seconds */
+    keep_alive_timeout; /* in seconds, 0 for none; needs a timer wheel */
   bool
     always_require_content_length,
     presume_get_empty,
@@ -0,0 +1,333 @@
+
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_capture.h"
+#include "http_fiber.h"
+#include "http_message.h"
+#include "http_status_code.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "http_reader.h"
+#include "http_writer.h"
+
+#include "http_replay.h"
+
+
+struct HTTPReplay;
+typedef struct HTTPReplay HTTPReplay;
+struct HTTPReplayConnection;
+typedef struct HTTPReplayConnection HTTPReplayConnection;
+
+struct HTTPReplay
+{
+  HTTPReplaySettings settings;
+  HTTPServerHandler handler;
+  void * context;
+
+  HTTPFiberScheduler * scheduler;
+  HTTPReplayConnection * connections;
+  uint64_t connection_count;
+  uint64_t first_time, start; /* recorded and replayed, in microseconds */
+
+  HTTPReplayStatistics statistics;
+};
+
+/* the records of one connection, in the order they were received */
+struct HTTPReplayConnection
+{
+  HTTPReplay * replay;
+  HTTPCaptureRecord * records;
+  size_t count, next, offset; /* into records[next] */
+};
+
+
+static uint64_t http_replay_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/* by connection, then by position in the file */
+static int http_replay_compare(const void * a, const void * b)
+{
+  const HTTPCaptureRecord * x = (const HTTPCaptureRecord *) a;
+  const HTTPCaptureRecord * y = (const HTTPCaptureRecord *) b;
+
+  if (x->connection != y->connection)
+    return x->connection < y->connection ? -1 : 1;
+  if (x->data != y->data)
+    return x->data < y->data ? -1 : 1;
+  return 0;
+}
+
+/* by when each connection first received something */
+static int http_replay_compare_connections(const void * a, const void * b)
+{
+  const HTTPReplayConnection * x = (const HTTPReplayConnection *) a;
+  const HTTPReplayConnection * y = (const HTTPReplayConnection *) b;
+
+  if (x->records[0].time != y->records[0].time)
+    return x->records[0].time < y->records[0].time ? -1 : 1;
+  return 0;
+}
+
+/* in a fiber; sleeps until what was recorded at `time' is due */
+static void http_replay_wait_until(HTTPReplay * replay, uint64_t time)
+{
+  uint64_t due, now;
+
+  if (replay->settings.speed <= 0)
+    return;
+
+  due = replay->start +
+    (uint64_t) ((time - replay->first_time) / replay->settings.speed);
+  now = http_replay_now();
+
+  if (due > now + 1000)
+    http_fiber_sleep((due - now) / 1000);
+}
+
+static ssize_t http_replay_read(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    )
+{
+  HTTPReplayConnection * conn = (HTTPReplayConnection *) context;
+  HTTPCaptureRecord * record;
+
+  (void) fd;
+
+  if (conn->next == conn->count)
+    return 0;
+
+  record = &conn->records[conn->next];
+  if (conn->offset == 0)
+    http_replay_wait_until(conn->replay, record->time);
+
+  if (record->length == 0)
+    return 0; /* the peer had finished sending */
+
+  if (length > record->length - conn->offset)
+    length = record->length - conn->offset;
+
+  memcpy(data, &record->data[conn->offset], length);
+  conn->offset += length;
+  if (conn->offset == record->length)
+  {
+    conn->next++;
+    conn->offset = 0;
+  }
+
+  return length;
+}
+
+static ssize_t http_replay_discard(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  (void) fd;
+  (void) data;
+  (void) context;
+
+  return length;
+}
+
+/* the fiber of a connection; handles its requests as the server would */
+static void http_replay_connection_run(void * context)
+{
+  HTTPReplayConnection * conn = (HTTPReplayConnection *) context;
+  HTTPReplay * replay = conn->replay;
+  HTTPResponse * response;
+  HTTPMessage * message;
+  HTTPContent content;
+  HTTPReader * reader;
+  HTTPWriter * writer;
+
+  reader = http_reader_new(-1);
+  http_reader_set_settings(reader, replay->settings.reader_settings);
+  http_reader_set_read_function(reader, http_replay_read, conn);
+
+  writer = http_writer_new();
+  http_writer_set_write_function(writer, http_replay_discard, NULL);
+
+  while ((message = http_reader_next(reader)))
+  {
+    if (http_message_get_type(message) != HTTP_MESSAGE_TYPE_REQUEST)
+    {
+      http_message_free_content(message);
+      http_message_destroy(message);
+      continue;
+    }
+
+    response = replay->handler((HTTPRequest *) message, replay->context);
+    http_message_free_content(message);
+    http_message_destroy(message);
+    replay->statistics.request_count++;
+
+    if (!response)
+    {
+      response = http_response_new();
+      http_response_set_status_code(
+          response,
+          HTTP_STATUS_CODE_500_INTERNAL_SERVER_ERROR
+          );
+    }
+
+    content = http_response_get_content(response);
+    if (!http_response_has_header(response, "Content-Length"))
+      http_response_set_content_length(response, content.length);
+
+    http_writer_render(writer, (HTTPMessage *) response, -1);
+
+    http_response_free_content(response);
+    http_response_destroy(response);
+  }
+
+  if (http_reader_get_error_code(reader) != HTTP_READER_ERROR_END_OF_STREAM)
+    replay->statistics.failure_count++;
+
+  http_reader_destroy(reader);
+  http_writer_destroy(writer);
+}
+
+/* the first fiber; starts each connection's when it is due */
+static void http_replay_dispatch(void * context)
+{
+  HTTPReplay * replay = (HTTPReplay *) context;
+  HTTPReplayConnection * conn;
+
+  for (uint64_t k = 0; k < replay->connection_count; k++)
+  {
+    conn = &replay->connections[k];
+    http_replay_wait_until(replay, conn->records[0].time);
+
+    if (!http_fiber_spawn(
+          replay->scheduler,
+          http_replay_connection_run,
+          conn
+          ))
+    {
+      replay->statistics.failure_count++;
+      continue;
+    }
+
+    /* without pauses, a connection runs through before the next starts */
+    http_fiber_yield();
+  }
+}
+
+
+HTTPReplaySettings http_replay_get_default_settings(void)
+{
+  HTTPReplaySettings ret;
+
+  ret.speed = 1;
+  ret.stack_size = 0;
+  ret.reader_settings = http_reader_get_default_settings();
+
+  return ret;
+}
+
+bool http_replay_run(
+    const char * path,
+    HTTPReplaySettings settings,
+    HTTPServerHandler handler,
+    void * context,
+    HTTPReplayStatistics * statistics
+    )
+{
+  HTTPCaptureRecord * records = NULL, record;
+  HTTPReplayConnection * conn = NULL;
+  size_t count = 0, capacity = 0;
+  HTTPCaptureFile * file;
+  HTTPReplay replay;
+
+  assert(path);
+  assert(handler);
+
+  file = http_capture_file_open(path);
+  if (!file)
+    return false;
+
+  while (http_capture_file_next(file, &record))
+  {
+    if (count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 0x100;
+      records = (HTTPCaptureRecord *)
+        realloc(records, sizeof(HTTPCaptureRecord) * capacity);
+      assert(records);
+    }
+    records[count++] = record;
+  }
+
+  memset(&replay, 0, sizeof(HTTPReplay));
+  replay.settings = settings;
+  replay.handler = handler;
+  replay.context = context;
+
+  if (count)
+  {
+    replay.first_time = records[0].time;
+    qsort(records, count, sizeof(HTTPCaptureRecord), http_replay_compare);
+
+    replay.connections = (HTTPReplayConnection *)
+      malloc(sizeof(HTTPReplayConnection) * count);
+    assert(replay.connections);
+
+    for (size_t k = 0; k < count; k++)
+    {
+      if (k == 0 || records[k].connection != records[k - 1].connection)
+      {
+        conn = &replay.connections[replay.connection_count++];
+        conn->replay = &replay;
+        conn->records = &records[k];
+        conn->count = 0;
+        conn->next = 0;
+        conn->offset = 0;
+      }
+      conn->count++;
+    }
+
+    qsort(
+        replay.connections,
+        replay.connection_count,
+        sizeof(HTTPReplayConnection),
+        http_replay_compare_connections
+        );
+  }
+
+  replay.statistics.connection_count = replay.connection_count;
+  replay.scheduler = http_fiber_scheduler_new(settings.stack_size);
+  replay.start = http_replay_now();
+
+  http_fiber_spawn(replay.scheduler, http_replay_dispatch, &replay);
+  http_fiber_scheduler_run(replay.scheduler);
+
+  replay.statistics.elapsed = http_replay_now() - replay.start;
+
+  http_fiber_scheduler_destroy(replay.scheduler);
+  free(replay.connections);
+  free(records);
+  http_capture_file_close(file);
+
+  if (statistics)
+    *statistics = replay.statistics;
+
+  return true;
+}
@@ -0,0 +1,49 @@
+
+
+#ifndef __CHTTP_HTTP_REPLAY_H
+#define __CHTTP_HTTP_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_server.h"
+
+
+struct HTTPReplaySettings
+{
+  double speed; /* 1 keeps the recorded pace, 2 doubles it; 0 for no pauses */
+  size_t stack_size; /* of each connection's fiber; 0 for the default */
+  HTTPReaderSettings reader_settings;
+};
+typedef struct HTTPReplaySettings HTTPReplaySettings;
+
+struct HTTPReplayStatistics
+{
+  uint64_t
+    connection_count,
+    request_count,
+    failure_count, /* connections whose input failed to parse */
+    elapsed; /* in microseconds */
+};
+typedef struct HTTPReplayStatistics HTTPReplayStatistics;
+
+
+HTTPReplaySettings http_replay_get_default_settings(void);
+
+/* plays the capture at `path' back on the calling thread: every connection
+ * in it gets a reader of its own, fed in the same pieces (and, at speed,
+ * with the same pauses) as the original, and every request it reads goes
+ * to `handler', whose response is rendered and thrown away. false (with
+ * errno set) if the capture cannot be read. `statistics' may be NULL
+ */
+bool http_replay_run(
+    const char * path,
+    HTTPReplaySettings settings,
+    HTTPServerHandler handler,
+    void * context,
+    HTTPReplayStatistics * statistics
+    );
+
+
+#endif
@@ -3,6 +3,7 @@
 #include <baselib/baselib.h>
 #include <stdlib.h>
 
+#include "http_allocator.h"
 #include "http_utils.h"
 
 #include "http_message.h"
@@ -20,18 +21,23 @@ struct HTTPRequest
 
 
 HTTPRequest * http_request_new()
+{
+  return http_request_new_with_allocator(chttp_get_allocator());
+}
+
+HTTPRequest * http_request_new_with_allocator(HTTPAllocator allocator)
 {
   HTTPRequest * ret;
   
-  ret = (HTTPRequest *) malloc(sizeof(HTTPRequest));
+  ret = (HTTPRequest *) http_allocator_malloc(&allocator, sizeof(HTTPRequest));
   assert(ret);
 
-  http_message_init_struct(&ret->base, HTTP_MESSAGE_TYPE_REQUEST);
+  http_message_init_struct(&ret->base, HTTP_MESSAGE_TYPE_REQUEST, allocator);
   ret->base.destroy = (void (*)(HTTPMessage *)) http_request_destroy;
 
   ret->method = HTTP_METHOD_GET;
-  ret->path = strings_clone("/");
-  ret->query = strings_clone("");
+  ret->path = http_allocator_clone(&allocator, "/");
+  ret->query = http_allocator_clone(&allocator, "");
   ret->params = dictionary_new(DICTIONARY_TYPE_HASH_TABLE);
 
   return ret;
@@ -39,12 +45,17 @@ HTTPRequest * http_request_new()
 
 void http_request_destroy(HTTPRequest * request)
 {
+  HTTPAllocator allocator;
+
   assert(request);
 
+  allocator = request->base.allocator;
+
   http_message_deinit_struct(&request->base);
-  free(request->path);
-  free(request->query);
+  http_allocator_free(&allocator, request->path);
+  http_allocator_free(&allocator, request->query);
   dictionary_destroy_and_free(request->params);
+  http_allocator_free(&allocator, request);
 }
 
 
@@ -151,16 +162,16 @@ void http_request_set_path(HTTPRequest * request, char * path)
 {
   assert(request);
 
-  free(request->path);
-  request->path = strings_clone(path);
+  http_allocator_free(&request->base.allocator, request->path);
+  request->path = http_allocator_clone(&request->base.allocator, path);
 }
 
 void http_request_set_query(HTTPRequest * request, char * query)
 {
   assert(request);
 
-  free(request->query);
-  request->query = strings_clone(query);
+  http_allocator_free(&request->base.allocator, request->query);
+  request->query = http_allocator_clone(&request->base.allocator, query);
 
   dictionary_clear_and_free(request->params);
   http_utils_parse_query_parameters(request->params, query);
@@ -4,6 +4,7 @@
 
 #include <baselib/baselib.h>
 
+#include "http_allocator.h"
 #include "http_method.h"
 
 struct HTTPRequest;
@@ -11,6 +12,7 @@ typedef struct HTTPRequest HTTPRequest;
 
 
 HTTPRequest * http_request_new();
+HTTPRequest * http_request_new_with_allocator(HTTPAllocator allocator);
 void http_request_destroy(HTTPRequest * request);
 
 
@@ -23,6 +25,8 @@ void http_request_destroy(HTTPRequest * request);
         http_message_get_version((HTTPMessage *) m)
 #define http_request_get_content(m) \
         http_message_get_content((HTTPMessage *) m)
+#define http_request_get_allocator(m) \
+        http_message_get_allocator((HTTPMessage *) m)
 
 #define http_request_list_header_keys(m) \
         http_message_list_header_keys((HTTPMessage *) m)
@@ -86,6 +90,9 @@ Dictionary * http_request_get_parameters(HTTPRequest * message);
 #define http_request_remove_cookie(m, c) \
         http_message_remove_cookie((HTTPMessage *) m, c)
 
+#define http_request_free_content(m) \
+        http_message_free_content((HTTPMessage *) m)
+
 
 void http_request_set_method(HTTPRequest * request, HTTPMethod method);
 
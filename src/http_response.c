@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "http_allocator.h"
 #include "http_status_code.h"
 
 #include "http_response.h"
@@ -19,10 +20,18 @@ struct HTTPResponse
 
 HTTPResponse * http_response_new()
 {
-  HTTPResponse * ret = (HTTPResponse *) malloc(sizeof(HTTPResponse));
+  return http_response_new_with_allocator(chttp_get_allocator());
+}
+
+HTTPResponse * http_response_new_with_allocator(HTTPAllocator allocator)
+{
+  HTTPResponse * ret;
+
+  ret = (HTTPResponse *)
+    http_allocator_malloc(&allocator, sizeof(HTTPResponse));
   assert(ret);
   
-  http_message_init_struct(&ret->base, HTTP_MESSAGE_TYPE_RESPONSE);
+  http_message_init_struct(&ret->base, HTTP_MESSAGE_TYPE_RESPONSE, allocator);
   ret->base.destroy = (void (*)(HTTPMessage *)) http_response_destroy;
 
   ret->status_code = HTTP_STATUS_CODE_200_OK;
@@ -33,12 +42,16 @@ HTTPResponse * http_response_new()
 
 void http_response_destroy(HTTPResponse * response)
 {
+  HTTPAllocator allocator;
+
   assert(response);
 
+  allocator = response->base.allocator;
+
   http_message_deinit_struct(&response->base);
 
-  free(response->status_message);
-  free(response);
+  http_allocator_free(&allocator, response->status_message);
+  http_allocator_free(&allocator, response);
 }
 
 
@@ -85,7 +98,8 @@ void http_response_set_status_message(
 {
   assert(response);
 
-  free(response->status_message);
-  response->status_message = strings_clone(status_message);
+  http_allocator_free(&response->base.allocator, response->status_message);
+  response->status_message =
+    http_allocator_clone(&response->base.allocator, status_message);
 }
 
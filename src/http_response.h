@@ -2,6 +2,7 @@
 #ifndef __CHTTP_HTTP_RESPONSE_H
 #define __CHTTP_HTTP_RESPONSE_H
 
+#include "http_allocator.h"
 #include "http_status_code.h"
 
 struct HTTPResponse;
@@ -9,6 +10,7 @@ typedef struct HTTPResponse HTTPResponse;
 
 
 HTTPResponse * http_response_new();
+HTTPResponse * http_response_new_with_allocator(HTTPAllocator allocator);
 void http_response_destroy(HTTPResponse * response);
 
 
@@ -21,6 +23,8 @@ void http_response_destroy(HTTPResponse * response);
         http_message_get_version((HTTPMessage *) m)
 #define http_response_get_content(m) \
         http_message_get_content((HTTPMessage *) m)
+#define http_response_get_allocator(m) \
+        http_message_get_allocator((HTTPMessage *) m)
 
 #define http_response_list_header_keys(m) \
         http_message_list_header_keys((HTTPMessage *) m)
@@ -80,6 +84,9 @@ char * http_response_get_status_message(HTTPResponse * response);
 #define http_response_remove_cookie(m, c) \
         http_message_remove_cookie((HTTPMessage *) m, c)
 
+#define http_response_free_content(m) \
+        http_message_free_content((HTTPMessage *) m)
+
 
 void http_response_set_status_code(
     HTTPResponse * response,
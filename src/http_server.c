@@ -0,0 +1,2841 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_cache.h"
+#include "http_io.h"
+#include "http_message.h"
+#include "http_metrics.h"
+#include "http_mpsc_queue.h"
+#include "http_status_code.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "http_reader.h"
+#include "http_spsc_ring.h"
+#include "http_timer_wheel.h"
+#include "http_uring.h"
+#include "http_utils.h"
+#include "http_wait.h"
+#include "http_worker_pool.h"
+#include "http_writer.h"
+
+#include "http_server.h"
+
+
+#define _HTTP_SERVER_EVENT_COUNT 0x100
+#define _HTTP_SERVER_READ_LENGTH 0x1000
+#define _HTTP_SERVER_TIMER_RESOLUTION 10 /* in milliseconds */
+
+#define _HTTP_SERVER_RING_ENTRIES 0x400
+#define _HTTP_SERVER_RING_BUFFER_COUNT 0x400
+#define _HTTP_SERVER_RING_BUFFER_GROUP 0
+
+/* io_uring user data: a connection pointer tagged with the operation */
+#define _HTTP_SERVER_OPERATION_RECV 1
+#define _HTTP_SERVER_OPERATION_SEND 2
+#define _HTTP_SERVER_OPERATION_MASK 3
+
+/* HTTPServerJob states: completing a job while its handler is still being
+ * called leaves the response to the caller, later ones to the loop
+ */
+#define _HTTP_SERVER_JOB_DISPATCHING 1
+#define _HTTP_SERVER_JOB_WAITING 2
+#define _HTTP_SERVER_JOB_COMPLETE 3
+
+#define _HTTP_SERVER_SPARE_COUNT 0x40 /* recycled connections kept per loop */
+#define _HTTP_SERVER_IDLE_POOL_COUNT 0x100 /* of each, given up while idle */
+#define _HTTP_SERVER_HANDOFF_LENGTH 0x400 /* accepted connections in transit */
+
+struct HTTPServerConnection;
+typedef struct HTTPServerConnection HTTPServerConnection;
+struct HTTPServerLoop;
+typedef struct HTTPServerLoop HTTPServerLoop;
+
+/* a request being handled, and the handle completing it. a response
+ * completed after the handler has returned (or by a handler on a worker)
+ * comes back to the connection's loop through its completed queue; only
+ * the loop ever touches the connection itself
+ */
+struct HTTPRequestHandle
+{
+  HTTPWorkerTask task;
+  HTTPMPSCNode node;
+  HTTPServerConnection * conn;
+  HTTPRequest * request;
+  HTTPResponse * response;
+  uint32_t state;
+
+  /* as per http_wait_now_ns, if metrics or an access log are kept */
+  uint64_t dispatched;
+
+  /* filled in as it goes, if the server keeps an access log. its target
+   * is the job's own
+   */
+  HTTPAccessLogRecord record;
+
+  /* to be filled with the response once rendered, if it may be cached */
+  HTTPCacheEntry * cache_entry;
+  HTTPCacheFlight * flight; /* led until then, if any */
+
+  /* on another request's flight rather than with the handler */
+  HTTPCacheWaiter waiter;
+  bool waiting;
+};
+typedef struct HTTPRequestHandle HTTPServerJob;
+
+struct HTTPServerConnection
+{
+  HTTPServerLoop * loop;
+  HTTPServerConnection * next, * prev;
+  int fd;
+
+  HTTPReader * reader;
+  HTTPWriter * writer;
+  HTTPTimer timer;
+  uint64_t deadline;
+
+  /* the request being handled; at most one at a time, to keep responses
+   * in order
+   */
+  HTTPServerJob job;
+  HTTPVersion version;
+  bool keep_alive;
+
+  /* received bytes; [input_start, input_length) are unparsed. while a
+   * message is being parsed, the reader is served [message_start,
+   * message_end) only, so it can never block or over-read
+   */
+  char * input;
+  size_t input_start, input_length, input_capacity, scan_offset;
+  size_t message_start, message_end;
+
+  /* rendered responses; [output_start, output_length) are unsent */
+  char * output;
+  size_t output_start, output_length, output_capacity;
+
+  uint32_t served;
+  uint32_t operations; /* io_uring operations yet to complete */
+  uint64_t capture_connection; /* its number in the server's capture */
+  bool
+    receiving, /* an io_uring recv is armed */
+    sending, /* an io_uring send of the output buffer is in flight */
+    awaiting, /* its job is with the worker pool or the handler */
+    headers_complete, /* of the message at input_start */
+    continued, /* a 100 Continue was queued for it */
+    input_paused, /* stopped reading because too much is buffered */
+    end_of_input,
+    closing, /* close once output is flushed */
+    closed;
+};
+
+/* one event loop per thread, each with its own listening socket (bound
+ * with SO_REUSEPORT when there are several), so a connection is handled by
+ * one thread from accept to close and loops share nothing but settings.
+ * with a single acceptor only the first loop listens, and it hands the
+ * connections it accepts to the others in turn through their rings
+ */
+struct HTTPServerLoop
+{
+  HTTPServer * server;
+  uint32_t index;
+  pthread_t thread;
+
+  int listen_fd, epoll_fd, stop_fd, wake_fd;
+  HTTPUring * ring;
+  bool recv_multishot, accepting;
+  bool running;
+  uint64_t now;
+  time_t date_time; /* the second `date' was formatted for */
+  char date [32]; /* as a Date header's value */
+
+  HTTPTimerWheel * timer_wheel;
+  HTTPServerConnection * connections, * closed;
+  HTTPServerConnection * spare; /* closed connections kept for reuse */
+  uint32_t connection_count, spare_count;
+
+  /* what idle connections gave up, with slim_idle, for the next to need it.
+   * the buffers are all _HTTP_SERVER_READ_LENGTH long
+   */
+  HTTPReader * idle_readers [_HTTP_SERVER_IDLE_POOL_COUNT];
+  HTTPWriter * idle_writers [_HTTP_SERVER_IDLE_POOL_COUNT];
+  char * idle_buffers [_HTTP_SERVER_IDLE_POOL_COUNT];
+  uint32_t idle_reader_count, idle_writer_count, idle_buffer_count;
+
+  HTTPSPSCRing * handoff; /* descriptors the acceptor passed on to it */
+  uint32_t next_loop; /* the acceptor's turn */
+
+  HTTPMPSCQueue completed; /* jobs handled by the workers */
+  bool wake_pending; /* wake_fd has been written since the last drain */
+
+  char * error; /* static message; never freed */
+  int error_number;
+};
+
+struct HTTPServer
+{
+  HTTPServerHandler handler;
+  HTTPServerAsyncHandler async_handler;
+  void * context;
+
+  HTTPServerSettings settings;
+  HTTPReaderSettings reader_settings;
+
+  HTTPServerBackend backend;
+  HTTPServerLoop * loops;
+  uint32_t loop_count;
+  bool handing_off; /* only the first loop listens */
+  HTTPWorkerPool * workers; /* while running, if there are any */
+  HTTPCapture * capture; /* records everything received, if set */
+  HTTPAccessLog * access_log; /* a line for every response, if set */
+  HTTPCache * cache; /* answers what it can in place of the handler */
+
+  char * error; /* static message; never freed */
+  int error_number;
+};
+
+
+static void http_server_fail(HTTPServer * server, char * error)
+{
+  server->error = error;
+  server->error_number = errno;
+}
+
+static void http_server_loop_fail(HTTPServerLoop * loop, char * error)
+{
+  loop->error = error;
+  loop->error_number = errno;
+}
+
+static void http_server_connection_free(HTTPServerConnection * conn)
+{
+  if (conn->reader)
+    http_reader_destroy(conn->reader);
+  if (conn->writer)
+    http_writer_destroy(conn->writer);
+  free(conn->input);
+  free(conn->output);
+  free(conn);
+}
+
+static void http_server_close(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+
+  if (conn->closed)
+    return;
+
+  conn->closed = true;
+  http_timer_wheel_cancel(loop->timer_wheel, &conn->timer);
+
+  if (!loop->ring)
+  {
+    close(conn->fd); /* also removes it from the epoll set */
+    conn->fd = -1;
+  }
+  else if (conn->operations)
+    http_uring_cancel_fd(loop->ring, conn->fd, 0);
+
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    loop->connections = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+
+  __atomic_sub_fetch(&loop->connection_count, 1, __ATOMIC_RELAXED);
+
+  /* freed once the current batch of events has been handled, as later
+   * events in the batch may still refer to it (and with io_uring, once the
+   * kernel is done with its buffers)
+   */
+  conn->prev = NULL;
+  conn->next = loop->closed;
+  loop->closed = conn;
+}
+
+/* keeps a closed connection's reader, writer and (modest) buffers for the
+ * next connection the loop accepts
+ */
+static void http_server_recycle(
+    HTTPServerLoop * loop,
+    HTTPServerConnection * conn
+    )
+{
+  if (loop->spare_count >= _HTTP_SERVER_SPARE_COUNT)
+  {
+    http_server_connection_free(conn);
+    return;
+  }
+
+  if (
+    conn->reader && (
+      http_reader_has_error(conn->reader) ||
+      !http_reader_buffer_is_empty(conn->reader)
+      )
+    )
+  {
+    http_reader_destroy(conn->reader);
+    conn->reader = NULL;
+  }
+  if (conn->writer && http_writer_has_error(conn->writer))
+  {
+    http_writer_destroy(conn->writer);
+    conn->writer = NULL;
+  }
+
+  if (conn->input_capacity > _HTTP_SERVER_READ_LENGTH * 4)
+  {
+    free(conn->input);
+    conn->input = NULL;
+    conn->input_capacity = 0;
+  }
+  if (conn->output_capacity > _HTTP_SERVER_READ_LENGTH * 4)
+  {
+    free(conn->output);
+    conn->output = NULL;
+    conn->output_capacity = 0;
+  }
+
+  conn->next = loop->spare;
+  loop->spare = conn;
+  loop->spare_count++;
+}
+
+static void http_server_free_closed(HTTPServerLoop * loop, bool force)
+{
+  HTTPServerConnection * conn, * waiting = NULL;
+
+  while (loop->closed)
+  {
+    conn = loop->closed;
+    loop->closed = conn->next;
+
+    if ((conn->operations || conn->awaiting) && !force)
+    {
+      conn->next = waiting;
+      waiting = conn;
+      continue;
+    }
+
+    if (conn->fd >= 0)
+      close(conn->fd);
+
+    if (force)
+      http_server_connection_free(conn);
+    else
+      http_server_recycle(loop, conn);
+  }
+
+  loop->closed = waiting;
+}
+
+static void http_server_timer_fired(HTTPTimer * timer, void * context)
+{
+  (void) timer;
+  http_server_close((HTTPServerConnection *) context);
+}
+
+static bool http_server_output_pending(HTTPServerConnection * conn)
+{
+  return conn->output_start < conn->output_length;
+}
+
+static bool http_server_input_pending(HTTPServerConnection * conn)
+{
+  return conn->input_start < conn->input_length;
+}
+
+static void http_server_slim(HTTPServerConnection * conn);
+
+/* keeps one deadline per connection, chosen by what it is waiting on */
+static void http_server_update_timer(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  uint64_t deadline;
+
+  if (conn->closed)
+    return;
+
+  if (server->settings.slim_idle)
+    http_server_slim(conn);
+
+  if (http_server_output_pending(conn))
+    deadline = loop->now + server->settings.write_timeout * 1000ULL;
+  else if (conn->awaiting)
+  {
+    /* handlers are not timed */
+    http_timer_wheel_cancel(loop->timer_wheel, &conn->timer);
+    return;
+  }
+  else if (http_server_input_pending(conn))
+    deadline = conn->deadline; /* set when the message began */
+  else if (conn->served == 0)
+    deadline = loop->now +
+               server->reader_settings.header_receive_timeout * 1000ULL;
+  else if (server->reader_settings.keep_alive_timeout)
+    deadline = loop->now +
+               server->reader_settings.keep_alive_timeout * 1000ULL;
+  else
+  {
+    http_timer_wheel_cancel(loop->timer_wheel, &conn->timer);
+    return;
+  }
+
+  if (!http_timer_is_armed(&conn->timer) || conn->timer.deadline != deadline)
+    http_timer_wheel_arm(loop->timer_wheel, &conn->timer, deadline);
+}
+
+
+static ssize_t http_server_read_message(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    )
+{
+  HTTPServerConnection * conn = (HTTPServerConnection *) context;
+  size_t remaining = conn->message_end - conn->message_start;
+
+  (void) fd;
+
+  if (length > remaining)
+    length = remaining;
+
+  memcpy(data, &conn->input[conn->message_start], length);
+  conn->message_start += length;
+
+  return length; /* zero at the end of the message */
+}
+
+static void http_server_reserve(
+    HTTPServerLoop * loop,
+    char ** buffer,
+    size_t * capacity,
+    size_t required
+    )
+{
+  if (*capacity >= required)
+    return;
+
+  if (*capacity == 0 && loop->idle_buffer_count)
+  {
+    *buffer = loop->idle_buffers[--loop->idle_buffer_count];
+    *capacity = _HTTP_SERVER_READ_LENGTH;
+    if (*capacity >= required)
+      return;
+  }
+
+  if (*capacity == 0)
+    *capacity = _HTTP_SERVER_READ_LENGTH;
+  while (*capacity < required)
+    *capacity *= 2;
+
+  *buffer = realloc(*buffer, *capacity);
+  assert(*buffer);
+}
+
+static ssize_t http_server_write_output(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  HTTPServerConnection * conn = (HTTPServerConnection *) context;
+
+  (void) fd;
+
+  http_server_reserve(
+      conn->loop,
+      &conn->output,
+      &conn->output_capacity,
+      conn->output_length + length
+      );
+  memcpy(&conn->output[conn->output_length], data, length);
+  conn->output_length += length;
+
+  return length;
+}
+
+/* what the reader answers by itself, queued behind earlier responses as
+ * any other. a 100 Continue already queued while the content was awaited
+ * is not queued again
+ */
+static ssize_t http_server_write_interim(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  HTTPServerConnection * conn = (HTTPServerConnection *) context;
+
+  if (conn->continued)
+    return length;
+
+  return http_server_write_output(fd, data, length, context);
+}
+
+
+/* a reader and writer for the connection, from the loop's idle pools if
+ * there are any
+ */
+static void http_server_take_reader(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+
+  if (loop->idle_reader_count)
+    conn->reader = loop->idle_readers[--loop->idle_reader_count];
+  else
+  {
+    conn->reader = http_reader_new(-1);
+    http_reader_set_settings(conn->reader, loop->server->reader_settings);
+  }
+
+  http_reader_set_read_function(conn->reader, http_server_read_message, conn);
+  http_reader_set_write_function(
+      conn->reader,
+      http_server_write_interim,
+      conn
+      );
+}
+
+static void http_server_take_writer(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+
+  if (loop->idle_writer_count)
+    conn->writer = loop->idle_writers[--loop->idle_writer_count];
+  else
+    conn->writer = http_writer_new();
+
+  http_writer_set_write_function(conn->writer, http_server_write_output, conn);
+}
+
+static void http_server_give_buffer(
+    HTTPServerLoop * loop,
+    char ** buffer,
+    size_t * capacity
+    )
+{
+  if (
+    *capacity == _HTTP_SERVER_READ_LENGTH &&
+    loop->idle_buffer_count < _HTTP_SERVER_IDLE_POOL_COUNT
+    )
+    loop->idle_buffers[loop->idle_buffer_count++] = *buffer;
+  else
+    free(*buffer);
+
+  *buffer = NULL;
+  *capacity = 0;
+}
+
+/* between requests, a connection gives up its reader, writer and buffers,
+ * so that an idle one costs little more than its own struct. they are
+ * taken back (likely from the pools) once a message comes in
+ */
+static void http_server_slim(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+
+  if (
+    conn->awaiting ||
+    conn->sending ||
+    http_server_output_pending(conn) ||
+    http_server_input_pending(conn)
+    )
+    return;
+
+  if (conn->reader)
+  {
+    if (
+      loop->idle_reader_count < _HTTP_SERVER_IDLE_POOL_COUNT &&
+      !http_reader_has_error(conn->reader) &&
+      http_reader_buffer_is_empty(conn->reader)
+      )
+      loop->idle_readers[loop->idle_reader_count++] = conn->reader;
+    else
+      http_reader_destroy(conn->reader);
+    conn->reader = NULL;
+  }
+
+  if (conn->writer)
+  {
+    if (
+      loop->idle_writer_count < _HTTP_SERVER_IDLE_POOL_COUNT &&
+      !http_writer_has_error(conn->writer)
+      )
+      loop->idle_writers[loop->idle_writer_count++] = conn->writer;
+    else
+      http_writer_destroy(conn->writer);
+    conn->writer = NULL;
+  }
+
+  if (conn->input)
+    http_server_give_buffer(loop, &conn->input, &conn->input_capacity);
+  if (conn->output)
+    http_server_give_buffer(loop, &conn->output, &conn->output_capacity);
+
+  conn->input_start = 0;
+  conn->input_length = 0;
+  conn->output_start = 0;
+  conn->output_length = 0;
+}
+
+/* whether raw headers ask to be told to go on before sending content */
+static bool http_server_expects_continue(const char * headers, size_t length)
+{
+  const char * value;
+  size_t value_length;
+
+  return
+    http_utils_scan_header(headers, length, "expect:", &value, &value_length) &&
+    value_length == 12 &&
+    strncasecmp(value, "100-continue", 12) == 0;
+}
+
+static void http_server_send_continue(HTTPServerConnection * conn)
+{
+  HTTPResponse * response;
+
+  response = http_response_new();
+  http_response_set_status_code(response, HTTP_STATUS_CODE_100_CONTINUE);
+  http_response_set_version(response, HTTP_VERSION_1_1);
+
+  if (!conn->writer)
+    http_server_take_writer(conn);
+  http_writer_render(conn->writer, (HTTPMessage *) response, conn->fd);
+  http_response_destroy(response);
+
+  conn->continued = true;
+}
+
+/* looks for a complete message at input_start without parsing it. returns
+ * its length, or 0 if more input is needed. `status' is set if the message
+ * is already known to be unacceptable
+ */
+static size_t http_server_scan_message(
+    HTTPServerConnection * conn,
+    HTTPStatusCode * status
+    )
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  char * start = &conn->input[conn->input_start];
+  size_t available = conn->input_length - conn->input_start;
+  size_t k, header_length, value_length;
+  unsigned long long content_length;
+  const char * value;
+  int found;
+
+  k = conn->scan_offset > 3 ? conn->scan_offset - 3 : 0;
+  for (; k + 3 < available; k++)
+  {
+    if (
+      start[k] == '\r' && start[k + 1] == '\n' &&
+      start[k + 2] == '\r' && start[k + 3] == '\n'
+      )
+      break;
+  }
+
+  if (k + 3 >= available)
+  {
+    conn->scan_offset = available;
+    if (available > server->settings.max_header_length)
+      *status = HTTP_STATUS_CODE_431_REQUEST_HEADER_FIELDS_TOO_LARGE;
+    return 0;
+  }
+
+  conn->scan_offset = k;
+  header_length = k + 4;
+  if (header_length > server->settings.max_header_length)
+  {
+    *status = HTTP_STATUS_CODE_431_REQUEST_HEADER_FIELDS_TOO_LARGE;
+    return 0;
+  }
+
+  if (!conn->headers_complete)
+  {
+    conn->headers_complete = true;
+    conn->deadline = loop->now +
+      server->reader_settings.content_receive_timeout * 1000ULL;
+  }
+
+  found = http_utils_scan_content_length(start, header_length, &content_length);
+  if (found < 0)
+  {
+    *status = HTTP_STATUS_CODE_400_BAD_REQUEST;
+    return 0;
+  }
+  else if (!found)
+    content_length = 0;
+
+  /* nothing here decodes a transfer coding, so a message framed by one
+   * (with a Content-Length besides, framed two ways at once) is refused
+   * rather than have its content taken for the next request
+   */
+  if (
+    http_utils_scan_header(
+        start,
+        header_length,
+        "transfer-encoding:",
+        &value,
+        &value_length
+        )
+    )
+  {
+    *status = found ?
+      HTTP_STATUS_CODE_400_BAD_REQUEST :
+      HTTP_STATUS_CODE_501_NOT_IMPLEMENTED;
+    return 0;
+  }
+
+  if (content_length > server->settings.max_content_length)
+  {
+    *status = HTTP_STATUS_CODE_413_PAYLOAD_TOO_LARGE;
+    return 0;
+  }
+
+  /* the reader would only answer Expect once the content is in, which the
+   * client may be waiting to be told to send. without a callback to
+   * consult, the server can tell it as soon as the headers are
+   */
+  if (
+    available < header_length + content_length &&
+    !conn->continued &&
+    http_server_expects_continue(start, header_length)
+    )
+  {
+    if (!server->reader_settings.allow_expect_continue)
+    {
+      *status = HTTP_STATUS_CODE_417_EXPECTATION_FAILED;
+      return 0;
+    }
+    else if (!server->reader_settings.send_continue_callback)
+      http_server_send_continue(conn);
+  }
+
+  if (available < header_length + content_length)
+    return 0;
+
+  return header_length + content_length;
+}
+
+
+static void http_server_render(
+    HTTPServerConnection * conn,
+    HTTPResponse * response
+    )
+{
+  HTTPContent content;
+
+  content = http_response_get_content(response);
+  if (!http_response_has_header(response, "Content-Length"))
+    http_response_set_content_length(response, content.length);
+
+  if (!conn->writer)
+    http_server_take_writer(conn);
+  http_writer_render(conn->writer, (HTTPMessage *) response, conn->fd);
+
+  http_response_free_content(response);
+  http_response_destroy(response);
+}
+
+static void http_server_send_error(
+    HTTPServerConnection * conn,
+    HTTPStatusCode status
+    )
+{
+  HTTPAccessLog * access_log = conn->loop->server->access_log;
+  HTTPAccessLogRecord record;
+  HTTPResponse * response;
+  uint64_t start = 0;
+
+  response = http_response_new();
+  http_response_set_status_code(response, status);
+  http_response_set_header(response, "Connection", "close");
+
+  if (access_log)
+    start = http_wait_now_ns();
+  http_server_render(conn, response);
+  conn->closing = true;
+
+  if (access_log)
+  {
+    memset(&record, 0, sizeof(HTTPAccessLogRecord));
+    record.status_code = status;
+    record.render_time = http_wait_now_ns() - start;
+    http_access_log_record(access_log, &record);
+  }
+}
+
+static bool http_server_message_closes(HTTPMessage * message)
+{
+  char * value;
+  bool ret;
+
+  value = http_message_get_header(message, "Connection");
+  if (!value)
+    return false;
+
+  ret = strings_equals_ignore_case(value, "close");
+  free(value);
+
+  return ret;
+}
+
+static void http_server_discard(HTTPResponse * response)
+{
+  if (!response)
+    return;
+
+  http_response_free_content(response);
+  http_response_destroy(response);
+}
+
+/* writes the response to the connection's current request */
+static void http_server_respond(
+    HTTPServerConnection * conn,
+    HTTPResponse * response
+    )
+{
+  HTTPServer * server = conn->loop->server;
+  HTTPAccessLog * access_log = server->access_log;
+  HTTPCacheEntry * cache_entry = conn->job.cache_entry;
+  bool keep_alive = conn->keep_alive;
+  uint64_t start = 0;
+  size_t rendered;
+
+  conn->job.cache_entry = NULL;
+
+  if (!response)
+  {
+    response = http_response_new();
+    http_response_set_status_code(
+        response,
+        HTTP_STATUS_CODE_500_INTERNAL_SERVER_ERROR
+        );
+  }
+
+  if (http_server_message_closes((HTTPMessage *) response))
+    keep_alive = false;
+  else if (!keep_alive)
+    http_response_set_header(response, "Connection", "close");
+  else if (conn->version == HTTP_VERSION_1_0)
+    http_response_set_header(response, "Connection", "keep-alive");
+
+  if (access_log)
+  {
+    conn->job.record.status_code = http_response_get_status_code(response);
+    conn->job.record.content_length =
+      http_response_get_content(response).length;
+    start = http_wait_now_ns();
+  }
+
+  rendered = conn->output_length;
+  http_server_render(conn, response);
+  if (conn->job.dispatched)
+    http_metrics_observe(
+        HTTP_METRIC_HISTOGRAM_RESPONSE,
+        http_wait_now_ns() - conn->job.dispatched
+        );
+
+  if (access_log)
+  {
+    conn->job.record.render_time = http_wait_now_ns() - start;
+    http_access_log_record(access_log, &conn->job.record);
+    free((char *) conn->job.record.target);
+    conn->job.record.target = NULL;
+  }
+
+  /* what was rendered is what any request like it can be sent */
+  if (cache_entry && keep_alive)
+    http_cache_insert(
+        server->cache,
+        cache_entry,
+        &conn->output[rendered],
+        conn->output_length - rendered
+        );
+  else if (cache_entry)
+    http_cache_release(server->cache, cache_entry);
+
+  if (conn->job.flight)
+  {
+    http_cache_end_flight(server->cache, conn->job.flight);
+    conn->job.flight = NULL;
+  }
+
+  conn->served++;
+  if (!keep_alive)
+    conn->closing = true;
+}
+
+/* what the cache keeps was rendered for a persistent HTTP/1.1
+ * connection, so only such a request can be answered from it
+ */
+static bool http_server_may_respond_cached(HTTPRequest * request)
+{
+  return
+    http_request_get_version(request) == HTTP_VERSION_1_1 &&
+    http_message_is_keep_alive((HTTPMessage *) request) &&
+    !http_server_message_closes((HTTPMessage *) request);
+}
+
+/* the current date as a Date header's value, formatted once a second */
+static const char * http_server_get_date(
+    HTTPServerLoop * loop,
+    size_t * length
+    )
+{
+  time_t now = time(NULL);
+  char * date;
+
+  if (now != loop->date_time)
+  {
+    date = http_utils_date_to_string(now, HTTP_VERSION_1_1);
+    strncpy(loop->date, date, sizeof(loop->date) - 1);
+    free(date);
+    loop->date_time = now;
+  }
+
+  *length = strlen(loop->date);
+  return loop->date;
+}
+
+/* answers the request from the server's cache, if it can, with the date
+ * the response was rendered on brought up to now
+ */
+static bool http_server_respond_cached(
+    HTTPServerConnection * conn,
+    HTTPRequest * request,
+    uint64_t parse_time
+    )
+{
+  HTTPServer * server = conn->loop->server;
+  HTTPAccessLogRecord record;
+  HTTPCacheEntry * entry;
+  const char * date;
+  size_t date_length;
+  HTTPCacheHit hit;
+  uint64_t start = 0;
+
+  if (!http_server_may_respond_cached(request))
+    return false;
+
+  if (server->access_log)
+    start = http_wait_now_ns();
+
+  entry = http_cache_lookup(server->cache, request, &hit);
+  if (!entry)
+    return false;
+
+  date = http_server_get_date(conn->loop, &date_length);
+  if (hit.date_offset && hit.date_length == date_length)
+  {
+    http_server_write_output(conn->fd, hit.data, hit.date_offset, conn);
+    http_server_write_output(conn->fd, date, date_length, conn);
+    http_server_write_output(
+        conn->fd,
+        &hit.data[hit.date_offset + date_length],
+        hit.length - hit.date_offset - date_length,
+        conn
+        );
+  }
+  else
+    http_server_write_output(conn->fd, hit.data, hit.length, conn);
+  http_cache_release(server->cache, entry);
+  conn->served++;
+
+  if (server->access_log)
+  {
+    memset(&record, 0, sizeof(HTTPAccessLogRecord));
+    record.method = http_request_get_method(request);
+    record.target = http_request_get_target(request);
+    record.status_code = hit.status_code;
+    record.content_length = hit.content_length;
+    record.parse_time = parse_time;
+    record.render_time = http_wait_now_ns() - start;
+    http_access_log_record(server->access_log, &record);
+    free((char *) record.target);
+  }
+
+  http_request_free_content(request);
+  http_request_destroy(request);
+
+  return true;
+}
+
+/* from any thread; only the first wake after a drain writes wake_fd */
+static void http_server_loop_wake(HTTPServerLoop * loop)
+{
+  uint64_t value = 1;
+
+  if (!__atomic_exchange_n(&loop->wake_pending, true, __ATOMIC_SEQ_CST))
+  {
+    (void) !write(loop->wake_fd, &value, sizeof(value));
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+  }
+}
+
+/* hands a job completed after its handler returned back to its loop */
+static void http_server_job_return(HTTPServerJob * job)
+{
+  HTTPServerLoop * loop = job->conn->loop;
+
+  http_mpsc_queue_push(&loop->completed, &job->node);
+  http_server_loop_wake(loop);
+}
+
+/* calls the handler; true if the job was completed before it returned */
+static bool http_server_job_call(HTTPServerJob * job)
+{
+  HTTPServer * server = job->conn->loop->server;
+  uint32_t expected = _HTTP_SERVER_JOB_DISPATCHING;
+
+  __atomic_store_n(&job->state, _HTTP_SERVER_JOB_DISPATCHING, __ATOMIC_RELAXED);
+
+  if (server->async_handler)
+    server->async_handler(job->request, job, server->context);
+  else
+    http_request_complete(
+        job,
+        server->handler(job->request, server->context)
+        );
+
+  return !__atomic_compare_exchange_n(
+      &job->state,
+      &expected,
+      _HTTP_SERVER_JOB_WAITING,
+      false,
+      __ATOMIC_ACQ_REL,
+      __ATOMIC_ACQUIRE
+      );
+}
+
+/* on a worker thread */
+static void http_server_job_run(HTTPWorkerTask * task)
+{
+  HTTPServerJob * job = (HTTPServerJob *) task;
+
+  if (http_server_job_call(job))
+    http_server_job_return(job);
+}
+
+/* on the loop, once the job is complete; hands back its response */
+static HTTPResponse * http_server_job_end(HTTPServerJob * job)
+{
+  job->conn->awaiting = false;
+
+  if (job->conn->loop->server->access_log)
+  {
+    job->record.method = http_request_get_method(job->request);
+    job->record.target = http_request_get_target(job->request);
+    job->record.handle_time = http_wait_now_ns() - job->dispatched;
+  }
+
+  if (
+    job->conn->loop->server->cache &&
+    job->response &&
+    job->conn->keep_alive &&
+    job->conn->version == HTTP_VERSION_1_1
+    )
+    job->cache_entry = http_cache_prepare(
+        job->conn->loop->server->cache,
+        job->request,
+        job->response
+        );
+
+  http_request_free_content(job->request);
+  http_request_destroy(job->request);
+  job->request = NULL;
+
+  return job->response;
+}
+
+/* ends a job whose connection is gone */
+static void http_server_job_discard(HTTPServerJob * job)
+{
+  if (job->waiting)
+  {
+    job->waiting = false;
+    job->conn->awaiting = false;
+    http_request_free_content(job->request);
+    http_request_destroy(job->request);
+    job->request = NULL;
+    return;
+  }
+
+  http_server_discard(http_server_job_end(job));
+
+  free((char *) job->record.target);
+  job->record.target = NULL;
+
+  if (job->cache_entry)
+  {
+    http_cache_release(job->conn->loop->server->cache, job->cache_entry);
+    job->cache_entry = NULL;
+  }
+
+  if (job->flight)
+  {
+    http_cache_end_flight(job->conn->loop->server->cache, job->flight);
+    job->flight = NULL;
+  }
+}
+
+/* `parse_time' is for the access log, if the server keeps one */
+static void http_server_dispatch(
+    HTTPServerConnection * conn,
+    HTTPRequest * request,
+    uint64_t parse_time
+    )
+{
+  HTTPServer * server = conn->loop->server;
+
+  conn->keep_alive = http_message_is_keep_alive((HTTPMessage *) request) &&
+                     !http_server_message_closes((HTTPMessage *) request);
+  conn->version = http_request_get_version(request);
+
+  conn->awaiting = true;
+  conn->job.conn = conn;
+  conn->job.request = request;
+  conn->job.response = NULL;
+  conn->job.dispatched =
+    http_metrics_is_enabled() || server->access_log ? http_wait_now_ns() : 0;
+  conn->job.record.parse_time = parse_time;
+
+  if (server->workers)
+  {
+    http_worker_task_init(&conn->job.task, http_server_job_run);
+    http_worker_pool_submit(server->workers, &conn->job.task);
+  }
+  else if (http_server_job_call(&conn->job))
+    http_server_respond(conn, http_server_job_end(&conn->job));
+}
+
+/* from the thread which ended the flight the job waited on */
+static void http_server_job_wake(HTTPCacheWaiter * waiter)
+{
+  http_server_job_return(
+      (HTTPServerJob *) ((char *) waiter - offsetof(HTTPServerJob, waiter))
+      );
+}
+
+/* answers the request from the cache or, should it miss while another
+ * request like it is being handled, has it wait for that one's response
+ * to be cached rather than handle it too. false if it is to be handled
+ */
+static bool http_server_consult_cache(
+    HTTPServerConnection * conn,
+    HTTPRequest * request,
+    uint64_t parse_time
+    )
+{
+  HTTPServer * server = conn->loop->server;
+
+  conn->job.flight = NULL;
+
+  if (!http_server_may_respond_cached(request))
+    return false;
+  else if (http_server_respond_cached(conn, request, parse_time))
+    return true;
+
+  conn->job.waiter.wake = http_server_job_wake;
+  if (
+    http_cache_begin_flight(
+        server->cache,
+        request,
+        &conn->job.waiter,
+        &conn->job.flight
+        )
+    )
+    return false;
+
+  /* parked, as with a handler, until woken */
+  conn->awaiting = true;
+  conn->job.conn = conn;
+  conn->job.request = request;
+  conn->job.response = NULL;
+  conn->job.record.parse_time = parse_time;
+  conn->job.waiting = true;
+
+  return true;
+}
+
+/* on the loop, once the flight the job waited on has ended. should the
+ * cache still miss, it is consulted as for a new request: where the
+ * response could not be kept the flight left its key marked, and the
+ * request is handled with no flight at all; otherwise (the response was
+ * kept but is gone again) the first to get there leads a new flight
+ */
+static void http_server_job_resume(HTTPServerJob * job)
+{
+  HTTPServerConnection * conn = job->conn;
+  HTTPRequest * request = job->request;
+
+  job->waiting = false;
+  job->request = NULL;
+  conn->awaiting = false;
+
+  if (!http_server_consult_cache(conn, request, job->record.parse_time))
+    http_server_dispatch(conn, request, job->record.parse_time);
+}
+
+static void http_server_compact_input(HTTPServerConnection * conn)
+{
+  if (conn->input_start == conn->input_length)
+  {
+    conn->input_start = 0;
+    conn->input_length = 0;
+  }
+  else if (conn->input_start > conn->input_capacity / 2)
+  {
+    memmove(
+        conn->input,
+        &conn->input[conn->input_start],
+        conn->input_length - conn->input_start
+        );
+    conn->input_length -= conn->input_start;
+    conn->input_start = 0;
+  }
+}
+
+/* parses and answers every complete message buffered, in order */
+static void http_server_process(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  HTTPMessage * message;
+  HTTPStatusCode status;
+  uint64_t parse_time;
+  size_t length;
+
+  while (
+    !conn->closing &&
+    !conn->awaiting &&
+    http_server_input_pending(conn) &&
+    conn->output_length - conn->output_start <=
+      server->settings.max_pending_output
+    )
+  {
+    status = 0;
+    length = http_server_scan_message(conn, &status);
+    if (status)
+    {
+      http_server_send_error(conn, status);
+      break;
+    }
+    else if (!length)
+      break;
+
+    conn->message_start = conn->input_start;
+    conn->message_end = conn->input_start + length;
+
+    if (!conn->reader)
+      http_server_take_reader(conn);
+    parse_time = server->access_log ? http_wait_now_ns() : 0;
+    message = http_reader_next(conn->reader);
+    if (parse_time)
+      parse_time = http_wait_now_ns() - parse_time;
+
+    conn->input_start += length;
+    conn->scan_offset = 0;
+    conn->headers_complete = false;
+    conn->continued = false;
+    conn->deadline = loop->now +
+      server->reader_settings.header_receive_timeout * 1000ULL;
+
+    if (
+      !message &&
+      http_reader_get_error_code(conn->reader) ==
+        HTTP_READER_ERROR_EXPECT_CONTINUE_REJECTED
+      )
+    {
+      conn->closing = true; /* the reader queued the rejection itself */
+      break;
+    }
+    else if (!message || !http_reader_buffer_is_empty(conn->reader))
+    {
+      status = http_reader_get_status_code(conn->reader);
+      http_server_send_error(
+          conn,
+          status ? status : HTTP_STATUS_CODE_400_BAD_REQUEST
+          );
+      if (message)
+      {
+        http_message_free_content(message);
+        http_message_destroy(message);
+      }
+      break;
+    }
+    else if (http_message_get_type(message) != HTTP_MESSAGE_TYPE_REQUEST)
+    {
+      http_server_send_error(conn, HTTP_STATUS_CODE_400_BAD_REQUEST);
+      http_message_free_content(message);
+      http_message_destroy(message);
+      break;
+    }
+
+    if (
+      server->cache &&
+      http_server_consult_cache(conn, (HTTPRequest *) message, parse_time)
+      )
+      continue;
+
+    http_server_dispatch(conn, (HTTPRequest *) message, parse_time);
+  }
+
+  /* at the end of input, close once what could be answered has been */
+  if (
+    conn->end_of_input &&
+    !conn->awaiting &&
+    conn->output_length - conn->output_start <=
+      server->settings.max_pending_output
+    )
+    conn->closing = true;
+
+  http_server_compact_input(conn);
+}
+
+static void http_server_flush(HTTPServerConnection * conn)
+{
+  ssize_t written;
+
+  while (http_server_output_pending(conn))
+  {
+    written = send(
+        conn->fd,
+        &conn->output[conn->output_start],
+        conn->output_length - conn->output_start,
+        MSG_NOSIGNAL
+        );
+    http_io_count(HTTP_METRIC_BYTES_SENT, written);
+
+    if (written > 0)
+      conn->output_start += written;
+    else if (written < 0 && errno == EINTR)
+      continue;
+    else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return; /* resumed on the next EPOLLOUT edge */
+    else
+    {
+      http_server_close(conn);
+      return;
+    }
+  }
+
+  conn->output_start = 0;
+  conn->output_length = 0;
+
+  if (conn->closing)
+    http_server_close(conn);
+}
+
+static void http_server_receive(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  ssize_t received;
+  size_t limit;
+
+  limit = server->settings.max_header_length +
+          server->settings.max_content_length;
+
+  conn->input_paused = false;
+
+  while (!conn->end_of_input && !conn->closing)
+  {
+    if (conn->input_length - conn->input_start > limit)
+    {
+      http_server_process(conn);
+      if (conn->input_length - conn->input_start > limit)
+      {
+        conn->input_paused = true; /* resumed once output drains */
+        break;
+      }
+    }
+
+    http_server_compact_input(conn);
+    http_server_reserve(
+        loop,
+        &conn->input,
+        &conn->input_capacity,
+        conn->input_length + _HTTP_SERVER_READ_LENGTH
+        );
+
+    received = recv(
+        conn->fd,
+        &conn->input[conn->input_length],
+        conn->input_capacity - conn->input_length,
+        0
+        );
+    http_io_count(HTTP_METRIC_BYTES_RECEIVED, received);
+
+    if (server->capture && received >= 0)
+      http_capture_record(
+          server->capture,
+          conn->capture_connection,
+          &conn->input[conn->input_length],
+          received
+          );
+
+    if (received > 0)
+    {
+      if (!http_server_input_pending(conn))
+        conn->deadline = loop->now +
+          server->reader_settings.header_receive_timeout * 1000ULL;
+      conn->input_length += received;
+    }
+    else if (received == 0)
+      conn->end_of_input = true;
+    else if (errno == EINTR)
+      continue;
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    else
+    {
+      http_server_close(conn);
+      return;
+    }
+  }
+
+  http_server_process(conn);
+}
+
+static void http_server_handle(HTTPServerConnection * conn, uint32_t events)
+{
+  if (events & EPOLLERR)
+  {
+    http_server_close(conn);
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+    http_server_receive(conn);
+
+  while (!conn->closed)
+  {
+    http_server_flush(conn);
+
+    /* once output drains, pick up whatever was held back */
+    if (
+      conn->closed ||
+      http_server_output_pending(conn) ||
+      (!conn->input_paused && !http_server_input_pending(conn)) ||
+      conn->closing
+      )
+      break;
+
+    if (conn->input_paused)
+      http_server_receive(conn);
+    else
+    {
+      http_server_process(conn);
+      if (!http_server_output_pending(conn))
+        break;
+    }
+  }
+
+  http_server_update_timer(conn);
+}
+
+static HTTPServerConnection * http_server_connection_new(
+    HTTPServerLoop * loop,
+    int fd
+    )
+{
+  HTTPServer * server = loop->server;
+  HTTPServerConnection * ret, spare;
+  int one = 1;
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (loop->spare)
+  {
+    spare = *loop->spare;
+    ret = loop->spare;
+    loop->spare = spare.next;
+    loop->spare_count--;
+
+    memset(ret, 0, sizeof(HTTPServerConnection));
+    ret->reader = spare.reader;
+    ret->writer = spare.writer;
+    ret->input = spare.input;
+    ret->input_capacity = spare.input_capacity;
+    ret->output = spare.output;
+    ret->output_capacity = spare.output_capacity;
+  }
+  else
+  {
+    ret = (HTTPServerConnection *) calloc(1, sizeof(HTTPServerConnection));
+    assert(ret);
+  }
+
+  ret->loop = loop;
+  ret->fd = fd;
+  if (server->capture)
+    ret->capture_connection = http_capture_new_connection(server->capture);
+
+  /* with slim_idle, readers and writers are only taken once needed */
+  if (!ret->reader && !server->settings.slim_idle)
+    http_server_take_reader(ret);
+  if (!ret->writer && !server->settings.slim_idle)
+    http_server_take_writer(ret);
+
+  http_timer_init(&ret->timer, http_server_timer_fired, ret);
+
+  ret->next = loop->connections;
+  if (ret->next)
+    ret->next->prev = ret;
+  loop->connections = ret;
+  __atomic_add_fetch(&loop->connection_count, 1, __ATOMIC_RELAXED);
+
+  http_server_update_timer(ret);
+
+  return ret;
+}
+
+/* max_connections is shared evenly between the loops */
+static bool http_server_is_full(HTTPServerLoop * loop)
+{
+  HTTPServer * server = loop->server;
+  uint32_t limit;
+
+  limit = server->settings.max_connections / server->loop_count;
+  if (limit == 0)
+    limit = 1;
+
+  return loop->connection_count >= limit;
+}
+
+static void http_server_ring_recv(HTTPServerConnection * conn);
+
+/* takes on a connection accepted by or for the loop */
+static void http_server_adopt(HTTPServerLoop * loop, int fd)
+{
+  HTTPServerConnection * conn;
+  struct epoll_event event;
+
+  if (http_server_is_full(loop))
+  {
+    close(fd);
+    return;
+  }
+
+  conn = http_server_connection_new(loop, fd);
+
+  if (loop->ring)
+  {
+    http_server_ring_recv(conn);
+    return;
+  }
+
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = conn;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    http_server_close(conn);
+}
+
+/* with a single acceptor, passes the connection to the next loop in turn
+ * and wakes that loop unless it is already due to wake. the acceptor keeps
+ * the connection itself when it is its own turn or the ring is full
+ */
+static void http_server_distribute(HTTPServerLoop * loop, int fd)
+{
+  HTTPServer * server = loop->server;
+  HTTPServerLoop * target;
+
+  if (!server->handing_off || server->loop_count == 1)
+  {
+    http_server_adopt(loop, fd);
+    return;
+  }
+
+  target = &server->loops[loop->next_loop];
+  loop->next_loop = (loop->next_loop + 1) % server->loop_count;
+
+  if (target == loop || !http_spsc_ring_push(target->handoff, fd))
+  {
+    http_server_adopt(loop, fd);
+    return;
+  }
+
+  http_server_loop_wake(target);
+}
+
+static void http_server_accept(HTTPServerLoop * loop)
+{
+  int fd;
+
+  for (;;)
+  {
+    fd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return; /* EAGAIN, or out of descriptors until some close */
+    }
+
+    http_server_distribute(loop, fd);
+  }
+}
+
+
+static void http_server_ring_process(HTTPServerConnection * conn);
+
+/* takes on the connections handed over to the loop, and writes the
+ * responses the workers have finished with
+ */
+static void http_server_loop_complete(HTTPServerLoop * loop)
+{
+  HTTPServerConnection * conn;
+  HTTPResponse * response;
+  HTTPServerJob * job;
+  HTTPMPSCNode * node;
+  uint64_t value;
+
+  while (read(loop->wake_fd, &value, sizeof(value)) > 0)
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+  __atomic_store_n(&loop->wake_pending, false, __ATOMIC_SEQ_CST);
+
+  if (loop->handoff)
+  {
+    while (http_spsc_ring_pop(loop->handoff, &value))
+      http_server_adopt(loop, (int) value);
+  }
+
+  while ((node = http_mpsc_queue_pop(&loop->completed)))
+  {
+    job = (HTTPServerJob *) ((char *) node - offsetof(HTTPServerJob, node));
+    conn = job->conn;
+
+    if (conn->closed)
+    {
+      http_server_job_discard(job);
+      continue;
+    }
+
+    if (job->waiting)
+      http_server_job_resume(job);
+    else
+    {
+      response = http_server_job_end(job);
+      http_server_respond(conn, response);
+    }
+
+    if (loop->ring)
+    {
+      http_server_ring_process(conn);
+      http_server_update_timer(conn);
+    }
+    else
+      http_server_handle(conn, 0);
+  }
+}
+
+
+/* IO_URING BACKEND */
+
+/* the output buffer may not move while a send of it is in flight, so
+ * responses are only rendered between sends. each send covers every
+ * response rendered since the last, so pipelined requests share one
+ */
+static void http_server_ring_send(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+
+  if (conn->closed || conn->sending)
+    return;
+
+  if (http_server_output_pending(conn))
+  {
+    http_uring_send(
+        loop->ring,
+        conn->fd,
+        &conn->output[conn->output_start],
+        conn->output_length - conn->output_start,
+        (uint64_t) (uintptr_t) conn | _HTTP_SERVER_OPERATION_SEND
+        );
+    conn->sending = true;
+    conn->operations++;
+  }
+  else if (conn->closing)
+    http_server_close(conn);
+}
+
+static void http_server_ring_recv(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+  uint64_t user_data;
+
+  if (conn->closed || conn->receiving || conn->end_of_input)
+    return;
+
+  user_data = (uint64_t) (uintptr_t) conn | _HTTP_SERVER_OPERATION_RECV;
+  if (loop->recv_multishot)
+    http_uring_recv_multishot(
+        loop->ring,
+        conn->fd,
+        _HTTP_SERVER_RING_BUFFER_GROUP,
+        user_data
+        );
+  else
+    http_uring_recv(
+        loop->ring,
+        conn->fd,
+        _HTTP_SERVER_RING_BUFFER_GROUP,
+        user_data
+        );
+
+  conn->receiving = true;
+  conn->operations++;
+}
+
+/* answers what is buffered, then resumes receiving if it had paused */
+static void http_server_ring_process(HTTPServerConnection * conn)
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  size_t limit;
+
+  if (conn->closed || conn->sending)
+    return;
+
+  http_server_process(conn);
+
+  limit = server->settings.max_header_length +
+          server->settings.max_content_length;
+
+  if (conn->input_length - conn->input_start > limit)
+  {
+    if (!conn->input_paused && conn->receiving)
+      http_uring_cancel(
+          loop->ring,
+          (uint64_t) (uintptr_t) conn | _HTTP_SERVER_OPERATION_RECV,
+          0
+          );
+    conn->input_paused = true; /* resumed once output drains */
+  }
+  else if (conn->input_paused)
+  {
+    conn->input_paused = false;
+    http_server_ring_recv(conn);
+  }
+
+  http_server_ring_send(conn);
+}
+
+static void http_server_ring_received(
+    HTTPServerConnection * conn,
+    HTTPUringCompletion * completion
+    )
+{
+  HTTPServerLoop * loop = conn->loop;
+  HTTPServer * server = loop->server;
+  uint16_t id;
+
+  if (!http_uring_completion_has_more(completion))
+  {
+    conn->receiving = false;
+    conn->operations--;
+  }
+
+  if (http_uring_completion_has_buffer(completion))
+  {
+    id = http_uring_completion_get_buffer(completion);
+
+    if (!conn->closed && completion->result > 0)
+    {
+      http_metrics_add(HTTP_METRIC_BYTES_RECEIVED, completion->result);
+      if (!http_server_input_pending(conn))
+        conn->deadline = loop->now +
+          server->reader_settings.header_receive_timeout * 1000ULL;
+
+      http_server_compact_input(conn);
+      http_server_reserve(
+          loop,
+          &conn->input,
+          &conn->input_capacity,
+          conn->input_length + completion->result
+          );
+      memcpy(
+          &conn->input[conn->input_length],
+          http_uring_get_buffer(loop->ring, id),
+          completion->result
+          );
+      if (server->capture)
+        http_capture_record(
+            server->capture,
+            conn->capture_connection,
+            &conn->input[conn->input_length],
+            completion->result
+            );
+      conn->input_length += completion->result;
+    }
+
+    http_uring_recycle_buffer(loop->ring, id);
+  }
+
+  if (conn->closed)
+    return;
+
+  if (completion->result == 0)
+  {
+    if (server->capture)
+      http_capture_record(server->capture, conn->capture_connection, NULL, 0);
+    conn->end_of_input = true;
+  }
+  else if (completion->result == -EINVAL && loop->recv_multishot)
+    loop->recv_multishot = false; /* kernel predates multishot recv */
+  else if (
+    completion->result < 0 &&
+    completion->result != -ENOBUFS &&
+    completion->result != -ECANCELED &&
+    completion->result != -EINTR
+    )
+  {
+    http_server_close(conn);
+    return;
+  }
+
+  http_server_ring_process(conn);
+
+  if (!conn->input_paused)
+    http_server_ring_recv(conn);
+
+  http_server_update_timer(conn);
+}
+
+static void http_server_ring_sent(
+    HTTPServerConnection * conn,
+    HTTPUringCompletion * completion
+    )
+{
+  conn->sending = false;
+  conn->operations--;
+
+  if (conn->closed)
+    return;
+
+  if (completion->result < 0)
+  {
+    http_server_close(conn);
+    return;
+  }
+
+  http_metrics_add(HTTP_METRIC_BYTES_SENT, completion->result);
+  conn->output_start += completion->result;
+  if (!http_server_output_pending(conn))
+  {
+    conn->output_start = 0;
+    conn->output_length = 0;
+  }
+
+  http_server_ring_process(conn);
+  http_server_update_timer(conn);
+}
+
+static void http_server_ring_accepted(
+    HTTPServerLoop * loop,
+    HTTPUringCompletion * completion
+    )
+{
+  if (!http_uring_completion_has_more(completion))
+    http_uring_accept_multishot(
+        loop->ring,
+        loop->listen_fd,
+        (uint64_t) (uintptr_t) &loop->listen_fd
+        );
+
+  if (completion->result < 0)
+    return;
+
+  http_server_distribute(loop, completion->result);
+}
+
+static void http_server_ring_complete(
+    HTTPServerLoop * loop,
+    HTTPUringCompletion * completion
+    )
+{
+  HTTPServerConnection * conn;
+  uint64_t value;
+
+  if (completion->user_data == 0)
+    return; /* a cancellation */
+  else if (completion->user_data == (uint64_t) (uintptr_t) &loop->listen_fd)
+    http_server_ring_accepted(loop, completion);
+  else if (completion->user_data == (uint64_t) (uintptr_t) &loop->stop_fd)
+  {
+    while (read(loop->stop_fd, &value, sizeof(value)) > 0)
+      ;
+    loop->running = false;
+  }
+  else if (completion->user_data == (uint64_t) (uintptr_t) &loop->wake_fd)
+  {
+    http_uring_poll(
+        loop->ring,
+        loop->wake_fd,
+        POLLIN,
+        (uint64_t) (uintptr_t) &loop->wake_fd
+        );
+    http_server_loop_complete(loop);
+  }
+  else
+  {
+    conn = (HTTPServerConnection *) (uintptr_t)
+      (completion->user_data & ~(uint64_t) _HTTP_SERVER_OPERATION_MASK);
+
+    switch (completion->user_data & _HTTP_SERVER_OPERATION_MASK)
+    {
+      case _HTTP_SERVER_OPERATION_RECV:
+        http_server_ring_received(conn, completion);
+        break;
+      case _HTTP_SERVER_OPERATION_SEND:
+        http_server_ring_sent(conn, completion);
+        break;
+      default:
+        assert(0);
+    }
+  }
+}
+
+/* every submission and wait of an iteration is one system call */
+static bool http_server_ring_run(HTTPServerLoop * loop)
+{
+  HTTPUringCompletion completion;
+
+  if (!http_uring_enable(loop->ring))
+  {
+    http_server_loop_fail(loop, "failed to enable io_uring");
+    loop->running = false;
+    return false;
+  }
+
+  if (!loop->accepting && loop->listen_fd >= 0)
+    http_uring_accept_multishot(
+        loop->ring,
+        loop->listen_fd,
+        (uint64_t) (uintptr_t) &loop->listen_fd
+        );
+  loop->accepting = true;
+
+  http_uring_poll(
+      loop->ring,
+      loop->stop_fd,
+      POLLIN,
+      (uint64_t) (uintptr_t) &loop->stop_fd
+      );
+  http_uring_poll(
+      loop->ring,
+      loop->wake_fd,
+      POLLIN,
+      (uint64_t) (uintptr_t) &loop->wake_fd
+      );
+
+  while (loop->running)
+  {
+    if (
+      http_uring_submit_and_wait(
+          loop->ring,
+          http_timer_wheel_next_timeout(loop->timer_wheel)
+          ) < 0
+      )
+    {
+      http_server_loop_fail(loop, "event loop failed");
+      loop->running = false;
+      return false;
+    }
+
+    loop->now = http_wait_now();
+
+    while (http_uring_next_completion(loop->ring, &completion))
+      http_server_ring_complete(loop, &completion);
+
+    http_timer_wheel_advance(loop->timer_wheel, loop->now);
+    http_server_free_closed(loop, false);
+  }
+
+  return true;
+}
+
+/* waits out the cancellation of closed connections' operations, so none
+ * outlives the buffers it refers to
+ */
+static void http_server_ring_drain(HTTPServerLoop * loop)
+{
+  HTTPUringCompletion completion;
+  HTTPServerConnection * conn;
+
+  for (;;)
+  {
+    for (conn = loop->closed; conn && !conn->operations; conn = conn->next)
+      ;
+    if (!conn || http_uring_submit_and_wait(loop->ring, -1) < 0)
+      return;
+
+    while (http_uring_next_completion(loop->ring, &completion))
+    {
+      if (
+        completion.user_data != (uint64_t) (uintptr_t) &loop->listen_fd &&
+        completion.user_data != (uint64_t) (uintptr_t) &loop->stop_fd &&
+        completion.user_data != (uint64_t) (uintptr_t) &loop->wake_fd
+        )
+        http_server_ring_complete(loop, &completion);
+    }
+  }
+}
+
+/* uses io_uring when the kernel has everything the backend relies upon */
+static bool http_server_ring_open(HTTPServerLoop * loop)
+{
+  loop->ring = http_uring_new(_HTTP_SERVER_RING_ENTRIES);
+  if (!loop->ring)
+    return false;
+
+  if (
+    !http_uring_setup_buffers(
+        loop->ring,
+        _HTTP_SERVER_RING_BUFFER_GROUP,
+        _HTTP_SERVER_RING_BUFFER_COUNT,
+        _HTTP_SERVER_READ_LENGTH
+        )
+    )
+  {
+    http_uring_destroy(loop->ring);
+    loop->ring = NULL;
+    return false;
+  }
+
+  loop->recv_multishot = true;
+
+  return true;
+}
+
+
+/* EVENT LOOPS */
+
+static void http_server_loop_init(HTTPServerLoop * loop, HTTPServer * server)
+{
+  memset(loop, 0, sizeof(HTTPServerLoop));
+
+  loop->server = server;
+  loop->listen_fd = -1;
+  loop->epoll_fd = -1;
+  loop->stop_fd = -1;
+  loop->wake_fd = -1;
+  http_mpsc_queue_init(&loop->completed);
+  loop->now = http_wait_now();
+  loop->timer_wheel = http_timer_wheel_new(_HTTP_SERVER_TIMER_RESOLUTION);
+}
+
+/* ends the jobs returned to the loop. ending a flight returns the jobs
+ * which waited on it, to any loop; false if there were none
+ */
+static bool http_server_loop_discard_completed(HTTPServerLoop * loop)
+{
+  HTTPServerJob * job;
+  HTTPMPSCNode * node;
+  bool ret = false;
+
+  while ((node = http_mpsc_queue_pop(&loop->completed)))
+  {
+    job = (HTTPServerJob *) ((char *) node - offsetof(HTTPServerJob, node));
+    http_server_job_discard(job);
+    ret = true;
+  }
+
+  return ret;
+}
+
+static void http_server_loop_deinit(HTTPServerLoop * loop)
+{
+  HTTPServerConnection * conn;
+  uint64_t value;
+
+  /* the workers are gone by now (and every handle completed); their last
+   * jobs still refer to connections
+   */
+  http_server_loop_discard_completed(loop);
+
+  while (loop->connections)
+    http_server_close(loop->connections);
+
+  if (loop->ring)
+  {
+    http_server_ring_drain(loop);
+    http_uring_destroy(loop->ring);
+  }
+  http_server_free_closed(loop, true);
+
+  while (loop->spare)
+  {
+    conn = loop->spare;
+    loop->spare = conn->next;
+    http_server_connection_free(conn);
+  }
+
+  while (loop->idle_reader_count)
+    http_reader_destroy(loop->idle_readers[--loop->idle_reader_count]);
+  while (loop->idle_writer_count)
+    http_writer_destroy(loop->idle_writers[--loop->idle_writer_count]);
+  while (loop->idle_buffer_count)
+    free(loop->idle_buffers[--loop->idle_buffer_count]);
+
+  if (loop->handoff)
+  {
+    while (http_spsc_ring_pop(loop->handoff, &value))
+      close((int) value);
+    http_spsc_ring_destroy(loop->handoff);
+  }
+
+  if (loop->listen_fd >= 0)
+    close(loop->listen_fd);
+  if (loop->epoll_fd >= 0)
+    close(loop->epoll_fd);
+  if (loop->stop_fd >= 0)
+    close(loop->stop_fd);
+  if (loop->wake_fd >= 0)
+    close(loop->wake_fd);
+
+  http_timer_wheel_destroy(loop->timer_wheel);
+}
+
+/* fills the loop's spare connections ahead of time, so that taking on a
+ * connection handed over by the acceptor allocates nothing
+ */
+static void http_server_loop_prepare(HTTPServerLoop * loop)
+{
+  HTTPServer * server = loop->server;
+  HTTPServerConnection * conn;
+
+  while (loop->spare_count < _HTTP_SERVER_SPARE_COUNT)
+  {
+    conn = (HTTPServerConnection *) calloc(1, sizeof(HTTPServerConnection));
+    assert(conn);
+
+    conn->reader = http_reader_new(-1);
+    http_reader_set_settings(conn->reader, server->reader_settings);
+    http_reader_set_read_function(conn->reader, http_server_read_message, conn);
+    http_reader_set_write_function(
+        conn->reader,
+        http_server_write_interim,
+        conn
+        );
+    conn->writer = http_writer_new();
+    http_writer_set_write_function(
+        conn->writer,
+        http_server_write_output,
+        conn
+        );
+
+    conn->next = loop->spare;
+    loop->spare = conn;
+    loop->spare_count++;
+  }
+}
+
+/* binds the loop's own listening socket to `address' */
+static bool http_server_loop_bind(
+    HTTPServerLoop * loop,
+    struct sockaddr * address,
+    socklen_t address_length
+    )
+{
+  HTTPServer * server = loop->server;
+  int one = 1;
+
+  loop->listen_fd = socket(
+      address->sa_family,
+      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+      0
+      );
+  if (loop->listen_fd < 0)
+  {
+    http_server_fail(server, "failed to create listen socket");
+    return false;
+  }
+
+  setsockopt(loop->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (
+    server->loop_count > 1 && !server->handing_off &&
+    setsockopt(loop->listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))
+    )
+  {
+    http_server_fail(server, "failed to share listen port");
+    return false;
+  }
+
+  if (
+    bind(loop->listen_fd, address, address_length) != 0 ||
+    listen(loop->listen_fd, server->settings.backlog) != 0
+    )
+  {
+    http_server_fail(server, "failed to bind listen socket");
+    return false;
+  }
+
+  return true;
+}
+
+/* binds the loop's own listening socket to `address' (or, when that is
+ * NULL, readies the loop to be handed connections instead) and readies the
+ * server's backend for it
+ */
+static bool http_server_loop_open(
+    HTTPServerLoop * loop,
+    struct sockaddr * address,
+    socklen_t address_length
+    )
+{
+  HTTPServer * server = loop->server;
+  struct epoll_event event;
+
+  if (server->handing_off)
+    http_server_loop_prepare(loop);
+
+  if (!address)
+    loop->handoff = http_spsc_ring_new(_HTTP_SERVER_HANDOFF_LENGTH);
+  else if (!http_server_loop_bind(loop, address, address_length))
+    return false;
+
+  loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->stop_fd < 0 || loop->wake_fd < 0)
+  {
+    http_server_fail(server, "failed to create event loop");
+    return false;
+  }
+
+  /* AUTO keeps loops sharing the port on epoll rather than hand their
+   * connections over from one acceptor, as io_uring would need to
+   */
+  if (
+    server->backend == HTTP_SERVER_BACKEND_AUTO &&
+    server->loop_count > 1 && !server->handing_off
+    )
+    server->backend = HTTP_SERVER_BACKEND_EPOLL;
+
+  if (server->backend != HTTP_SERVER_BACKEND_EPOLL)
+  {
+    if (http_server_ring_open(loop))
+    {
+      server->backend = HTTP_SERVER_BACKEND_IO_URING;
+      return true;
+    }
+    else if (server->backend == HTTP_SERVER_BACKEND_IO_URING)
+    {
+      http_server_fail(server, "io_uring is unavailable");
+      return false;
+    }
+  }
+
+  server->backend = HTTP_SERVER_BACKEND_EPOLL;
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0)
+  {
+    http_server_fail(server, "failed to create event loop");
+    return false;
+  }
+
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &loop->listen_fd;
+  if (
+    loop->listen_fd >= 0 &&
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &event) < 0
+    )
+  {
+    http_server_fail(server, "failed to watch listen socket");
+    return false;
+  }
+
+  event.events = EPOLLIN;
+  event.data.ptr = &loop->stop_fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &event) < 0)
+  {
+    http_server_fail(server, "failed to watch stop descriptor");
+    return false;
+  }
+
+  event.events = EPOLLIN;
+  event.data.ptr = &loop->wake_fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) < 0)
+  {
+    http_server_fail(server, "failed to watch wake descriptor");
+    return false;
+  }
+
+  return true;
+}
+
+/* pins the calling thread to the loop's share of the allowed CPUs */
+static void http_server_loop_pin(HTTPServerLoop * loop)
+{
+  cpu_set_t allowed, pinned;
+  uint32_t k, cpu, count;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+
+  count = CPU_COUNT(&allowed);
+  if (count == 0)
+    return;
+
+  for (k = 0, cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+
+    if (k++ == loop->index % count)
+      break;
+  }
+
+  CPU_ZERO(&pinned);
+  CPU_SET(cpu, &pinned);
+  pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+}
+
+static bool http_server_loop_run(HTTPServerLoop * loop)
+{
+  struct epoll_event events [_HTTP_SERVER_EVENT_COUNT];
+  uint64_t value;
+  int count;
+
+  if (loop->server->settings.pin_threads)
+    http_server_loop_pin(loop);
+
+  loop->running = true;
+
+  if (loop->ring)
+    return http_server_ring_run(loop);
+
+  while (loop->running)
+  {
+    count = epoll_wait(
+        loop->epoll_fd,
+        events,
+        _HTTP_SERVER_EVENT_COUNT,
+        http_timer_wheel_next_timeout(loop->timer_wheel)
+        );
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      http_server_loop_fail(loop, "event loop failed");
+      loop->running = false;
+      return false;
+    }
+
+    loop->now = http_wait_now();
+
+    for (int k = 0; k < count; k++)
+    {
+      if (events[k].data.ptr == &loop->listen_fd)
+        http_server_accept(loop);
+      else if (events[k].data.ptr == &loop->stop_fd)
+      {
+        while (read(loop->stop_fd, &value, sizeof(value)) > 0)
+          ;
+        loop->running = false;
+      }
+      else if (events[k].data.ptr == &loop->wake_fd)
+        http_server_loop_complete(loop);
+      else
+        http_server_handle(
+            (HTTPServerConnection *) events[k].data.ptr,
+            events[k].events
+            );
+    }
+
+    http_timer_wheel_advance(loop->timer_wheel, loop->now);
+    http_server_free_closed(loop, false);
+  }
+
+  return true;
+}
+
+static void * http_server_loop_thread(void * context)
+{
+  HTTPServerLoop * loop = (HTTPServerLoop *) context;
+
+  http_server_loop_run(loop);
+
+  /* one loop failing stops the rest, so http_server_run can report it */
+  if (loop->error)
+    http_server_stop(loop->server);
+
+  return NULL;
+}
+
+static void http_server_make_loops(HTTPServer * server)
+{
+  long cpus;
+  uint32_t k;
+
+  server->loop_count = server->settings.thread_count;
+  if (server->loop_count == 0)
+  {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    server->loop_count = cpus > 0 ? cpus : 1;
+  }
+
+  server->loops = (HTTPServerLoop *)
+    malloc(sizeof(HTTPServerLoop) * server->loop_count);
+  assert(server->loops);
+
+  for (k = 0; k < server->loop_count; k++)
+  {
+    http_server_loop_init(&server->loops[k], server);
+    server->loops[k].index = k;
+  }
+}
+
+/* opens the loops after the first (which settled the address) */
+static bool http_server_open_loops(HTTPServer * server)
+{
+  struct sockaddr_storage bound;
+  socklen_t bound_length;
+  uint32_t k;
+
+  bound_length = sizeof(bound);
+  getsockname(
+      server->loops[0].listen_fd,
+      (struct sockaddr *) &bound,
+      &bound_length
+      );
+
+  for (k = 1; k < server->loop_count; k++)
+  {
+    if (
+      !http_server_loop_open(
+          &server->loops[k],
+          server->handing_off ? NULL : (struct sockaddr *) &bound,
+          bound_length
+          )
+      )
+      return false;
+  }
+
+  return true;
+}
+
+static HTTPServer * http_server_new_with(
+    HTTPServerHandler handler,
+    HTTPServerAsyncHandler async_handler,
+    void * context
+    )
+{
+  HTTPServer * ret;
+
+  ret = (HTTPServer *) malloc(sizeof(HTTPServer));
+  assert(ret);
+
+  ret->handler = handler;
+  ret->async_handler = async_handler;
+  ret->context = context;
+
+  ret->settings = http_server_get_default_settings();
+  ret->reader_settings = http_reader_get_default_settings();
+
+  ret->backend = HTTP_SERVER_BACKEND_AUTO;
+  ret->capture = NULL;
+  ret->access_log = NULL;
+  ret->cache = NULL;
+  ret->loops = NULL;
+  ret->loop_count = 0;
+  ret->handing_off = false;
+  ret->workers = NULL;
+
+  ret->error = NULL;
+  ret->error_number = 0;
+
+  return ret;
+}
+
+
+HTTPServerSettings http_server_get_default_settings(void)
+{
+  HTTPServerSettings ret;
+
+  ret.backlog = SOMAXCONN;
+  ret.max_connections = 0x10000;
+  ret.max_header_length = 0x10000;
+  ret.max_content_length = 0x100000;
+  ret.max_pending_output = 0x100000;
+  ret.write_timeout = 30;
+  ret.thread_count = 1;
+  ret.worker_count = 0;
+  ret.pin_threads = false;
+  ret.single_acceptor = false;
+  ret.slim_idle = false;
+
+  return ret;
+}
+
+
+HTTPServer * http_server_new(HTTPServerHandler handler, void * context)
+{
+  assert(handler);
+
+  return http_server_new_with(handler, NULL, context);
+}
+
+HTTPServer * http_server_new_async(
+    HTTPServerAsyncHandler handler,
+    void * context
+    )
+{
+  assert(handler);
+
+  return http_server_new_with(NULL, handler, context);
+}
+
+void http_server_destroy(HTTPServer * server)
+{
+  bool discarded;
+
+  assert(server);
+
+  /* every job first, as those of one loop may wait on another's */
+  do
+  {
+    discarded = false;
+    for (uint32_t k = 0; k < server->loop_count; k++)
+    {
+      if (http_server_loop_discard_completed(&server->loops[k]))
+        discarded = true;
+    }
+  }
+  while (discarded);
+
+  for (uint32_t k = 0; k < server->loop_count; k++)
+    http_server_loop_deinit(&server->loops[k]);
+  free(server->loops);
+
+  free(server);
+}
+
+void http_server_set_settings(HTTPServer * server, HTTPServerSettings settings)
+{
+  assert(server);
+
+  server->settings = settings;
+}
+void http_server_set_reader_settings(
+    HTTPServer * server,
+    HTTPReaderSettings settings
+    )
+{
+  assert(server);
+
+  server->reader_settings = settings;
+}
+
+/* must be called before http_server_listen */
+void http_server_set_backend(HTTPServer * server, HTTPServerBackend backend)
+{
+  assert(server);
+  assert(!server->loops);
+
+  server->backend = backend;
+}
+
+/* records the bytes received on every connection accepted from now on.
+ * `capture' must outlive the server
+ */
+void http_server_set_capture(HTTPServer * server, HTTPCapture * capture)
+{
+  assert(server);
+  assert(!server->loops);
+
+  server->capture = capture;
+}
+
+/* records a line for every response sent from now on. `log' must outlive
+ * the server
+ */
+void http_server_set_access_log(HTTPServer * server, HTTPAccessLog * log)
+{
+  assert(server);
+  assert(!server->loops);
+
+  server->access_log = log;
+}
+
+/* answers requests from `cache' where it can, and fills it with the
+ * responses it may keep. `cache' must outlive the server, and may be
+ * shared between servers
+ */
+void http_server_set_cache(HTTPServer * server, HTTPCache * cache)
+{
+  assert(server);
+  assert(!server->loops);
+
+  server->cache = cache;
+}
+
+/* once listening, reports the backend AUTO settled upon */
+HTTPServerBackend http_server_get_backend(HTTPServer * server)
+{
+  assert(server);
+  return server->backend;
+}
+
+bool http_server_has_error(HTTPServer * server)
+{
+  assert(server);
+  return server->error != NULL;
+}
+char * http_server_get_error(HTTPServer * server)
+{
+  assert(server);
+
+  if (!server->error)
+    return NULL;
+  else if (server->error_number)
+    return strings_format(
+        "%s: %s",
+        server->error,
+        errors_get_errno_name(server->error_number)
+        );
+  else
+    return strings_clone(server->error);
+}
+int http_server_get_errno(HTTPServer * server)
+{
+  assert(server);
+  return server->error_number;
+}
+
+/* binds and listens on `address' (NULL for any) and `port' with one socket
+ * per event loop (or only the first's, with a single acceptor), and
+ * readies the loops. must be called before http_server_run
+ */
+bool http_server_listen(HTTPServer * server, char * address, uint16_t port)
+{
+  struct addrinfo hints, * addresses, * ai;
+  char port_string [8];
+
+  assert(server);
+  assert(!server->loops);
+
+  http_server_make_loops(server);
+
+  /* connections to io_uring loops sharing the port through SO_REUSEPORT
+   * have been seen reset, so io_uring loops always share one acceptor
+   */
+  server->handing_off =
+    server->settings.single_acceptor || (
+      server->backend == HTTP_SERVER_BACKEND_IO_URING &&
+      server->loop_count > 1
+      );
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  snprintf(port_string, sizeof(port_string), "%u", (unsigned int) port);
+
+  errno = 0;
+  if (getaddrinfo(address, port_string, &hints, &addresses) != 0)
+  {
+    http_server_fail(server, "failed to resolve listen address");
+    return false;
+  }
+
+  /* the first loop settles the address (and, for port 0, the port) */
+  for (ai = addresses; ai; ai = ai->ai_next)
+  {
+    if (http_server_loop_open(&server->loops[0], ai->ai_addr, ai->ai_addrlen))
+      break;
+
+    http_server_loop_deinit(&server->loops[0]);
+    http_server_loop_init(&server->loops[0], server);
+  }
+
+  freeaddrinfo(addresses);
+
+  if (!ai)
+    return false;
+
+  server->error = NULL;
+  server->error_number = 0;
+
+  return http_server_open_loops(server);
+}
+
+/* as http_server_listen, on the unix domain socket at `path' (which must
+ * not exist yet). a path cannot be shared, so the first loop accepts for
+ * all of them
+ */
+bool http_server_listen_unix(HTTPServer * server, char * path)
+{
+  struct sockaddr_un address;
+
+  assert(server);
+  assert(path);
+  assert(!server->loops);
+
+  server->handing_off = true;
+  http_server_make_loops(server);
+
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    http_server_fail(server, "unix socket path is too long");
+    return false;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  if (
+    !http_server_loop_open(
+        &server->loops[0],
+        (struct sockaddr *) &address,
+        sizeof(address)
+        )
+    )
+    return false;
+
+  return http_server_open_loops(server);
+}
+
+/* runs the first event loop on the calling thread, and the others on
+ * threads of their own, until http_server_stop
+ */
+bool http_server_run(HTTPServer * server)
+{
+  HTTPServerLoop * loop;
+  uint32_t k, started;
+
+  assert(server);
+  assert(server->loops);
+
+  server->error = NULL;
+  server->error_number = 0;
+
+  if (server->settings.worker_count)
+    server->workers = http_worker_pool_new(server->settings.worker_count);
+
+  for (started = 1; started < server->loop_count; started++)
+  {
+    loop = &server->loops[started];
+    if (pthread_create(&loop->thread, NULL, http_server_loop_thread, loop))
+    {
+      http_server_fail(server, "failed to start event loop thread");
+      http_server_stop(server);
+      break;
+    }
+  }
+
+  http_server_loop_thread(&server->loops[0]);
+
+  for (k = 1; k < started; k++)
+    pthread_join(server->loops[k].thread, NULL);
+
+  /* lets the handlers in progress finish; their responses are dropped */
+  if (server->workers)
+  {
+    http_worker_pool_destroy(server->workers);
+    server->workers = NULL;
+  }
+
+  for (k = 0; k < server->loop_count && !server->error; k++)
+  {
+    if (server->loops[k].error)
+    {
+      server->error = server->loops[k].error;
+      server->error_number = server->loops[k].error_number;
+    }
+  }
+
+  return !server->error;
+}
+
+/* safe to call from any thread (or a signal handler) */
+void http_server_stop(HTTPServer * server)
+{
+  uint64_t value = 1;
+
+  assert(server);
+
+  for (uint32_t k = 0; k < server->loop_count; k++)
+  {
+    if (server->loops[k].stop_fd >= 0)
+      (void) !write(server->loops[k].stop_fd, &value, sizeof(value));
+  }
+}
+
+/* from any thread, once per handle */
+void http_request_complete(HTTPRequestHandle * handle, HTTPResponse * response)
+{
+  uint32_t expected = _HTTP_SERVER_JOB_DISPATCHING;
+
+  assert(handle);
+
+  handle->response = response;
+
+  /* the thread calling the handler is still in it, and responds */
+  if (
+    __atomic_compare_exchange_n(
+        &handle->state,
+        &expected,
+        _HTTP_SERVER_JOB_COMPLETE,
+        false,
+        __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE
+        )
+    )
+    return;
+
+  assert(expected == _HTTP_SERVER_JOB_WAITING);
+  __atomic_store_n(&handle->state, _HTTP_SERVER_JOB_COMPLETE, __ATOMIC_RELAXED);
+  http_server_job_return(handle);
+}
+
+uint32_t http_server_get_connection_count(HTTPServer * server)
+{
+  uint32_t ret = 0;
+
+  assert(server);
+
+  for (uint32_t k = 0; k < server->loop_count; k++)
+    ret += __atomic_load_n(
+        &server->loops[k].connection_count,
+        __ATOMIC_RELAXED
+        );
+
+  return ret;
+}
+
@@ -0,0 +1,115 @@
+
+
+#ifndef __CHTTP_HTTP_SERVER_H
+#define __CHTTP_HTTP_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http_access_log.h"
+#include "http_cache.h"
+#include "http_capture.h"
+#include "http_status_code.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "http_reader.h"
+
+
+struct HTTPServer;
+typedef struct HTTPServer HTTPServer;
+
+/* called for every complete request: on its event loop's thread or, with
+ * worker threads, on one of those (so possibly concurrently). the request
+ * is destroyed once the handler returns. the returned response (including
+ * its content data) becomes the server's; returning NULL sends a 500
+ */
+typedef HTTPResponse * (*HTTPServerHandler)(
+    HTTPRequest * request,
+    void * context
+    );
+
+struct HTTPRequestHandle;
+typedef struct HTTPRequestHandle HTTPRequestHandle;
+
+/* the handler of a server made with http_server_new_async. it responds
+ * whenever it likes, from any thread, by completing `handle' (possibly
+ * before returning). until then the request stays valid and its
+ * connection is parked: later pipelined requests wait their turn, so
+ * responses still go out in order. every handle must be completed before
+ * the server is destroyed
+ */
+typedef void (*HTTPServerAsyncHandler)(
+    HTTPRequest * request,
+    HTTPRequestHandle * handle,
+    void * context
+    );
+
+/* the system interface the event loop is built upon. AUTO uses io_uring
+ * where the running kernel supports it and epoll otherwise, and epoll
+ * whenever several loops share the listening port. several io_uring loops
+ * never share it: the first accepts for them all, as with single_acceptor
+ */
+enum HTTPServerBackend
+{
+  HTTP_SERVER_BACKEND_AUTO = 0,
+  HTTP_SERVER_BACKEND_EPOLL = 1,
+  HTTP_SERVER_BACKEND_IO_URING = 2,
+};
+typedef enum HTTPServerBackend HTTPServerBackend;
+
+struct HTTPServerSettings
+{
+  int backlog;
+  uint32_t
+    max_connections, /* shared evenly between the event loops */
+    max_header_length, /* of the start line and headers together */
+    max_content_length,
+    max_pending_output, /* stop reading while more than this is unsent */
+    write_timeout, /* in seconds */
+    thread_count, /* event loops, each on a thread; 0 for one per CPU */
+    worker_count; /* handler threads; 0 runs handlers on the event loops */
+  bool
+    pin_threads, /* pin each loop's thread to a CPU of its own */
+    single_acceptor, /* the first loop accepts for all and hands over */
+    slim_idle; /* idle connections lend their reader, writer and buffers */
+};
+typedef struct HTTPServerSettings HTTPServerSettings;
+
+
+HTTPServerSettings http_server_get_default_settings(void);
+
+HTTPServer * http_server_new(HTTPServerHandler handler, void * context);
+HTTPServer * http_server_new_async(
+    HTTPServerAsyncHandler handler,
+    void * context
+    );
+void http_server_destroy(HTTPServer * server);
+
+void http_server_set_settings(HTTPServer * server, HTTPServerSettings settings);
+void http_server_set_reader_settings(
+    HTTPServer * server,
+    HTTPReaderSettings settings
+    );
+void http_server_set_backend(HTTPServer * server, HTTPServerBackend backend);
+HTTPServerBackend http_server_get_backend(HTTPServer * server);
+void http_server_set_capture(HTTPServer * server, HTTPCapture * capture);
+void http_server_set_access_log(HTTPServer * server, HTTPAccessLog * log);
+void http_server_set_cache(HTTPServer * server, HTTPCache * cache);
+
+bool http_server_has_error(HTTPServer * server);
+char * http_server_get_error(HTTPServer * server);
+int http_server_get_errno(HTTPServer * server);
+
+bool http_server_listen(HTTPServer * server, char * address, uint16_t port);
+bool http_server_listen_unix(HTTPServer * server, char * path);
+bool http_server_run(HTTPServer * server);
+void http_server_stop(HTTPServer * server);
+
+uint32_t http_server_get_connection_count(HTTPServer * server);
+
+/* the response (NULL sends a 500) becomes the server's */
+void http_request_complete(HTTPRequestHandle * handle, HTTPResponse * response);
+
+
+#endif
+
@@ -0,0 +1,121 @@
+
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "http_spsc_ring.h"
+
+
+#define _HTTP_SPSC_RING_CACHE_LINE 64
+
+
+/* the producer owns `tail' and the consumer `head', each on a cache line
+ * of its own. each side also keeps the last value it read of the other's
+ * index, so it only touches the other's cache line when that copy says
+ * the ring is full (or empty)
+ */
+struct HTTPSPSCRing
+{
+  uint64_t * values;
+  uint32_t mask;
+
+  _Alignas(_HTTP_SPSC_RING_CACHE_LINE) uint32_t head;
+  uint32_t cached_tail; /* the consumer's copy */
+
+  _Alignas(_HTTP_SPSC_RING_CACHE_LINE) uint32_t tail;
+  uint32_t cached_head; /* the producer's copy */
+};
+
+
+HTTPSPSCRing * http_spsc_ring_new(uint32_t capacity)
+{
+  HTTPSPSCRing * ret;
+  uint32_t size = 1;
+
+  assert(capacity > 0 && capacity <= 0x80000000);
+
+  while (size < capacity)
+    size <<= 1;
+
+  ret = (HTTPSPSCRing *) aligned_alloc(
+      _HTTP_SPSC_RING_CACHE_LINE,
+      sizeof(HTTPSPSCRing)
+      );
+  assert(ret);
+
+  ret->values = (uint64_t *) malloc(sizeof(uint64_t) * size);
+  assert(ret->values);
+
+  ret->mask = size - 1;
+  ret->head = 0;
+  ret->cached_tail = 0;
+  ret->tail = 0;
+  ret->cached_head = 0;
+
+  return ret;
+}
+
+void http_spsc_ring_destroy(HTTPSPSCRing * ring)
+{
+  assert(ring);
+
+  free(ring->values);
+  free(ring);
+}
+
+uint32_t http_spsc_ring_get_capacity(HTTPSPSCRing * ring)
+{
+  assert(ring);
+
+  return ring->mask + 1;
+}
+
+bool http_spsc_ring_push(HTTPSPSCRing * ring, uint64_t value)
+{
+  uint32_t tail;
+
+  assert(ring);
+
+  tail = ring->tail;
+  if (tail - ring->cached_head > ring->mask)
+  {
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - ring->cached_head > ring->mask)
+      return false;
+  }
+
+  ring->values[tail & ring->mask] = value;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+bool http_spsc_ring_pop(HTTPSPSCRing * ring, uint64_t * value)
+{
+  uint32_t head;
+
+  assert(ring);
+  assert(value);
+
+  head = ring->head;
+  if (head == ring->cached_tail)
+  {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == ring->cached_tail)
+      return false;
+  }
+
+  *value = ring->values[head & ring->mask];
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+bool http_spsc_ring_is_empty(HTTPSPSCRing * ring)
+{
+  assert(ring);
+
+  return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,30 @@
+
+
+#ifndef __CHTTP_HTTP_SPSC_RING_H
+#define __CHTTP_HTTP_SPSC_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+struct HTTPSPSCRing;
+typedef struct HTTPSPSCRing HTTPSPSCRing;
+
+
+/* a bounded lock-free ring of values which one thread pushes onto and one
+ * thread pops from. `capacity' is rounded up to a power of two
+ */
+HTTPSPSCRing * http_spsc_ring_new(uint32_t capacity);
+void http_spsc_ring_destroy(HTTPSPSCRing * ring);
+
+uint32_t http_spsc_ring_get_capacity(HTTPSPSCRing * ring);
+
+/* producer only; false if the ring is full */
+bool http_spsc_ring_push(HTTPSPSCRing * ring, uint64_t value);
+
+/* consumer only; false if the ring is empty */
+bool http_spsc_ring_pop(HTTPSPSCRing * ring, uint64_t * value);
+bool http_spsc_ring_is_empty(HTTPSPSCRing * ring);
+
+
+#endif
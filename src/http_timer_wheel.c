@@ -0,0 +1,301 @@
+
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "http_wait.h"
+
+#include "http_timer_wheel.h"
+
+
+/* four levels of 64 slots: with a 1ms resolution the wheel spans about
+ * 4.6 hours; later deadlines park in the top level and are re-placed as
+ * the wheel turns
+ */
+#define _HTTP_TIMER_WHEEL_LEVELS 4
+#define _HTTP_TIMER_WHEEL_BITS 6
+#define _HTTP_TIMER_WHEEL_SLOTS (1 << _HTTP_TIMER_WHEEL_BITS)
+#define _HTTP_TIMER_WHEEL_MASK (_HTTP_TIMER_WHEEL_SLOTS - 1)
+#define _HTTP_TIMER_WHEEL_SPAN \
+        (1ULL << (_HTTP_TIMER_WHEEL_LEVELS * _HTTP_TIMER_WHEEL_BITS))
+
+
+struct HTTPTimerWheel
+{
+  uint32_t resolution;
+  uint64_t current; /* last processed tick */
+  size_t size;
+  HTTPTimer slots [_HTTP_TIMER_WHEEL_LEVELS][_HTTP_TIMER_WHEEL_SLOTS];
+};
+
+
+static void http_timer_wheel_link(HTTPTimer * head, HTTPTimer * timer)
+{
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+static void http_timer_unlink(HTTPTimer * timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+static uint64_t http_timer_wheel_tick_of(
+    HTTPTimerWheel * wheel,
+    uint64_t deadline
+    )
+{
+  return (deadline + wheel->resolution - 1) / wheel->resolution;
+}
+
+/* puts `timer' in the slot of its tick, or of `earliest' if that is later.
+ * a cascade happens before the slot of the current tick fires, so timers
+ * cascading on the very tick they are due may still be placed in it
+ */
+static void http_timer_wheel_place(
+    HTTPTimerWheel * wheel,
+    HTTPTimer * timer,
+    uint64_t earliest
+    )
+{
+  uint64_t tick, delta;
+  unsigned int level, slot;
+
+  tick = http_timer_wheel_tick_of(wheel, timer->deadline);
+  if (tick < earliest)
+    tick = earliest;
+
+  delta = tick - wheel->current;
+  if (delta >= _HTTP_TIMER_WHEEL_SPAN)
+  {
+    delta = _HTTP_TIMER_WHEEL_SPAN - 1;
+    tick = wheel->current + delta;
+  }
+
+  for (level = 0; level < _HTTP_TIMER_WHEEL_LEVELS - 1; level++)
+  {
+    if (delta < 1ULL << ((level + 1) * _HTTP_TIMER_WHEEL_BITS))
+      break;
+  }
+
+  slot = (tick >> (level * _HTTP_TIMER_WHEEL_BITS)) & _HTTP_TIMER_WHEEL_MASK;
+  http_timer_wheel_link(&wheel->slots[level][slot], timer);
+}
+
+/* moves the timers of one higher-level slot down to where they belong now */
+static void http_timer_wheel_cascade(
+    HTTPTimerWheel * wheel,
+    unsigned int level,
+    unsigned int slot
+    )
+{
+  HTTPTimer pending, * head, * timer;
+
+  head = &wheel->slots[level][slot];
+  if (head->next == head)
+    return;
+
+  pending.next = head->next;
+  pending.prev = head->prev;
+  pending.next->prev = &pending;
+  pending.prev->next = &pending;
+  head->next = head;
+  head->prev = head;
+
+  while (pending.next != &pending)
+  {
+    timer = pending.next;
+    http_timer_unlink(timer);
+    http_timer_wheel_place(wheel, timer, wheel->current);
+  }
+}
+
+
+HTTPTimerWheel * http_timer_wheel_new(uint32_t resolution)
+{
+  HTTPTimerWheel * ret;
+
+  assert(resolution);
+
+  ret = (HTTPTimerWheel *) malloc(sizeof(HTTPTimerWheel));
+  assert(ret);
+
+  ret->resolution = resolution;
+  ret->current = http_wait_now() / resolution;
+  ret->size = 0;
+
+  for (unsigned int l = 0; l < _HTTP_TIMER_WHEEL_LEVELS; l++)
+  {
+    for (unsigned int k = 0; k < _HTTP_TIMER_WHEEL_SLOTS; k++)
+    {
+      ret->slots[l][k].next = &ret->slots[l][k];
+      ret->slots[l][k].prev = &ret->slots[l][k];
+    }
+  }
+
+  return ret;
+}
+
+/* armed timers are simply forgotten; they belong to their embedders */
+void http_timer_wheel_destroy(HTTPTimerWheel * wheel)
+{
+  assert(wheel);
+
+  free(wheel);
+}
+
+void http_timer_init(
+    HTTPTimer * timer,
+    HTTPTimerCallback callback,
+    void * context
+    )
+{
+  assert(timer);
+
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->deadline = 0;
+  timer->callback = callback;
+  timer->context = context;
+}
+
+bool http_timer_is_armed(HTTPTimer * timer)
+{
+  assert(timer);
+  return timer->next != NULL;
+}
+
+/* (re-)arms `timer' to fire once `deadline' passes. O(1) */
+void http_timer_wheel_arm(
+    HTTPTimerWheel * wheel,
+    HTTPTimer * timer,
+    uint64_t deadline
+    )
+{
+  assert(wheel);
+  assert(timer);
+
+  if (http_timer_is_armed(timer))
+    http_timer_unlink(timer);
+  else
+    wheel->size++;
+
+  timer->deadline = deadline;
+  http_timer_wheel_place(wheel, timer, wheel->current + 1);
+}
+
+/* O(1); cancelling an unarmed timer is harmless */
+void http_timer_wheel_cancel(HTTPTimerWheel * wheel, HTTPTimer * timer)
+{
+  assert(wheel);
+  assert(timer);
+
+  if (!http_timer_is_armed(timer))
+    return;
+
+  http_timer_unlink(timer);
+  wheel->size--;
+}
+
+size_t http_timer_wheel_size(HTTPTimerWheel * wheel)
+{
+  assert(wheel);
+  return wheel->size;
+}
+
+/* milliseconds until the wheel next needs advancing (suitable as a poll or
+ * epoll_wait timeout), or -1 if no timers are armed
+ */
+int http_timer_wheel_next_timeout(HTTPTimerWheel * wheel)
+{
+  uint64_t tick;
+  HTTPTimer * head;
+
+  assert(wheel);
+
+  if (wheel->size == 0)
+    return -1;
+
+  for (tick = wheel->current + 1;
+       tick <= wheel->current + _HTTP_TIMER_WHEEL_SLOTS;
+       tick++)
+  {
+    head = &wheel->slots[0][tick & _HTTP_TIMER_WHEEL_MASK];
+    if (head->next != head)
+      return http_wait_remaining(tick * wheel->resolution);
+    if ((tick & _HTTP_TIMER_WHEEL_MASK) == 0)
+      break; /* a cascade happens here and may bring timers down */
+  }
+
+  return http_wait_remaining(tick * wheel->resolution);
+}
+
+/* fires every timer whose deadline is at or before `now', returning how
+ * many fired. callbacks may re-arm or cancel any timer, including their own
+ */
+size_t http_timer_wheel_advance(HTTPTimerWheel * wheel, uint64_t now)
+{
+  HTTPTimer expired, * head, * timer;
+  uint64_t target;
+  unsigned int slot, level;
+  size_t fired = 0;
+
+  assert(wheel);
+
+  target = now / wheel->resolution;
+  if (wheel->size == 0 && wheel->current < target)
+    wheel->current = target; /* nothing to fire or cascade on the way */
+
+  while (wheel->current < target)
+  {
+    wheel->current++;
+    slot = wheel->current & _HTTP_TIMER_WHEEL_MASK;
+
+    for (level = 1; level < _HTTP_TIMER_WHEEL_LEVELS; level++)
+    {
+      if (
+        (wheel->current &
+         ((1ULL << (level * _HTTP_TIMER_WHEEL_BITS)) - 1)) != 0
+        )
+        break;
+
+      http_timer_wheel_cascade(
+          wheel,
+          level,
+          (wheel->current >> (level * _HTTP_TIMER_WHEEL_BITS)) &
+            _HTTP_TIMER_WHEEL_MASK
+          );
+    }
+
+    head = &wheel->slots[0][slot];
+    if (head->next == head)
+      continue;
+
+    expired.next = head->next;
+    expired.prev = head->prev;
+    expired.next->prev = &expired;
+    expired.prev->next = &expired;
+    head->next = head;
+    head->prev = head;
+
+    while (expired.next != &expired)
+    {
+      timer = expired.next;
+      http_timer_unlink(timer);
+      wheel->size--;
+      fired++;
+
+      if (timer->callback)
+        timer->callback(timer, timer->context);
+    }
+  }
+
+  return fired;
+}
+
@@ -0,0 +1,54 @@
+
+
+#ifndef __CHTTP_HTTP_TIMER_WHEEL_H
+#define __CHTTP_HTTP_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+struct HTTPTimer;
+typedef struct HTTPTimer HTTPTimer;
+
+typedef void (*HTTPTimerCallback)(HTTPTimer * timer, void * context);
+
+/* intrusive timer; embed it in the object it times out so that arming
+ * and cancelling never allocate. treat the members as private
+ */
+struct HTTPTimer
+{
+  HTTPTimer * next, * prev;
+  uint64_t deadline; /* as per http_wait_now */
+  HTTPTimerCallback callback;
+  void * context;
+};
+
+struct HTTPTimerWheel;
+typedef struct HTTPTimerWheel HTTPTimerWheel;
+
+
+HTTPTimerWheel * http_timer_wheel_new(uint32_t resolution); /* in ms */
+void http_timer_wheel_destroy(HTTPTimerWheel * wheel);
+
+void http_timer_init(
+    HTTPTimer * timer,
+    HTTPTimerCallback callback,
+    void * context
+    );
+bool http_timer_is_armed(HTTPTimer * timer);
+
+void http_timer_wheel_arm(
+    HTTPTimerWheel * wheel,
+    HTTPTimer * timer,
+    uint64_t deadline
+    );
+void http_timer_wheel_cancel(HTTPTimerWheel * wheel, HTTPTimer * timer);
+
+size_t http_timer_wheel_size(HTTPTimerWheel * wheel);
+int http_timer_wheel_next_timeout(HTTPTimerWheel * wheel);
+size_t http_timer_wheel_advance(HTTPTimerWheel * wheel, uint64_t now);
+
+
+#endif
+
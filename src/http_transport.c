@@ -0,0 +1,576 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "http_io.h"
+#include "http_metrics.h"
+#include "http_wait.h"
+
+#include "http_transport.h"
+
+
+#define _HTTP_TRANSPORT_COPY_LENGTH 0x4000
+
+
+struct HTTPTransportMemory;
+typedef struct HTTPTransportMemory HTTPTransportMemory;
+struct HTTPTransportMemoryShared;
+typedef struct HTTPTransportMemoryShared HTTPTransportMemoryShared;
+
+struct HTTPTransportMemoryShared
+{
+  pthread_mutex_t lock;
+  pthread_cond_t changed; /* on the monotonic clock */
+  uint32_t open_count;
+};
+
+/* an end of a memory pair holds what its peer has written to it. both
+ * ends are freed together, once both are closed, since each looks at the
+ * other
+ */
+struct HTTPTransportMemory
+{
+  HTTPTransport base;
+  HTTPTransportMemoryShared * shared;
+  HTTPTransportMemory * peer;
+
+  char * data;
+  size_t start, length, capacity;
+  bool closed;
+};
+
+
+/* sendfile by way of a buffer, for transports without a descriptor or
+ * descriptors the kernel cannot splice to
+ */
+static ssize_t http_transport_copy_file(
+    HTTPTransport * transport,
+    int file_fd,
+    off_t * offset,
+    size_t length
+    )
+{
+  char buffer [_HTTP_TRANSPORT_COPY_LENGTH];
+  struct iovec vector;
+  off_t position;
+  ssize_t got, ret;
+
+  position = offset ? *offset : lseek(file_fd, 0, SEEK_CUR);
+  if (position < 0)
+    return -1;
+
+  if (length > sizeof(buffer))
+    length = sizeof(buffer);
+
+  got = pread(file_fd, buffer, length, position);
+  if (got <= 0)
+    return got;
+
+  vector.iov_base = buffer;
+  vector.iov_len = got;
+  ret = transport->interface->writev(transport, &vector, 1);
+  if (ret <= 0)
+    return ret;
+
+  if (offset)
+    *offset += ret;
+  else
+    lseek(file_fd, ret, SEEK_CUR);
+
+  return ret;
+}
+
+
+/* DESCRIPTORS */
+
+static ssize_t http_transport_fd_read(
+    HTTPTransport * transport,
+    void * data,
+    size_t length
+    )
+{
+  ssize_t ret;
+
+  ret = read(transport->fd, data, length);
+  http_io_count(HTTP_METRIC_BYTES_RECEIVED, ret);
+
+  return ret;
+}
+
+static ssize_t http_transport_fd_writev(
+    HTTPTransport * transport,
+    const struct iovec * vector,
+    int count
+    )
+{
+  struct msghdr message;
+  ssize_t ret;
+
+  /* sendmsg, unlike writev, can be kept from raising SIGPIPE */
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = (struct iovec *) vector;
+  message.msg_iovlen = count;
+
+  ret = sendmsg(transport->fd, &message, MSG_NOSIGNAL);
+  if (ret < 0 && errno == ENOTSOCK)
+    ret = writev(transport->fd, vector, count);
+  http_io_count(HTTP_METRIC_BYTES_SENT, ret);
+
+  return ret;
+}
+
+static ssize_t http_transport_fd_sendfile(
+    HTTPTransport * transport,
+    int file_fd,
+    off_t * offset,
+    size_t length
+    )
+{
+  ssize_t ret;
+
+  ret = sendfile(transport->fd, file_fd, offset, length);
+  http_io_count(HTTP_METRIC_BYTES_SENT, ret);
+  if (ret < 0 && (errno == EINVAL || errno == ENOSYS))
+    ret = http_transport_copy_file(transport, file_fd, offset, length);
+
+  return ret;
+}
+
+static int http_transport_fd_wait(
+    HTTPTransport * transport,
+    short events,
+    int timeout
+    )
+{
+  return http_wait_poll(transport->fd, events, timeout, NULL);
+}
+
+static void http_transport_fd_close(HTTPTransport * transport)
+{
+  close(transport->fd);
+  free(transport);
+}
+
+static const HTTPTransportInterface http_transport_fd_interface =
+{
+  .read = http_transport_fd_read,
+  .writev = http_transport_fd_writev,
+  .sendfile = http_transport_fd_sendfile,
+  .wait = http_transport_fd_wait,
+  .close = http_transport_fd_close,
+};
+
+
+/* MEMORY PAIRS */
+
+static ssize_t http_transport_memory_read(
+    HTTPTransport * transport,
+    void * data,
+    size_t length
+    )
+{
+  HTTPTransportMemory * end = (HTTPTransportMemory *) transport;
+  ssize_t ret;
+
+  pthread_mutex_lock(&end->shared->lock);
+
+  if (end->start == end->length)
+  {
+    if (end->peer->closed)
+      ret = 0;
+    else
+    {
+      errno = EAGAIN;
+      ret = -1;
+    }
+  }
+  else
+  {
+    if (length > end->length - end->start)
+      length = end->length - end->start;
+
+    memcpy(data, &end->data[end->start], length);
+    end->start += length;
+    if (end->start == end->length)
+    {
+      end->start = 0;
+      end->length = 0;
+    }
+
+    ret = length;
+  }
+
+  pthread_mutex_unlock(&end->shared->lock);
+
+  return ret;
+}
+
+static ssize_t http_transport_memory_writev(
+    HTTPTransport * transport,
+    const struct iovec * vector,
+    int count
+    )
+{
+  HTTPTransportMemory * end = (HTTPTransportMemory *) transport;
+  HTTPTransportMemory * peer = end->peer;
+  size_t total = 0;
+
+  for (int k = 0; k < count; k++)
+    total += vector[k].iov_len;
+
+  pthread_mutex_lock(&end->shared->lock);
+
+  if (peer->closed)
+  {
+    pthread_mutex_unlock(&end->shared->lock);
+    errno = EPIPE;
+    return -1;
+  }
+
+  if (peer->start && peer->length + total > peer->capacity)
+  {
+    memmove(peer->data, &peer->data[peer->start], peer->length - peer->start);
+    peer->length -= peer->start;
+    peer->start = 0;
+  }
+
+  if (peer->length + total > peer->capacity)
+  {
+    if (peer->capacity == 0)
+      peer->capacity = _HTTP_TRANSPORT_COPY_LENGTH;
+    while (peer->length + total > peer->capacity)
+      peer->capacity *= 2;
+
+    peer->data = (char *) realloc(peer->data, peer->capacity);
+    assert(peer->data);
+  }
+
+  for (int k = 0; k < count; k++)
+  {
+    memcpy(&peer->data[peer->length], vector[k].iov_base, vector[k].iov_len);
+    peer->length += vector[k].iov_len;
+  }
+
+  pthread_cond_broadcast(&end->shared->changed);
+  pthread_mutex_unlock(&end->shared->lock);
+
+  return total;
+}
+
+static int http_transport_memory_wait(
+    HTTPTransport * transport,
+    short events,
+    int timeout
+    )
+{
+  HTTPTransportMemory * end = (HTTPTransportMemory *) transport;
+  struct timespec deadline;
+  int ret = 1;
+
+  /* writes never block */
+  if (events & POLLOUT)
+    return 1;
+
+  if (timeout > 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  pthread_mutex_lock(&end->shared->lock);
+
+  while (end->start == end->length && !end->peer->closed)
+  {
+    if (timeout == 0)
+      ret = 0;
+    else if (timeout < 0)
+      pthread_cond_wait(&end->shared->changed, &end->shared->lock);
+    else if (
+      pthread_cond_timedwait(
+          &end->shared->changed,
+          &end->shared->lock,
+          &deadline
+          ) == ETIMEDOUT
+      )
+      ret = 0;
+
+    if (ret == 0)
+      break;
+  }
+
+  pthread_mutex_unlock(&end->shared->lock);
+
+  return ret;
+}
+
+static void http_transport_memory_close(HTTPTransport * transport)
+{
+  HTTPTransportMemory * end = (HTTPTransportMemory *) transport;
+  HTTPTransportMemoryShared * shared = end->shared;
+  bool last;
+
+  pthread_mutex_lock(&shared->lock);
+  end->closed = true;
+  last = --shared->open_count == 0;
+  pthread_cond_broadcast(&shared->changed);
+  pthread_mutex_unlock(&shared->lock);
+
+  if (!last)
+    return;
+
+  free(end->peer->data);
+  free(end->peer);
+  free(end->data);
+  free(end);
+
+  pthread_mutex_destroy(&shared->lock);
+  pthread_cond_destroy(&shared->changed);
+  free(shared);
+}
+
+static const HTTPTransportInterface http_transport_memory_interface =
+{
+  .read = http_transport_memory_read,
+  .writev = http_transport_memory_writev,
+  .sendfile = http_transport_copy_file,
+  .wait = http_transport_memory_wait,
+  .close = http_transport_memory_close,
+};
+
+static HTTPTransportMemory * http_transport_memory_new(
+    HTTPTransportMemoryShared * shared
+    )
+{
+  HTTPTransportMemory * ret;
+
+  ret = (HTTPTransportMemory *) calloc(1, sizeof(HTTPTransportMemory));
+  assert(ret);
+
+  ret->base.interface = &http_transport_memory_interface;
+  ret->base.fd = -1;
+  ret->shared = shared;
+
+  return ret;
+}
+
+
+HTTPTransport * http_transport_new_fd(int fd)
+{
+  HTTPTransport * ret;
+
+  assert(fd >= 0);
+
+  ret = (HTTPTransport *) malloc(sizeof(HTTPTransport));
+  assert(ret);
+
+  ret->interface = &http_transport_fd_interface;
+  ret->fd = fd;
+
+  return ret;
+}
+
+HTTPTransport * http_transport_connect_unix(const char * path)
+{
+  struct sockaddr_un address;
+  int fd;
+
+  assert(path);
+
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return NULL;
+
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return http_transport_new_fd(fd);
+}
+
+bool http_transport_new_unix_pair(HTTPTransport ** a, HTTPTransport ** b)
+{
+  int fds [2];
+
+  assert(a);
+  assert(b);
+
+  if (
+    socketpair(
+        AF_UNIX,
+        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        0,
+        fds
+        ) != 0
+    )
+    return false;
+
+  *a = http_transport_new_fd(fds[0]);
+  *b = http_transport_new_fd(fds[1]);
+
+  return true;
+}
+
+void http_transport_new_memory_pair(HTTPTransport ** a, HTTPTransport ** b)
+{
+  HTTPTransportMemoryShared * shared;
+  HTTPTransportMemory * first, * second;
+  pthread_condattr_t attributes;
+
+  assert(a);
+  assert(b);
+
+  shared = (HTTPTransportMemoryShared *)
+    malloc(sizeof(HTTPTransportMemoryShared));
+  assert(shared);
+
+  pthread_mutex_init(&shared->lock, NULL);
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&shared->changed, &attributes);
+  pthread_condattr_destroy(&attributes);
+  shared->open_count = 2;
+
+  first = http_transport_memory_new(shared);
+  second = http_transport_memory_new(shared);
+  first->peer = second;
+  second->peer = first;
+
+  *a = &first->base;
+  *b = &second->base;
+}
+
+ssize_t http_transport_read(
+    HTTPTransport * transport,
+    void * data,
+    size_t length
+    )
+{
+  assert(transport);
+
+  return transport->interface->read(transport, data, length);
+}
+
+ssize_t http_transport_write(
+    HTTPTransport * transport,
+    const void * data,
+    size_t length
+    )
+{
+  struct iovec vector;
+
+  assert(transport);
+
+  vector.iov_base = (void *) data;
+  vector.iov_len = length;
+
+  return transport->interface->writev(transport, &vector, 1);
+}
+
+ssize_t http_transport_writev(
+    HTTPTransport * transport,
+    const struct iovec * vector,
+    int count
+    )
+{
+  assert(transport);
+
+  return transport->interface->writev(transport, vector, count);
+}
+
+ssize_t http_transport_sendfile(
+    HTTPTransport * transport,
+    int file_fd,
+    off_t * offset,
+    size_t length
+    )
+{
+  assert(transport);
+
+  return transport->interface->sendfile(transport, file_fd, offset, length);
+}
+
+int http_transport_wait(HTTPTransport * transport, short events, int timeout)
+{
+  assert(transport);
+
+  return transport->interface->wait(transport, events, timeout);
+}
+
+void http_transport_close(HTTPTransport * transport)
+{
+  assert(transport);
+
+  transport->interface->close(transport);
+}
+
+int http_transport_get_fd(HTTPTransport * transport)
+{
+  assert(transport);
+
+  return transport->fd;
+}
+
+ssize_t http_transport_io_read(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    )
+{
+  (void) fd;
+  return http_transport_read((HTTPTransport *) context, data, length);
+}
+
+ssize_t http_transport_io_write(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    )
+{
+  (void) fd;
+  return http_transport_write((HTTPTransport *) context, data, length);
+}
+
+int http_transport_io_wait(int fd, short events, int timeout, void * context)
+{
+  (void) fd;
+  return http_transport_wait((HTTPTransport *) context, events, timeout);
+}
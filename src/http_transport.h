@@ -0,0 +1,105 @@
+
+
+#ifndef __CHTTP_HTTP_TRANSPORT_H
+#define __CHTTP_HTTP_TRANSPORT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+struct HTTPTransport;
+typedef struct HTTPTransport HTTPTransport;
+struct HTTPTransportInterface;
+typedef struct HTTPTransportInterface HTTPTransportInterface;
+
+/* what a transport implements. the operations follow the conventions of
+ * the system calls they are named after (returning -1 with errno set on
+ * failure, and failing with EAGAIN rather than blocking), except for wait,
+ * which is an HTTPWaitFunction on the transport. close also frees it
+ */
+struct HTTPTransportInterface
+{
+  ssize_t (*read)(HTTPTransport * transport, void * data, size_t length);
+  ssize_t (*writev)(
+      HTTPTransport * transport,
+      const struct iovec * vector,
+      int count
+      );
+  ssize_t (*sendfile)(
+      HTTPTransport * transport,
+      int file_fd,
+      off_t * offset,
+      size_t length
+      );
+  int (*wait)(HTTPTransport * transport, short events, int timeout);
+  void (*close)(HTTPTransport * transport);
+};
+
+/* embed as the first member of an implementation's own struct */
+struct HTTPTransport
+{
+  const HTTPTransportInterface * interface;
+  int fd; /* the underlying descriptor, or -1 if there is none */
+};
+
+
+/* takes over `fd' (closing it with the transport) */
+HTTPTransport * http_transport_new_fd(int fd);
+
+/* connects to the unix domain socket at `path'; NULL (with errno set) on
+ * failure
+ */
+HTTPTransport * http_transport_connect_unix(const char * path);
+bool http_transport_new_unix_pair(HTTPTransport ** a, HTTPTransport ** b);
+
+/* two connected ends, each reading what the other writes, with no kernel
+ * in between. either end may be used by a different thread
+ */
+void http_transport_new_memory_pair(HTTPTransport ** a, HTTPTransport ** b);
+
+ssize_t http_transport_read(
+    HTTPTransport * transport,
+    void * data,
+    size_t length
+    );
+ssize_t http_transport_write(
+    HTTPTransport * transport,
+    const void * data,
+    size_t length
+    );
+ssize_t http_transport_writev(
+    HTTPTransport * transport,
+    const struct iovec * vector,
+    int count
+    );
+ssize_t http_transport_sendfile(
+    HTTPTransport * transport,
+    int file_fd,
+    off_t * offset,
+    size_t length
+    );
+int http_transport_wait(HTTPTransport * transport, short events, int timeout);
+void http_transport_close(HTTPTransport * transport);
+
+int http_transport_get_fd(HTTPTransport * transport);
+
+/* HTTPReadFunction, HTTPWriteFunction and HTTPWaitFunction adapters, with
+ * the transport as `context' (and `fd' ignored)
+ */
+ssize_t http_transport_io_read(
+    int fd,
+    void * data,
+    size_t length,
+    void * context
+    );
+ssize_t http_transport_io_write(
+    int fd,
+    const void * data,
+    size_t length,
+    void * context
+    );
+int http_transport_io_wait(int fd, short events, int timeout, void * context);
+
+
+#endif
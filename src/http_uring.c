@@ -0,0 +1,699 @@
+
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "http_metrics.h"
+
+#include "http_uring.h"
+
+
+/* multishot recv (6.0) marks headers new enough for everything used */
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define _HTTP_URING_SUPPORTED
+#endif
+
+
+#ifdef _HTTP_URING_SUPPORTED
+
+struct HTTPUring
+{
+  int fd;
+  uint32_t features;
+  bool enabled;
+
+  void * sq_map, * cq_map;
+  size_t sq_map_length, cq_map_length;
+  struct io_uring_sqe * sqes;
+  size_t sqes_length;
+
+  uint32_t * sq_head, * sq_tail, * sq_array, sq_mask, sq_entries;
+  uint32_t * cq_head, * cq_tail, cq_mask;
+  struct io_uring_cqe * cqes;
+  uint32_t sq_local_tail; /* prepared but not yet published */
+
+  struct io_uring_buf_ring * buffer_ring;
+  size_t buffer_ring_length;
+  char * buffers;
+  uint32_t buffer_length;
+  uint16_t buffer_count, buffer_group;
+};
+
+
+static int http_uring_setup(uint32_t entries, struct io_uring_params * params)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int http_uring_enter(
+    HTTPUring * ring,
+    uint32_t submit,
+    uint32_t wait,
+    uint32_t flags,
+    void * arg,
+    size_t arg_length
+    )
+{
+  http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+
+  return (int) syscall(
+      __NR_io_uring_enter,
+      ring->fd,
+      submit,
+      wait,
+      flags,
+      arg,
+      arg_length
+      );
+}
+
+static int http_uring_register(
+    HTTPUring * ring,
+    uint32_t opcode,
+    void * arg,
+    uint32_t count
+    )
+{
+  return (int) syscall(__NR_io_uring_register, ring->fd, opcode, arg, count);
+}
+
+static bool http_uring_map(HTTPUring * ring, struct io_uring_params * params)
+{
+  ring->sq_map_length =
+    params->sq_off.array + params->sq_entries * sizeof(uint32_t);
+  ring->cq_map_length =
+    params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params->features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_map_length > ring->sq_map_length)
+      ring->sq_map_length = ring->cq_map_length;
+    ring->cq_map_length = 0;
+  }
+
+  ring->sq_map = mmap(
+      NULL,
+      ring->sq_map_length,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring->fd,
+      IORING_OFF_SQ_RING
+      );
+  if (ring->sq_map == MAP_FAILED)
+  {
+    ring->sq_map = NULL;
+    return false;
+  }
+
+  if (ring->cq_map_length)
+  {
+    ring->cq_map = mmap(
+        NULL,
+        ring->cq_map_length,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring->fd,
+        IORING_OFF_CQ_RING
+        );
+    if (ring->cq_map == MAP_FAILED)
+    {
+      ring->cq_map = NULL;
+      return false;
+    }
+  }
+  else
+    ring->cq_map = ring->sq_map;
+
+  ring->sqes_length = params->sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(
+      NULL,
+      ring->sqes_length,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ring->fd,
+      IORING_OFF_SQES
+      );
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    return false;
+  }
+
+  ring->sq_head = (uint32_t *) ((char *) ring->sq_map + params->sq_off.head);
+  ring->sq_tail = (uint32_t *) ((char *) ring->sq_map + params->sq_off.tail);
+  ring->sq_array = (uint32_t *) ((char *) ring->sq_map + params->sq_off.array);
+  ring->sq_mask =
+    *(uint32_t *) ((char *) ring->sq_map + params->sq_off.ring_mask);
+  ring->sq_entries = params->sq_entries;
+  ring->sq_local_tail = *ring->sq_tail;
+
+  ring->cq_head = (uint32_t *) ((char *) ring->cq_map + params->cq_off.head);
+  ring->cq_tail = (uint32_t *) ((char *) ring->cq_map + params->cq_off.tail);
+  ring->cq_mask =
+    *(uint32_t *) ((char *) ring->cq_map + params->cq_off.ring_mask);
+  ring->cqes =
+    (struct io_uring_cqe *) ((char *) ring->cq_map + params->cq_off.cqes);
+
+  return true;
+}
+
+/* publishes prepared entries and has the kernel consume them */
+static int http_uring_submit(
+    HTTPUring * ring,
+    uint32_t wait,
+    uint32_t flags,
+    void * arg,
+    size_t arg_length
+    )
+{
+  uint32_t submit;
+  int ret;
+
+  submit = ring->sq_local_tail - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+  do
+  {
+    ret = http_uring_enter(ring, submit, wait, flags, arg, arg_length);
+  } while (ret < 0 && errno == EINTR && wait == 0);
+
+  return ret;
+}
+
+static struct io_uring_sqe * http_uring_get_sqe(HTTPUring * ring)
+{
+  struct io_uring_sqe * sqe;
+  uint32_t head;
+
+  head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  while (ring->sq_local_tail - head >= ring->sq_entries)
+  {
+    /* full: hand the kernel what is queued so far */
+    http_uring_submit(ring, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  ring->sq_array[ring->sq_local_tail & ring->sq_mask] =
+    ring->sq_local_tail & ring->sq_mask;
+  ring->sq_local_tail++;
+
+  return sqe;
+}
+
+
+HTTPUring * http_uring_new(uint32_t entries)
+{
+  static const uint32_t setup_flags [] = {
+    IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+      IORING_SETUP_DEFER_TASKRUN,
+    IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+    0,
+  };
+  struct io_uring_params params;
+  HTTPUring * ret;
+  size_t k;
+
+  ret = (HTTPUring *) calloc(1, sizeof(HTTPUring));
+  assert(ret);
+
+  ret->fd = -1;
+  for (k = 0; k < sizeof(setup_flags) / sizeof(*setup_flags); k++)
+  {
+    memset(&params, 0, sizeof(params));
+    params.flags = setup_flags[k] | IORING_SETUP_R_DISABLED |
+                   IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = entries * 4;
+
+    ret->fd = http_uring_setup(entries, &params);
+    if (ret->fd >= 0 || errno != EINVAL)
+      break;
+  }
+
+  if (
+    ret->fd < 0 ||
+    !(params.features & IORING_FEAT_EXT_ARG) ||
+    !(params.features & IORING_FEAT_NODROP) ||
+    !http_uring_map(ret, &params)
+    )
+  {
+    http_uring_destroy(ret);
+    return NULL;
+  }
+
+  ret->features = params.features;
+
+  return ret;
+}
+
+/* rings start disabled so that the thread which will drive one (and which
+ * alone may, where single issuer mode is available) is the one enabling it
+ */
+bool http_uring_enable(HTTPUring * ring)
+{
+  assert(ring);
+
+  if (!ring->enabled)
+    ring->enabled =
+      http_uring_register(ring, IORING_REGISTER_ENABLE_RINGS, NULL, 0) == 0;
+
+  return ring->enabled;
+}
+
+void http_uring_destroy(HTTPUring * ring)
+{
+  struct io_uring_buf_reg registration;
+
+  assert(ring);
+
+  if (ring->buffer_ring)
+  {
+    memset(&registration, 0, sizeof(registration));
+    registration.bgid = ring->buffer_group;
+    http_uring_register(ring, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    munmap(ring->buffer_ring, ring->buffer_ring_length);
+  }
+  free(ring->buffers);
+
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_length);
+  if (ring->cq_map && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_length);
+  if (ring->sq_map)
+    munmap(ring->sq_map, ring->sq_map_length);
+  if (ring->fd >= 0)
+    close(ring->fd);
+
+  free(ring);
+}
+
+/* registers `count' (a power of two) buffers of `length' bytes each which
+ * the kernel picks from when receiving with http_uring_recv[_multishot].
+ * only one group is kept per ring
+ */
+bool http_uring_setup_buffers(
+    HTTPUring * ring,
+    uint16_t group,
+    uint16_t count,
+    uint32_t length
+    )
+{
+  struct io_uring_buf_reg registration;
+  uint16_t k;
+
+  assert(ring);
+  assert(!ring->buffer_ring);
+  assert(count && (count & (count - 1)) == 0);
+
+  ring->buffer_ring_length = count * sizeof(struct io_uring_buf);
+  ring->buffer_ring = mmap(
+      NULL,
+      ring->buffer_ring_length,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0
+      );
+  if (ring->buffer_ring == MAP_FAILED)
+  {
+    ring->buffer_ring = NULL;
+    return false;
+  }
+
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (uint64_t) (uintptr_t) ring->buffer_ring;
+  registration.ring_entries = count;
+  registration.bgid = group;
+
+  if (http_uring_register(ring, IORING_REGISTER_PBUF_RING, &registration, 1))
+  {
+    munmap(ring->buffer_ring, ring->buffer_ring_length);
+    ring->buffer_ring = NULL;
+    return false;
+  }
+
+  ring->buffers = (char *) malloc((size_t) count * length);
+  assert(ring->buffers);
+
+  ring->buffer_length = length;
+  ring->buffer_count = count;
+  ring->buffer_group = group;
+
+  for (k = 0; k < count; k++)
+    http_uring_recycle_buffer(ring, k);
+
+  return true;
+}
+
+char * http_uring_get_buffer(HTTPUring * ring, uint16_t id)
+{
+  assert(ring);
+  assert(id < ring->buffer_count);
+
+  return &ring->buffers[(size_t) id * ring->buffer_length];
+}
+
+/* returns buffer `id' to the kernel once its contents have been consumed */
+void http_uring_recycle_buffer(HTTPUring * ring, uint16_t id)
+{
+  struct io_uring_buf * buffer;
+  uint16_t tail;
+
+  assert(ring);
+  assert(id < ring->buffer_count);
+
+  tail = ring->buffer_ring->tail;
+  buffer = &ring->buffer_ring->bufs[tail & (ring->buffer_count - 1)];
+  buffer->addr = (uint64_t) (uintptr_t) http_uring_get_buffer(ring, id);
+  buffer->len = ring->buffer_length;
+  buffer->bid = id;
+
+  __atomic_store_n(&ring->buffer_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+void http_uring_accept_multishot(HTTPUring * ring, int fd, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+}
+
+void http_uring_recv_multishot(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    )
+{
+  struct io_uring_sqe * sqe;
+
+  http_uring_recv(ring, fd, group, user_data);
+
+  sqe = &ring->sqes[(ring->sq_local_tail - 1) & ring->sq_mask];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+}
+
+void http_uring_recv(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    )
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  sqe->user_data = user_data;
+}
+
+void http_uring_send(
+    HTTPUring * ring,
+    int fd,
+    const void * data,
+    size_t length,
+    uint64_t user_data
+    )
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) data;
+  sqe->len = length;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+}
+
+void http_uring_poll(HTTPUring * ring, int fd, short events, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->user_data = user_data;
+}
+
+/* cancels the operation submitted with user data `target' */
+void http_uring_cancel(HTTPUring * ring, uint64_t target, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = target;
+  sqe->user_data = user_data;
+}
+
+/* cancels every operation in flight on `fd' */
+void http_uring_cancel_fd(HTTPUring * ring, int fd, uint64_t user_data)
+{
+  struct io_uring_sqe * sqe;
+
+  assert(ring);
+
+  sqe = http_uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = user_data;
+}
+
+
+/* submits everything prepared and waits up to `timeout' milliseconds (-1
+ * waits indefinitely) for at least one completion, in a single system call
+ */
+int http_uring_submit_and_wait(HTTPUring * ring, int timeout)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec time;
+  int ret;
+
+  assert(ring);
+
+  memset(&arg, 0, sizeof(arg));
+  if (timeout >= 0)
+  {
+    time.tv_sec = timeout / 1000;
+    time.tv_nsec = (timeout % 1000) * 1000000LL;
+    arg.ts = (uint64_t) (uintptr_t) &time;
+  }
+
+  /* completions already waiting need no wait at all */
+  if (
+    __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) != *ring->cq_head
+    )
+  {
+    time.tv_sec = 0;
+    time.tv_nsec = 0;
+    arg.ts = (uint64_t) (uintptr_t) &time;
+  }
+
+  ret = http_uring_submit(
+      ring,
+      1,
+      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+      &arg,
+      sizeof(arg)
+      );
+
+  if (ret < 0 && (errno == ETIME || errno == EINTR))
+    return 0;
+
+  return ret;
+}
+
+bool http_uring_next_completion(
+    HTTPUring * ring,
+    HTTPUringCompletion * completion
+    )
+{
+  struct io_uring_cqe * cqe;
+  uint32_t head;
+
+  assert(ring);
+  assert(completion);
+
+  head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return false;
+
+  cqe = &ring->cqes[head & ring->cq_mask];
+  completion->user_data = cqe->user_data;
+  completion->result = cqe->res;
+  completion->flags = cqe->flags;
+
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+bool http_uring_completion_has_more(HTTPUringCompletion * completion)
+{
+  assert(completion);
+  return (completion->flags & IORING_CQE_F_MORE) != 0;
+}
+bool http_uring_completion_has_buffer(HTTPUringCompletion * completion)
+{
+  assert(completion);
+  return (completion->flags & IORING_CQE_F_BUFFER) != 0;
+}
+uint16_t http_uring_completion_get_buffer(HTTPUringCompletion * completion)
+{
+  assert(completion);
+  return completion->flags >> IORING_CQE_BUFFER_SHIFT;
+}
+
+#else /* _HTTP_URING_SUPPORTED */
+
+/* built without the io_uring headers: never available, so the remaining
+ * functions are unreachable
+ */
+
+HTTPUring * http_uring_new(uint32_t entries)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+void http_uring_destroy(HTTPUring * ring) { assert(0); }
+bool http_uring_enable(HTTPUring * ring)
+{
+  assert(0);
+  return false;
+}
+
+bool http_uring_setup_buffers(
+    HTTPUring * ring,
+    uint16_t group,
+    uint16_t count,
+    uint32_t length
+    )
+{
+  assert(0);
+  return false;
+}
+char * http_uring_get_buffer(HTTPUring * ring, uint16_t id)
+{
+  assert(0);
+  return NULL;
+}
+void http_uring_recycle_buffer(HTTPUring * ring, uint16_t id) { assert(0); }
+
+void http_uring_accept_multishot(HTTPUring * ring, int fd, uint64_t user_data)
+{
+  assert(0);
+}
+void http_uring_recv_multishot(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    )
+{
+  assert(0);
+}
+void http_uring_recv(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    )
+{
+  assert(0);
+}
+void http_uring_send(
+    HTTPUring * ring,
+    int fd,
+    const void * data,
+    size_t length,
+    uint64_t user_data
+    )
+{
+  assert(0);
+}
+void http_uring_poll(HTTPUring * ring, int fd, short events, uint64_t user_data)
+{
+  assert(0);
+}
+void http_uring_cancel(HTTPUring * ring, uint64_t target, uint64_t user_data)
+{
+  assert(0);
+}
+void http_uring_cancel_fd(HTTPUring * ring, int fd, uint64_t user_data)
+{
+  assert(0);
+}
+
+int http_uring_submit_and_wait(HTTPUring * ring, int timeout)
+{
+  assert(0);
+  return -1;
+}
+bool http_uring_next_completion(
+    HTTPUring * ring,
+    HTTPUringCompletion * completion
+    )
+{
+  assert(0);
+  return false;
+}
+
+bool http_uring_completion_has_more(HTTPUringCompletion * completion)
+{
+  assert(0);
+  return false;
+}
+bool http_uring_completion_has_buffer(HTTPUringCompletion * completion)
+{
+  assert(0);
+  return false;
+}
+uint16_t http_uring_completion_get_buffer(HTTPUringCompletion * completion)
+{
+  assert(0);
+  return 0;
+}
+
+#endif /* _HTTP_URING_SUPPORTED */
+
@@ -0,0 +1,78 @@
+
+
+#ifndef __CHTTP_HTTP_URING_H
+#define __CHTTP_HTTP_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* a minimal io_uring submission/completion ring, spoken to through the raw
+ * system calls so that no library beyond the kernel headers is needed.
+ * http_uring_new returns NULL where io_uring (or one of the features used
+ * here: provided buffer rings, multishot accept) is unavailable
+ */
+
+struct HTTPUring;
+typedef struct HTTPUring HTTPUring;
+
+struct HTTPUringCompletion
+{
+  uint64_t user_data;
+  int32_t result; /* as a system call would return it, or -errno */
+  uint32_t flags;
+};
+typedef struct HTTPUringCompletion HTTPUringCompletion;
+
+
+HTTPUring * http_uring_new(uint32_t entries);
+void http_uring_destroy(HTTPUring * ring);
+bool http_uring_enable(HTTPUring * ring);
+
+bool http_uring_setup_buffers(
+    HTTPUring * ring,
+    uint16_t group,
+    uint16_t count,
+    uint32_t length
+    );
+char * http_uring_get_buffer(HTTPUring * ring, uint16_t id);
+void http_uring_recycle_buffer(HTTPUring * ring, uint16_t id);
+
+void http_uring_accept_multishot(HTTPUring * ring, int fd, uint64_t user_data);
+void http_uring_recv_multishot(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    );
+void http_uring_recv(
+    HTTPUring * ring,
+    int fd,
+    uint16_t group,
+    uint64_t user_data
+    );
+void http_uring_send(
+    HTTPUring * ring,
+    int fd,
+    const void * data,
+    size_t length,
+    uint64_t user_data
+    );
+void http_uring_poll(HTTPUring * ring, int fd, short events, uint64_t user_data);
+void http_uring_cancel(HTTPUring * ring, uint64_t target, uint64_t user_data);
+void http_uring_cancel_fd(HTTPUring * ring, int fd, uint64_t user_data);
+
+int http_uring_submit_and_wait(HTTPUring * ring, int timeout);
+bool http_uring_next_completion(
+    HTTPUring * ring,
+    HTTPUringCompletion * completion
+    );
+
+bool http_uring_completion_has_more(HTTPUringCompletion * completion);
+bool http_uring_completion_has_buffer(HTTPUringCompletion * completion);
+uint16_t http_uring_completion_get_buffer(HTTPUringCompletion * completion);
+
+
+#endif
+
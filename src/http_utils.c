@@ -1,7 +1,9 @@
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "http_version.h"
@@ -122,196 +124,231 @@ static char * http_utils_month_string(int k)
   }
 }
 
-List * http_utils_parse_cookie(char * str, bool ignore_bad_names)
+static bool http_utils_is_cookie_space(char c)
 {
-  HTTPCookie * cookie;
-  List * ret, * split;
-  ListTraversal * trav;
-  char * cookie_str;
-  char * name, * value;
+  return c == ' ' || c == '\t';
+}
 
-  ret = list_new(LIST_TYPE_LINKED_LIST);
-  if (strings_is_whitespace(str))
-    return ret;
+static bool http_utils_token_name_is(HTTPCookieToken * token, char * name)
+{
+  size_t length = strlen(name);
 
-  split = strings_split(str, ';');
-  trav = list_get_traversal(split);
+  return token->name_length == length &&
+         memcmp(token->name, name, length) == 0;
+}
 
-  while (!list_traversal_completed(trav))
+static bool http_utils_token_is_reserved_name(HTTPCookieToken * token)
+{
+  return
+    http_utils_token_name_is(token, "Expires") ||
+    http_utils_token_name_is(token, "Max-Age") ||
+    http_utils_token_name_is(token, "Domain") ||
+    http_utils_token_name_is(token, "Path");
+}
+
+static bool http_utils_token_is_flag(HTTPCookieToken * token)
+{
+  return
+    !token->has_value &&
+    (
+      http_utils_token_name_is(token, "HttpOnly") ||
+      http_utils_token_name_is(token, "Secure")
+    );
+}
+
+static HTTPCookie * http_utils_cookie_from_token(HTTPCookieToken * token)
+{
+  HTTPCookie * cookie = http_cookie_new();
+
+  http_cookie_set_name_range(cookie, token->name, token->name_length);
+  http_cookie_set_value_range(cookie, token->value, token->value_length);
+
+  return cookie;
+}
+
+/* yields the next `;'-delimited segment of a Cookie or Set-Cookie header
+ * value, trimmed of surrounding white-space, without copying or allocating.
+ * empty segments are skipped. returns false once the string is exhausted
+ */
+bool http_utils_next_cookie_token(char ** cursor, HTTPCookieToken * token)
+{
+  char * ptr, * start, * equals = NULL, * name_end, * value_end;
+
+  assert(cursor);
+  assert(*cursor);
+  assert(token);
+
+  ptr = *cursor;
+  while (http_utils_is_cookie_space(*ptr) || *ptr == ';')
+    ptr++;
+
+  if (*ptr == '\0')
   {
-    cookie_str = list_traversal_next_str(trav);
+    *cursor = ptr;
+    return false;
+  }
 
-    if (strings_is_null_or_whitespace(cookie_str))
-      continue;
-    
-    if (!http_utils_split_about(cookie_str, &name, &value, '='))
+  start = ptr;
+  for (; *ptr != '\0' && *ptr != ';'; ptr++)
+  {
+    if (*ptr == '=' && !equals)
+      equals = ptr;
+  }
+
+  *cursor = *ptr == ';' ? ptr + 1 : ptr;
+
+  value_end = ptr;
+  while (value_end > start && http_utils_is_cookie_space(value_end[-1]))
+    value_end--;
+
+  if (!equals)
+  {
+    token->name = start;
+    token->name_length = value_end - start;
+    token->value = value_end;
+    token->value_length = 0;
+    token->has_value = false;
+    return true;
+  }
+
+  name_end = equals;
+  while (name_end > start && http_utils_is_cookie_space(name_end[-1]))
+    name_end--;
+
+  token->name = start;
+  token->name_length = name_end - start;
+
+  token->value = equals + 1;
+  while (
+    token->value < value_end &&
+    http_utils_is_cookie_space(token->value[0])
+    )
+    token->value++;
+  if (value_end < token->value)
+    value_end = token->value;
+
+  token->value_length = value_end - token->value;
+  token->has_value = true;
+
+  return true;
+}
+
+List * http_utils_parse_cookie(char * str, bool ignore_bad_names)
+{
+  HTTPCookieToken token;
+  List * ret;
+  char * cursor;
+
+  assert(str);
+
+  ret = list_new(LIST_TYPE_LINKED_LIST);
+
+  cursor = str;
+  while (http_utils_next_cookie_token(&cursor, &token))
+  {
+    if (!token.has_value)
     {
-      if (ignore_bad_names)
-      {
-        cookie_str = strings_trim(cookie_str);
-        if (
-          strings_equals(cookie_str, "HttpOnly") ||
-          strings_equals(cookie_str, "Secure")
-          )
-        {
-          free(cookie_str);
-          continue;
-        }
-        free(cookie_str);
-      }
-      list_traversal_destroy(trav);
-      list_destroy(split);
+      if (ignore_bad_names && http_utils_token_is_flag(&token))
+        continue;
+
       list_destroy_and_user_free(ret, (void (*)(void *)) http_cookie_destroy);
       return NULL;
     }
 
-
-    if (
-      strings_equals(name, "Expires") ||
-      strings_equals(name, "Max-Age") ||
-      strings_equals(name, "Domain") ||
-      strings_equals(name, "Path")
-      )
+    if (http_utils_token_is_reserved_name(&token))
     {
-      
-      free(name);
-      free(value);
-
       if (ignore_bad_names)
         continue;
-      else
-      {
-        list_traversal_destroy(trav);
-        list_destroy(split);
-        list_destroy_and_user_free(ret, (void (*)(void *)) http_cookie_destroy);
-        return NULL;
-      }
-    }
 
-    cookie = http_cookie_new();
-
-    http_cookie_set_name(cookie, name);
-    http_cookie_set_value(cookie, value);
-    
-    free(name);
-    free(value);
+      list_destroy_and_user_free(ret, (void (*)(void *)) http_cookie_destroy);
+      return NULL;
+    }
 
-    list_add(ret, ptr_to_any(cookie));
+    list_add(ret, ptr_to_any(http_utils_cookie_from_token(&token)));
   }
 
   return ret;
 }
 
-static bool http_utils_parse_cookie_attribute(
-        char * cookie_str, time_t * expiry, uint32_t * max_age,
-        char ** domain, char ** path, bool * secure, bool * httponly
-        )
+static bool http_utils_parse_max_age(HTTPCookieToken * token, uint32_t * out)
 {
-  bool err = false;
-  char
-    * trim = strings_trim(cookie_str), * name, * value;
+  uint32_t value = 0;
 
-  if (strings_equals(trim, "Secure"))
-    *secure = true;
-  else if (strings_equals(trim, "HttpOnly"))
-    *httponly = true;
-  else
+  for (size_t k = 0; k < token->value_length; k++)
   {
-    if (http_utils_split_about(trim, &name, &value, '='))
-    {
-      if (strings_equals(name, "Expiries"))
-      {
-        *expiry = http_utils_parse_date(value);
-        if (!(*expiry))
-          err = true;
-      }
-      else if (strings_equals(name, "Max-Age"))
-      {
-        *max_age = strtoul(value, NULL, 10);
-        if (!(*max_age))
-          err = true;
-      }
-      else if (strings_equals(name, "Domain"))
-      {
-        free(*domain);
-        *domain = value;
-        value = NULL; /* prevents from being freed */
-      }
-      else if (strings_equals(name, "Path"))
-      {
-        free(*path);
-        *path = value;
-        value = NULL;
-      }
-      
-      free(name);
-      free(value);
-    }
+    if (token->value[k] < '0' || token->value[k] > '9')
+      break;
+    value = value * 10 + (token->value[k] - '0');
   }
 
-  free(trim);
-  return !err;
+  *out = value;
+  return value != 0;
 }
 
-static void http_utils_apply_attributes_to_cookie(
-    HTTPCookie * cookie, time_t expiry, uint32_t max_age,
-    char * domain, char * path, bool secure, bool httponly
-    )
+static bool http_utils_parse_expiry(HTTPCookieToken * token, time_t * out)
 {
-  if (expiry)
-    http_cookie_set_expiry(cookie, expiry);
-  if (max_age)
-    http_cookie_set_max_age(cookie, max_age);
-  if (domain)
-    http_cookie_set_domain(cookie, domain);
-  if (path)
-    http_cookie_set_path(cookie, path);
+  char buffer [0x40];
+
+  if (token->value_length >= sizeof(buffer))
+    return false;
+
+  memcpy(buffer, token->value, token->value_length);
+  buffer[token->value_length] = '\0';
 
-  http_cookie_set_secure(cookie, secure);
-  http_cookie_set_httponly(cookie, httponly);
+  *out = http_utils_parse_date(buffer);
+  return *out != 0;
 }
 
 List * http_utils_parse_set_cookie(char * str)
 {
+  HTTPCookieToken token, domain, path;
   HTTPCookie * cookie;
-  List * ret, * split;
+  List * ret;
   ListTraversal * trav;
-  char * cookie_str;
+  char * cursor;
   time_t expiry = 0;
   uint32_t max_age = 0;
-  char * domain  = NULL, * path = NULL;
-  bool secure = false, httponly = false;
+  bool
+    has_domain = false, has_path = false,
+    secure = false, httponly = false, err = false;
 
   assert(str);
 
-  if (strings_is_whitespace(str))
-    return list_new(LIST_TYPE_LINKED_LIST);
-
-  split = strings_split(str, ';');
+  ret = list_new(LIST_TYPE_LINKED_LIST);
 
-  trav = list_get_traversal(split);
-  while (!list_traversal_completed(trav))
+  cursor = str;
+  while (!err && http_utils_next_cookie_token(&cursor, &token))
   {
-    cookie_str = list_traversal_next_str(trav);
-    if (strings_is_whitespace(cookie_str))
-      continue;
-
-    if (!http_utils_parse_cookie_attribute(
-        cookie_str, &expiry, &max_age, &domain, &path, &secure, &httponly
-        ))
+    if (!token.has_value)
     {
-      list_traversal_destroy(trav);
-      return NULL;
+      if (http_utils_token_name_is(&token, "Secure"))
+        secure = true;
+      else if (http_utils_token_name_is(&token, "HttpOnly"))
+        httponly = true;
+      else
+        err = true;
+    }
+    else if (http_utils_token_name_is(&token, "Expiries"))
+      err = !http_utils_parse_expiry(&token, &expiry);
+    else if (http_utils_token_name_is(&token, "Max-Age"))
+      err = !http_utils_parse_max_age(&token, &max_age);
+    else if (http_utils_token_name_is(&token, "Domain"))
+    {
+      domain = token;
+      has_domain = true;
     }
+    else if (http_utils_token_name_is(&token, "Path"))
+    {
+      path = token;
+      has_path = true;
+    }
+    else if (!http_utils_token_is_reserved_name(&token))
+      list_add(ret, ptr_to_any(http_utils_cookie_from_token(&token)));
   }
 
-  list_destroy_and_free(split);
-
-  ret = http_utils_parse_cookie(str, true);
-  if (!ret)
+  if (err)
   {
-    free(domain);
-    free(path);
+    list_destroy_and_user_free(ret, (void (*)(void *)) http_cookie_destroy);
     return NULL;
   }
 
@@ -319,13 +356,19 @@ List * http_utils_parse_set_cookie(char * str)
   while (!list_traversal_completed(trav))
   {
     cookie = (HTTPCookie *) list_traversal_next_ptr(trav);
-    http_utils_apply_attributes_to_cookie(
-        cookie, expiry, max_age, domain, path, secure, httponly
-        );
-  }
 
-  free(domain);
-  free(path);
+    if (expiry)
+      http_cookie_set_expiry(cookie, expiry);
+    if (max_age)
+      http_cookie_set_max_age(cookie, max_age);
+    if (has_domain)
+      http_cookie_set_domain_range(cookie, domain.value, domain.value_length);
+    if (has_path)
+      http_cookie_set_path_range(cookie, path.value, path.value_length);
+
+    http_cookie_set_secure(cookie, secure);
+    http_cookie_set_httponly(cookie, httponly);
+  }
 
   return ret;
 }
@@ -794,7 +837,7 @@ char * http_utils_url_deescape(char * str)
       else
       {
         memcpy(hex_buffer, &str[k + 1], 2);
-        hex_buffer[3] = 0;
+        hex_buffer[2] = 0;
         escaped_code_point = strtoul(hex_buffer, NULL, 16);
         string_builder_append_char(sb, (char) escaped_code_point);
         k += 2;
@@ -942,3 +985,131 @@ char * http_utils_headerize(char * header_name)
   return ret;
 }
 
+/* a Content-Length value of `length' bytes: digits alone, which must fit.
+ * false for anything else, a list of lengths included
+ */
+bool http_utils_parse_content_length(
+    const char * str,
+    size_t length,
+    unsigned long long * value
+    )
+{
+  unsigned int digit;
+
+  assert(str || length == 0);
+  assert(value);
+
+  if (length == 0)
+    return false;
+
+  *value = 0;
+  for (size_t k = 0; k < length; k++)
+  {
+    if (str[k] < '0' || str[k] > '9')
+      return false;
+
+    digit = str[k] - '0';
+    if (*value > (ULLONG_MAX - digit) / 10)
+      return false;
+    *value = *value * 10 + digit;
+  }
+
+  return true;
+}
+
+/* looks for the header `name' (lowercase, its colon included) amongst
+ * `length' bytes of raw header lines, without parsing them, pointing
+ * `value' at the first one's value, white space trimmed. false if absent
+ */
+bool http_utils_scan_header(
+    const char * headers,
+    size_t length,
+    const char * name,
+    const char ** value,
+    size_t * value_length
+    )
+{
+  size_t k, end, name_length = strlen(name);
+
+  assert(headers || length == 0);
+  assert(name);
+  assert(value);
+  assert(value_length);
+
+  for (k = 0; k + name_length < length; k++)
+  {
+    if (k != 0 && headers[k - 1] != '\n')
+      continue;
+    if (strncasecmp(&headers[k], name, name_length) != 0)
+      continue;
+
+    k += name_length;
+    while (k < length && (headers[k] == ' ' || headers[k] == '\t'))
+      k++;
+
+    end = k;
+    while (end < length && headers[end] != '\r' && headers[end] != '\n')
+      end++;
+    while (end > k && (headers[end - 1] == ' ' || headers[end - 1] == '\t'))
+      end--;
+
+    *value = &headers[k];
+    *value_length = end - k;
+    return true;
+  }
+
+  return false;
+}
+
+/* looks for the Content-Length header amongst `length' bytes of raw header
+ * lines, without parsing them. 1 if it is found, 0 if it is absent and -1
+ * if its value is malformed, too large or continued on a folded line, or
+ * the header is stated more than once (as a reader would not frame the
+ * message alike)
+ */
+int http_utils_scan_content_length(
+    const char * headers,
+    size_t length,
+    unsigned long long * value
+    )
+{
+  static const char name [] = "content-length:";
+  size_t k, start, end;
+  bool found = false;
+
+  assert(headers || length == 0);
+  assert(value);
+
+  for (k = 0; k + sizeof(name) - 1 < length; k++)
+  {
+    if (k != 0 && headers[k - 1] != '\n')
+      continue;
+    if (strncasecmp(&headers[k], name, sizeof(name) - 1) != 0)
+      continue;
+    if (found)
+      return -1;
+
+    k += sizeof(name) - 1;
+    while (k < length && (headers[k] == ' ' || headers[k] == '\t'))
+      k++;
+
+    start = k;
+    while (k < length && headers[k] != '\r' && headers[k] != '\n')
+      k++;
+    end = k;
+    while (end > start && (headers[end - 1] == ' ' || headers[end - 1] == '\t'))
+      end--;
+
+    if (!http_utils_parse_content_length(&headers[start], end - start, value))
+      return -1;
+
+    while (k < length && headers[k] != '\n')
+      k++;
+    if (k + 1 < length && (headers[k + 1] == ' ' || headers[k + 1] == '\t'))
+      return -1;
+
+    found = true;
+  }
+
+  return found ? 1 : 0;
+}
@@ -7,8 +7,10 @@
 #include <time.h>
 
 #include "http_cookie.h"
+#include "http_cookie_token.h"
 #include "http_version.h"
 
+bool http_utils_next_cookie_token(char ** cursor, HTTPCookieToken * token);
 List * http_utils_parse_cookie(char * str, bool ignore_bad_names);
 List * http_utils_parse_set_cookie(char * str);
 
@@ -31,6 +33,24 @@ bool http_utils_split_about_no_trim(
 
 char * http_utils_headerize(char * header_name);
 
+bool http_utils_scan_header(
+    const char * headers,
+    size_t length,
+    const char * name,
+    const char ** value,
+    size_t * value_length
+    );
+bool http_utils_parse_content_length(
+    const char * str,
+    size_t length,
+    unsigned long long * value
+    );
+int http_utils_scan_content_length(
+    const char * headers,
+    size_t length,
+    unsigned long long * value
+    );
+
 #endif
 
 
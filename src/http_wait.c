@@ -0,0 +1,123 @@
+
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "http_metrics.h"
+
+#include "http_wait.h"
+
+
+/* milliseconds on the monotonic clock; unaffected by wall-clock changes */
+uint64_t http_wait_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* nanoseconds on the same clock, for measuring rather than waiting */
+uint64_t http_wait_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* milliseconds left until `deadline' (as per http_wait_now), clamped to
+ * zero and to the range of a poll() timeout
+ */
+int http_wait_remaining(uint64_t deadline)
+{
+  uint64_t now = http_wait_now();
+
+  if (now >= deadline)
+    return 0;
+  else if (deadline - now > INT32_MAX)
+    return INT32_MAX;
+  else
+    return (int) (deadline - now);
+}
+
+int http_wait_poll(int fd, short events, int timeout, void * context)
+{
+  struct pollfd pfd;
+  int ret;
+
+  (void) context;
+
+  pfd.fd = fd;
+  pfd.events = events;
+  pfd.revents = 0;
+
+  do
+  {
+    ret = poll(&pfd, 1, timeout);
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+  }
+  while (ret < 0 && errno == EINTR);
+
+  return ret;
+}
+
+/* waits through a caller-owned epoll instance. `context' must point to
+ * the int epoll descriptor; `fd' is (re-)armed one-shot on each call so
+ * the instance may be shared by all the descriptors a thread blocks on
+ */
+int http_wait_epoll(int fd, short events, int timeout, void * context)
+{
+  struct epoll_event event, ready;
+  int epoll_fd, ret;
+  uint64_t deadline = 0;
+
+  assert(context);
+
+  if (timeout > 0)
+    deadline = http_wait_now() + timeout;
+
+  epoll_fd = *(int *) context;
+
+  event.events = EPOLLONESHOT;
+  if (events & POLLIN)
+    event.events |= EPOLLIN | EPOLLRDHUP;
+  if (events & POLLOUT)
+    event.events |= EPOLLOUT;
+  event.data.fd = fd;
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+  {
+    if (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+      return -1;
+  }
+
+  for (;;)
+  {
+    ret = epoll_wait(epoll_fd, &ready, 1, timeout);
+    http_metrics_add(HTTP_METRIC_SYSCALLS, 1);
+
+    if (ret > 0 && ready.data.fd == fd)
+      return ret;
+    else if (ret == 0)
+      return 0;
+    else if (ret < 0 && errno != EINTR)
+      return -1;
+
+    /* interrupted, or woken by a descriptor armed by an earlier call */
+
+    if (timeout > 0)
+    {
+      timeout = http_wait_remaining(deadline);
+      if (timeout == 0)
+        return 0;
+    }
+  }
+}
+
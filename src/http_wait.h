@@ -0,0 +1,31 @@
+
+
+#ifndef __CHTTP_HTTP_WAIT_H
+#define __CHTTP_HTTP_WAIT_H
+
+#include <stdint.h>
+
+
+/* blocks until `fd' is ready for `events' (POLLIN/POLLOUT) or until
+ * `timeout' milliseconds have passed (-1 waits indefinitely). returns a
+ * positive value when ready, zero on timeout and a negative value (with
+ * errno set) on failure
+ */
+typedef int (*HTTPWaitFunction)(
+    int fd,
+    short events,
+    int timeout,
+    void * context
+    );
+
+
+uint64_t http_wait_now(void);
+uint64_t http_wait_now_ns(void);
+int http_wait_remaining(uint64_t deadline);
+
+int http_wait_poll(int fd, short events, int timeout, void * context);
+int http_wait_epoll(int fd, short events, int timeout, void * context);
+
+
+#endif
+
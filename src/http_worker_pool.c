@@ -0,0 +1,459 @@
+
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "http_mpsc_queue.h"
+
+#include "http_worker_pool.h"
+
+
+/* every worker owns a Chase-Lev deque, pushing and taking at its bottom
+ * while idle workers steal from its top. tasks submitted from outside the
+ * pool land in a worker's lock-free inbox, which only that worker drains
+ * (into its deque, where the others may steal them). tasks submitted by
+ * a task go straight onto its own worker's deque
+ */
+
+#define _HTTP_WORKER_POOL_DEQUE_LENGTH 0x100
+
+struct HTTPWorkerArray;
+typedef struct HTTPWorkerArray HTTPWorkerArray;
+struct HTTPWorker;
+typedef struct HTTPWorker HTTPWorker;
+
+struct HTTPWorkerArray
+{
+  HTTPWorkerArray * retired; /* outgrown arrays; freed with the pool */
+  int64_t length; /* a power of two */
+  HTTPWorkerTask * tasks [];
+};
+
+struct HTTPWorker
+{
+  HTTPWorkerPool * pool;
+  uint32_t index;
+  pthread_t thread;
+
+  int64_t top, bottom;
+  HTTPWorkerArray * array;
+  HTTPMPSCQueue inbox;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool sleeping;
+};
+
+struct HTTPWorkerPool
+{
+  HTTPWorker * workers;
+  uint32_t count;
+  uint32_t next; /* round robin for submissions from outside */
+  bool stopping;
+};
+
+
+static __thread HTTPWorker * http_worker_current = NULL;
+
+
+static HTTPWorkerArray * http_worker_array_new(int64_t length)
+{
+  HTTPWorkerArray * ret;
+
+  ret = (HTTPWorkerArray *)
+    malloc(sizeof(HTTPWorkerArray) + length * sizeof(HTTPWorkerTask *));
+  assert(ret);
+
+  ret->retired = NULL;
+  ret->length = length;
+
+  return ret;
+}
+
+static HTTPWorkerTask * http_worker_array_get(
+    HTTPWorkerArray * array,
+    int64_t index
+    )
+{
+  return __atomic_load_n(
+      &array->tasks[index & (array->length - 1)],
+      __ATOMIC_RELAXED
+      );
+}
+
+static void http_worker_array_set(
+    HTTPWorkerArray * array,
+    int64_t index,
+    HTTPWorkerTask * task
+    )
+{
+  __atomic_store_n(
+      &array->tasks[index & (array->length - 1)],
+      task,
+      __ATOMIC_RELAXED
+      );
+}
+
+/* owner only */
+static void http_worker_push(HTTPWorker * worker, HTTPWorkerTask * task)
+{
+  HTTPWorkerArray * array, * grown;
+  int64_t top, bottom, k;
+
+  bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+  top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+  array = __atomic_load_n(&worker->array, __ATOMIC_RELAXED);
+
+  if (bottom - top >= array->length)
+  {
+    grown = http_worker_array_new(array->length * 2);
+    for (k = top; k < bottom; k++)
+      http_worker_array_set(grown, k, http_worker_array_get(array, k));
+
+    /* thieves may still be reading the old array */
+    grown->retired = array;
+    __atomic_store_n(&worker->array, grown, __ATOMIC_RELEASE);
+    array = grown;
+  }
+
+  http_worker_array_set(array, bottom, task);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+/* owner only */
+static HTTPWorkerTask * http_worker_take(HTTPWorker * worker)
+{
+  HTTPWorkerArray * array;
+  HTTPWorkerTask * ret;
+  int64_t top, bottom;
+
+  bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+  array = __atomic_load_n(&worker->array, __ATOMIC_RELAXED);
+  __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+
+  if (top > bottom)
+  {
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  ret = http_worker_array_get(array, bottom);
+  if (top == bottom)
+  {
+    /* the last task: race any thief for it */
+    if (
+      !__atomic_compare_exchange_n(
+          &worker->top,
+          &top,
+          top + 1,
+          false,
+          __ATOMIC_SEQ_CST,
+          __ATOMIC_RELAXED
+          )
+      )
+      ret = NULL;
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+
+  return ret;
+}
+
+/* any thread */
+static HTTPWorkerTask * http_worker_steal(HTTPWorker * worker)
+{
+  HTTPWorkerArray * array;
+  HTTPWorkerTask * ret;
+  int64_t top, bottom;
+
+  top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  bottom = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= bottom)
+    return NULL;
+
+  array = __atomic_load_n(&worker->array, __ATOMIC_ACQUIRE);
+  ret = http_worker_array_get(array, top);
+
+  if (
+    !__atomic_compare_exchange_n(
+        &worker->top,
+        &top,
+        top + 1,
+        false,
+        __ATOMIC_SEQ_CST,
+        __ATOMIC_RELAXED
+        )
+    )
+    return NULL; /* lost to the owner or another thief */
+
+  return ret;
+}
+
+static bool http_worker_has_stealable(HTTPWorker * worker)
+{
+  return __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE) <
+         __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+}
+
+static void http_worker_wake(HTTPWorker * worker)
+{
+  if (!__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST))
+    return;
+
+  pthread_mutex_lock(&worker->lock);
+  pthread_cond_signal(&worker->wake);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+/* hands a task on to a sleeping worker, if there is one, to steal */
+static void http_worker_wake_thief(HTTPWorker * worker)
+{
+  HTTPWorkerPool * pool = worker->pool;
+  HTTPWorker * other;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (uint32_t k = 1; k < pool->count; k++)
+  {
+    other = &pool->workers[(worker->index + k) % pool->count];
+    if (__atomic_load_n(&other->sleeping, __ATOMIC_SEQ_CST))
+    {
+      http_worker_wake(other);
+      return;
+    }
+  }
+}
+
+static HTTPWorkerTask * http_worker_find(HTTPWorker * worker)
+{
+  HTTPWorkerPool * pool = worker->pool;
+  HTTPMPSCNode * node;
+  HTTPWorkerTask * ret;
+  bool moved = false;
+
+  /* publish the inbox so that the others can steal from it too */
+  while ((node = http_mpsc_queue_pop(&worker->inbox)))
+  {
+    http_worker_push(worker, (HTTPWorkerTask *) node);
+    moved = true;
+  }
+
+  ret = http_worker_take(worker);
+  if (ret)
+  {
+    if (moved && http_worker_has_stealable(worker))
+      http_worker_wake_thief(worker);
+    return ret;
+  }
+
+  for (uint32_t k = 1; k < pool->count; k++)
+  {
+    ret = http_worker_steal(&pool->workers[(worker->index + k) % pool->count]);
+    if (ret)
+      return ret;
+  }
+
+  return NULL;
+}
+
+static bool http_worker_has_work(HTTPWorker * worker)
+{
+  HTTPWorkerPool * pool = worker->pool;
+
+  if (!http_mpsc_queue_is_empty(&worker->inbox))
+    return true;
+
+  for (uint32_t k = 0; k < pool->count; k++)
+  {
+    if (http_worker_has_stealable(&pool->workers[k]))
+      return true;
+  }
+
+  return false;
+}
+
+static void * http_worker_run(void * context)
+{
+  HTTPWorker * worker = (HTTPWorker *) context;
+  HTTPWorkerPool * pool = worker->pool;
+  HTTPWorkerTask * task;
+
+  http_worker_current = worker;
+
+  for (;;)
+  {
+    task = http_worker_find(worker);
+    if (task)
+    {
+      task->function(task);
+      continue;
+    }
+
+    /* announce sleep before the final look, so that a submitter either
+     * sees it and wakes us or its task is seen here
+     */
+    pthread_mutex_lock(&worker->lock);
+    __atomic_store_n(&worker->sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while (
+      !http_worker_has_work(worker) &&
+      !__atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST)
+      )
+      pthread_cond_wait(&worker->wake, &worker->lock);
+
+    __atomic_store_n(&worker->sleeping, false, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&worker->lock);
+
+    /* finish what was submitted before stopping */
+    if (
+      __atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST) &&
+      !http_worker_has_work(worker)
+      )
+      break;
+  }
+
+  http_worker_current = NULL;
+
+  return NULL;
+}
+
+
+HTTPWorkerPool * http_worker_pool_new(uint32_t thread_count)
+{
+  HTTPWorkerPool * ret;
+  HTTPWorker * worker;
+
+  assert(thread_count > 0);
+
+  ret = (HTTPWorkerPool *) malloc(sizeof(HTTPWorkerPool));
+  assert(ret);
+
+  ret->workers = (HTTPWorker *) calloc(thread_count, sizeof(HTTPWorker));
+  assert(ret->workers);
+  ret->count = thread_count;
+  ret->next = 0;
+  ret->stopping = false;
+
+  for (uint32_t k = 0; k < thread_count; k++)
+  {
+    worker = &ret->workers[k];
+    worker->pool = ret;
+    worker->index = k;
+    worker->array = http_worker_array_new(_HTTP_WORKER_POOL_DEQUE_LENGTH);
+    http_mpsc_queue_init(&worker->inbox);
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+  }
+
+  for (uint32_t k = 0; k < thread_count; k++)
+  {
+    worker = &ret->workers[k];
+    if (pthread_create(&worker->thread, NULL, http_worker_run, worker))
+      assert(0);
+  }
+
+  return ret;
+}
+
+/* runs every task already submitted, then joins the threads */
+void http_worker_pool_destroy(HTTPWorkerPool * pool)
+{
+  HTTPWorkerArray * array, * retired;
+  HTTPWorker * worker;
+
+  assert(pool);
+  assert(!http_worker_current || http_worker_current->pool != pool);
+
+  __atomic_store_n(&pool->stopping, true, __ATOMIC_SEQ_CST);
+
+  for (uint32_t k = 0; k < pool->count; k++)
+  {
+    worker = &pool->workers[k];
+    pthread_mutex_lock(&worker->lock);
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+  }
+
+  for (uint32_t k = 0; k < pool->count; k++)
+    pthread_join(pool->workers[k].thread, NULL);
+
+  for (uint32_t k = 0; k < pool->count; k++)
+  {
+    worker = &pool->workers[k];
+
+    for (array = worker->array; array; array = retired)
+    {
+      retired = array->retired;
+      free(array);
+    }
+
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->wake);
+  }
+
+  free(pool->workers);
+  free(pool);
+}
+
+void http_worker_task_init(HTTPWorkerTask * task, HTTPWorkerFunction function)
+{
+  assert(task);
+  assert(function);
+
+  task->node.next = NULL;
+  task->function = function;
+}
+
+/* may be called from any thread, including from within a task */
+void http_worker_pool_submit(HTTPWorkerPool * pool, HTTPWorkerTask * task)
+{
+  HTTPWorker * worker;
+  uint32_t start;
+
+  assert(pool);
+  assert(task);
+
+  worker = http_worker_current;
+  if (worker && worker->pool == pool)
+  {
+    http_worker_push(worker, task);
+    http_worker_wake_thief(worker);
+    return;
+  }
+
+  /* prefer a worker that is asleep, as a busy one will not look at its
+   * inbox until its current task is done
+   */
+  start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+  worker = &pool->workers[start % pool->count];
+  for (uint32_t k = 0; k < pool->count; k++)
+  {
+    if (__atomic_load_n(
+          &pool->workers[(start + k) % pool->count].sleeping,
+          __ATOMIC_RELAXED
+          ))
+    {
+      worker = &pool->workers[(start + k) % pool->count];
+      break;
+    }
+  }
+
+  http_mpsc_queue_push(&worker->inbox, &task->node);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  http_worker_wake(worker);
+}
+
+uint32_t http_worker_pool_get_thread_count(HTTPWorkerPool * pool)
+{
+  assert(pool);
+  return pool->count;
+}
+
@@ -0,0 +1,41 @@
+
+
+#ifndef __CHTTP_HTTP_WORKER_POOL_H
+#define __CHTTP_HTTP_WORKER_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "http_mpsc_queue.h"
+
+
+struct HTTPWorkerTask;
+typedef struct HTTPWorkerTask HTTPWorkerTask;
+
+typedef void (*HTTPWorkerFunction)(HTTPWorkerTask * task);
+
+/* intrusive task; embed it in the object the work is about so that
+ * submitting never allocates. treat the members as private
+ */
+struct HTTPWorkerTask
+{
+  HTTPMPSCNode node;
+  HTTPWorkerFunction function;
+};
+
+struct HTTPWorkerPool;
+typedef struct HTTPWorkerPool HTTPWorkerPool;
+
+
+HTTPWorkerPool * http_worker_pool_new(uint32_t thread_count);
+void http_worker_pool_destroy(HTTPWorkerPool * pool);
+
+void http_worker_task_init(HTTPWorkerTask * task, HTTPWorkerFunction function);
+
+void http_worker_pool_submit(HTTPWorkerPool * pool, HTTPWorkerTask * task);
+
+uint32_t http_worker_pool_get_thread_count(HTTPWorkerPool * pool);
+
+
+#endif
+
@@ -3,19 +3,26 @@
 
 #include <assert.h>
 #include <errno.h>
-#include <pthread.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "http_allocator.h"
 #include "http_content.h"
 #include "http_message.h"
+#include "http_probes.h"
 #include "http_request.h"
 #include "http_response.h"
+#include "http_transport.h"
 #include "http_utils.h"
 #include "http_version.h"
+#include "http_wait.h"
 
 #include "http_writer.h"
 
@@ -25,8 +32,22 @@
 struct HTTPWriter
 {
   struct timeval timeout_point;
-  char * error;
+  HTTPWriteFunction write;
+  void * write_context;
+  HTTPWaitFunction wait;
+  void * wait_context;
+  HTTPTransport * transport;
+  HTTPTimerWheel * timer_wheel;
+  HTTPTimer write_timer;
+  HTTPWriterTimeoutCallback timeout_callback;
+  void * timeout_context;
+  HTTPWriterError error;
   int error_number;
+  size_t bytes_written, error_offset;
+  HTTPAllocator allocator; /* of the writer and the lines it renders */
+
+  bool timed;
+  HTTPWriterTimings timings;
 };
 
 
@@ -47,31 +68,112 @@ static bool http_writer_timed_out(HTTPWriter * writer)
     return false;
 }
 
-static bool http_writer_check_fd_error(HTTPWriter * writer)
+/* milliseconds until the timeout point, or -1 if none is set */
+static int http_writer_remaining_time(HTTPWriter * writer)
+{
+  struct timeval now;
+  long long remaining;
+
+  if (writer->timeout_point.tv_sec == 0 && writer->timeout_point.tv_usec == 0)
+    return -1;
+
+  gettimeofday(&now, NULL);
+
+  remaining =
+    (writer->timeout_point.tv_sec - now.tv_sec) * 1000LL +
+    (writer->timeout_point.tv_usec - now.tv_usec) / 1000;
+
+  if (remaining < 0)
+    return 0;
+  else if (remaining > INT32_MAX)
+    return INT32_MAX;
+  else
+    return (int) remaining;
+}
+
+static void http_writer_timer_fired(HTTPTimer * timer, void * context)
+{
+  HTTPWriter * writer = (HTTPWriter *) context;
+
+  (void) timer;
+
+  if (writer->timeout_callback)
+    writer->timeout_callback(writer, writer->timeout_context);
+}
+
+/* arms the write deadline on the timer wheel for the span of one render */
+static void http_writer_begin(HTTPWriter * writer)
 {
+  int remaining;
+
+  if (!writer->timer_wheel)
+    return;
+
+  remaining = http_writer_remaining_time(writer);
+  if (remaining >= 0)
+    http_timer_wheel_arm(
+        writer->timer_wheel,
+        &writer->write_timer,
+        http_wait_now() + remaining
+        );
+}
+
+static void http_writer_end(HTTPWriter * writer)
+{
+  if (writer->timer_wheel)
+    http_timer_wheel_cancel(writer->timer_wheel, &writer->write_timer);
+}
+
+static void http_writer_fail(
+    HTTPWriter * writer,
+    HTTPWriterError error,
+    int error_number
+    )
+{
+  writer->error = error;
+  writer->error_number = error_number;
+  writer->error_offset = writer->bytes_written;
+}
+
+static bool http_writer_check_fd_error(HTTPWriter * writer, int fd)
+{
+  int ready;
+
   if (http_writer_timed_out(writer))
+    http_writer_fail(writer, HTTP_WRITER_ERROR_TIMED_OUT, EAGAIN);
+  else if (errno == EINTR)
+    return true; /* reattempt write */
+  else if (errno == EAGAIN || errno == EWOULDBLOCK)
   {
-    writer->error = strings_clone("write timed out");
-    writer->error_number = EAGAIN;
-  }
-  else if (errno)
-  {
-    if (errno == EAGAIN || errno == EWOULDBLOCK)
-    {
-      pthread_yield();
-      return true; /* reattempt write */
-    }
-
-    writer->error_number = errno;
-    writer->error = strings_format(
-        "write error: %s", 
-        errors_get_errno_name(writer->error_number)
+    ready = writer->wait(
+        fd,
+        POLLOUT,
+        http_writer_remaining_time(writer),
+        writer->wait_context
         );
+    if (ready > 0)
+      return true; /* reattempt write */
+    else if (ready == 0)
+      http_writer_fail(writer, HTTP_WRITER_ERROR_TIMED_OUT, EAGAIN);
+    else
+      http_writer_fail(writer, HTTP_WRITER_ERROR_WRITE_FAILED, errno);
   }
+  else if (errno)
+    http_writer_fail(writer, HTTP_WRITER_ERROR_WRITE_FAILED, errno);
 
   return false;
 }
 
+/* after each successful write, when timed */
+static void http_writer_mark_written(HTTPWriter * writer)
+{
+  uint64_t now = http_wait_now_ns();
+
+  if (!writer->timings.first_byte)
+    writer->timings.first_byte = now;
+  writer->timings.last_byte = now;
+}
+
 static void http_writer_write(
     HTTPWriter * writer,
     int fd,
@@ -79,15 +181,24 @@ static void http_writer_write(
     size_t data_length
     )
 {
-  if (writer->error)
-    return;
+  ssize_t written;
 
-  errno = 0;
-  do
+  while (!writer->error && data_length > 0)
   {
-    write(fd, data, data_length);
+    errno = 0;
+    written = writer->write(fd, data, data_length, writer->write_context);
+
+    if (written > 0)
+    {
+      writer->bytes_written += written;
+      data += written;
+      data_length -= written;
+      if (writer->timed)
+        http_writer_mark_written(writer);
+    }
+    else if (!http_writer_check_fd_error(writer, fd) && !writer->error)
+      http_writer_fail(writer, HTTP_WRITER_ERROR_WRITE_FAILED, errno);
   }
-  while (http_writer_check_fd_error(writer));
 }
 
 static void http_writer_render_crlf(HTTPWriter * writer, int fd)
@@ -109,7 +220,8 @@ static void http_writer_render_request_line(
 
   target = http_request_get_target(request);
   escaped_target = http_utils_url_escape(target);
-  line = strings_format(
+  line = http_allocator_format(
+      &writer->allocator,
       "%s %s %s",
       http_method_get_string(http_request_get_method(request)),
       target,
@@ -122,7 +234,7 @@ static void http_writer_render_request_line(
 
   free(target);
   free(escaped_target);
-  free(line);
+  http_allocator_free(&writer->allocator, line);
 }
 
 static void http_writer_render_status_line(
@@ -145,13 +257,18 @@ static void http_writer_render_status_line(
     );
 
   status_message = http_response_get_status_message(response);
-  line = strings_format("%s %s", buffer, status_message);
+  line = http_allocator_format(
+      &writer->allocator,
+      "%s %s",
+      buffer,
+      status_message
+      );
 
   line_length = strings_length(line);
   http_writer_write(writer, fd, line, line_length);
 
   free(status_message);
-  free(line);
+  http_allocator_free(&writer->allocator, line);
 
 }
 
@@ -177,14 +294,14 @@ static void http_writer_render_headers(
   {
     key = list_traversal_next_str(trav);
     value = http_message_get_header(msg, key);
-    line = strings_format("%s: %s", key, value);
+    line = http_allocator_format(&writer->allocator, "%s: %s", key, value);
     line_length = strings_length(line);
     
     http_writer_write(writer, fd, line, line_length);
     http_writer_render_crlf(writer, fd);
 
     free(value);
-    free(line);
+    http_allocator_free(&writer->allocator, line);
 
     if (writer->error)
     {
@@ -228,14 +345,19 @@ static void http_writer_render_cookies(
         cookie,
         http_message_get_version(msg)
         );
-    line = strings_format("%s: %s", key, cookie_string);
+    line = http_allocator_format(
+        &writer->allocator,
+        "%s: %s",
+        key,
+        cookie_string
+        );
     line_length = strings_length(line);
     
-    write(fd, line, line_length);
+    http_writer_write(writer, fd, line, line_length);
     http_writer_render_crlf(writer, fd);
 
     free(cookie_string);
-    free(line);
+    http_allocator_free(&writer->allocator, line);
 
     if (writer->error)
     {
@@ -250,23 +372,44 @@ static void http_writer_render_cookies(
 
 HTTPWriter * http_writer_new()
 {
-  HTTPWriter * ret = (HTTPWriter *) malloc(sizeof(HTTPWriter));
+  HTTPAllocator allocator = chttp_get_allocator();
+  HTTPWriter * ret;
+
+  ret = (HTTPWriter *) http_allocator_malloc(&allocator, sizeof(HTTPWriter));
   assert(ret);
 
+  ret->allocator = allocator;
+  ret->timed = false;
+  memset(&ret->timings, 0, sizeof(HTTPWriterTimings));
   ret->timeout_point.tv_sec = 0;
   ret->timeout_point.tv_usec = 0;
-  ret->error = NULL;
+  ret->write = http_io_write;
+  ret->write_context = NULL;
+  ret->wait = http_wait_poll;
+  ret->wait_context = NULL;
+  ret->transport = NULL;
+  ret->timer_wheel = NULL;
+  ret->timeout_callback = NULL;
+  ret->timeout_context = NULL;
+  http_timer_init(&ret->write_timer, http_writer_timer_fired, ret);
+  ret->error = HTTP_WRITER_ERROR_NONE;
   ret->error_number = 0;
+  ret->bytes_written = 0;
+  ret->error_offset = 0;
 
   return ret;
 }
 
 void http_writer_destroy(HTTPWriter * writer)
 {
+  HTTPAllocator allocator;
+
   assert(writer);
 
-  free(writer->error);
-  free(writer);
+  allocator = writer->allocator;
+
+  http_writer_end(writer);
+  http_allocator_free(&allocator, writer);
 }
 
 void http_writer_set_timeout_point(HTTPWriter * writer, struct timeval time)
@@ -276,27 +419,134 @@ void http_writer_set_timeout_point(HTTPWriter * writer, struct timeval time)
   writer->timeout_point = time;
 }
 
+void http_writer_set_write_function(
+    HTTPWriter * writer,
+    HTTPWriteFunction write,
+    void * context
+    )
+{
+  assert(writer);
+
+  writer->write = write ? write : http_io_write;
+  writer->write_context = write ? context : NULL;
+}
+
+void http_writer_set_wait_function(
+    HTTPWriter * writer,
+    HTTPWaitFunction wait,
+    void * context
+    )
+{
+  assert(writer);
+
+  writer->wait = wait ? wait : http_wait_poll;
+  writer->wait_context = wait ? context : NULL;
+}
+
+/* routes writes and waits through `transport' (NULL for the descriptor
+ * passed to the render functions), which then replaces their descriptor
+ */
+void http_writer_set_transport(HTTPWriter * writer, HTTPTransport * transport)
+{
+  assert(writer);
+
+  writer->transport = transport;
+  http_writer_set_write_function(
+      writer,
+      transport ? http_transport_io_write : NULL,
+      transport
+      );
+  http_writer_set_wait_function(
+      writer,
+      transport ? http_transport_io_wait : NULL,
+      transport
+      );
+}
+
+void http_writer_set_timer_wheel(
+    HTTPWriter * writer,
+    HTTPTimerWheel * wheel,
+    HTTPWriterTimeoutCallback callback,
+    void * context
+    )
+{
+  assert(writer);
+
+  http_writer_end(writer);
+
+  writer->timer_wheel = wheel;
+  writer->timeout_callback = callback;
+  writer->timeout_context = context;
+}
+
+/* has the writer time each message it renders, for http_writer_get_timings.
+ * off, it does not read the clock at all
+ */
+void http_writer_set_timed(HTTPWriter * writer, bool value)
+{
+  assert(writer);
+
+  writer->timed = value;
+}
+
 bool http_writer_has_error(HTTPWriter * writer)
 {
   assert(writer);
-  return writer->error != NULL;
+  return writer->error != HTTP_WRITER_ERROR_NONE;
 }
 
 char * http_writer_get_error(HTTPWriter * writer)
+{
+  char buffer [0xFF];
+
+  assert(writer);
+
+  if (!writer->error)
+    return NULL;
+
+  http_writer_print_error(writer, buffer, sizeof(buffer));
+  return strings_clone(buffer);
+}
+HTTPWriterError http_writer_get_error_code(HTTPWriter * writer)
+{
+  assert(writer);
+  return writer->error;
+}
+size_t http_writer_get_error_offset(HTTPWriter * writer)
 {
   assert(writer);
-  return writer->error ? strings_clone(writer->error) : NULL;
+  return writer->error_offset;
+}
+size_t http_writer_print_error(
+    HTTPWriter * writer,
+    char * buffer,
+    size_t buffer_length
+    )
+{
+  assert(writer);
+  return http_writer_error_print(
+      writer->error,
+      writer->error_number,
+      buffer,
+      buffer_length
+      );
 }
 int http_writer_get_errno(HTTPWriter * writer)
 {
   assert(writer);
   return writer->error_number;
 }
+HTTPWriterTimings http_writer_get_timings(HTTPWriter * writer)
+{
+  assert(writer);
+  return writer->timings;
+}
 void http_writer_clear_error(HTTPWriter * writer)
 {
   assert(writer);
-  free(writer->error);
+  writer->error = HTTP_WRITER_ERROR_NONE;
   writer->error_number = 0;
+  writer->error_offset = 0;
 }
 
 void http_writer_render(HTTPWriter * writer, HTTPMessage * msg, int fd)
@@ -309,7 +559,20 @@ void http_writer_render_header(HTTPWriter * writer, HTTPMessage * msg, int fd)
 {
   assert(writer);
   assert(msg);
-  assert(fd >= 0);
+  assert(fd >= 0 || writer->transport || writer->write != http_io_write);
+
+  if (writer->timed)
+  {
+    writer->timings.start = http_wait_now_ns();
+    writer->timings.first_byte = 0;
+    writer->timings.last_byte = 0;
+  }
+  HTTP_PROBE3(write__start, writer, msg, fd);
+
+  /* the writer is reused, so what it counts starts with each message */
+  writer->bytes_written = 0;
+
+  http_writer_begin(writer);
 
   if (http_message_get_type(msg) == HTTP_MESSAGE_TYPE_REQUEST)
     http_writer_render_request_line(writer, (HTTPRequest *) msg, fd);
@@ -322,6 +585,8 @@ void http_writer_render_header(HTTPWriter * writer, HTTPMessage * msg, int fd)
   http_writer_render_cookies(writer, msg, fd);
 
   http_writer_render_crlf(writer, fd);
+
+  http_writer_end(writer);
 }
 
 void http_writer_render_content(HTTPWriter * writer, HTTPMessage * msg, int fd)
@@ -330,16 +595,82 @@ void http_writer_render_content(HTTPWriter * writer, HTTPMessage * msg, int fd)
 
   assert(writer);
   assert(msg);
-  assert(fd >= 0);
+  assert(fd >= 0 || writer->transport || writer->write != http_io_write);
 
   content = http_message_get_content(msg);
   if (content.length != 0)
   {
+    http_writer_begin(writer);
     http_writer_write(writer, fd, content.data, content.length);
+    http_writer_end(writer);
   }
+
+  HTTP_PROBE4(
+      write__complete,
+      writer,
+      fd,
+      writer->error,
+      writer->bytes_written
+      );
 }
 
+/* writes `length' bytes of `file_fd' from `offset' as content, letting the
+ * kernel copy them where it can. the header (with its Content-Length)
+ * goes first, by http_writer_render_header, and the bytes counted go on
+ * from it
+ */
+void http_writer_render_file(
+    HTTPWriter * writer,
+    int file_fd,
+    off_t offset,
+    size_t length,
+    int fd
+    )
+{
+  ssize_t written;
+
+  assert(writer);
+  assert(file_fd >= 0);
+  assert(fd >= 0 || writer->transport);
+
+  http_writer_begin(writer);
 
+  while (!writer->error && length > 0)
+  {
+    errno = 0;
+    if (writer->transport)
+      written = http_transport_sendfile(
+          writer->transport,
+          file_fd,
+          &offset,
+          length
+          );
+    else
+    {
+      written = sendfile(fd, file_fd, &offset, length);
+      http_io_count(HTTP_METRIC_BYTES_SENT, written);
+    }
 
+    if (written > 0)
+    {
+      writer->bytes_written += written;
+      length -= written;
+      if (writer->timed)
+        http_writer_mark_written(writer);
+    }
+    else if (written == 0)
+      http_writer_fail(writer, HTTP_WRITER_ERROR_WRITE_FAILED, EIO);
+    else if (!http_writer_check_fd_error(writer, fd) && !writer->error)
+      http_writer_fail(writer, HTTP_WRITER_ERROR_WRITE_FAILED, errno);
+  }
 
+  http_writer_end(writer);
 
+  HTTP_PROBE4(
+      write__complete,
+      writer,
+      fd,
+      writer->error,
+      writer->bytes_written
+      );
+}
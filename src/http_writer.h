@@ -4,27 +4,78 @@
 #define __CHTTP_HTTP_WRITER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
+#include "http_io.h"
 #include "http_message.h"
+#include "http_timer_wheel.h"
+#include "http_transport.h"
+#include "http_wait.h"
+#include "http_writer_error.h"
 
 struct HTTPWriter;
 typedef struct HTTPWriter HTTPWriter;
 
+typedef void (*HTTPWriterTimeoutCallback)(HTTPWriter * writer, void * context);
+
+/* when the last message rendered was begun and when its first and last
+ * bytes were written, in nanoseconds as per http_wait_now_ns; 0 if none was
+ */
+struct HTTPWriterTimings
+{
+  uint64_t start, first_byte, last_byte;
+};
+typedef struct HTTPWriterTimings HTTPWriterTimings;
+
 
 HTTPWriter * http_writer_new();
 void http_writer_destroy(HTTPWriter * writer);
 
 void http_writer_set_timeout_point(HTTPWriter * writer, struct timeval time);
+void http_writer_set_write_function(
+    HTTPWriter * writer,
+    HTTPWriteFunction write,
+    void * context
+    );
+void http_writer_set_wait_function(
+    HTTPWriter * writer,
+    HTTPWaitFunction wait,
+    void * context
+    );
+void http_writer_set_transport(HTTPWriter * writer, HTTPTransport * transport);
+void http_writer_set_timer_wheel(
+    HTTPWriter * writer,
+    HTTPTimerWheel * wheel,
+    HTTPWriterTimeoutCallback callback,
+    void * context
+    );
+void http_writer_set_timed(HTTPWriter * writer, bool value);
 
 bool http_writer_has_error(HTTPWriter * writer);
 char * http_writer_get_error(HTTPWriter * writer);
+HTTPWriterError http_writer_get_error_code(HTTPWriter * writer);
+size_t http_writer_get_error_offset(HTTPWriter * writer);
+size_t http_writer_print_error(
+    HTTPWriter * writer,
+    char * buffer,
+    size_t buffer_length
+    );
 int http_writer_get_errno(HTTPWriter * writer);
+HTTPWriterTimings http_writer_get_timings(HTTPWriter * writer);
 
 void http_writer_clear_error(HTTPWriter * writer);
 
 void http_writer_render(HTTPWriter * writer, HTTPMessage * msg, int fd);
 void http_writer_render_header(HTTPWriter * writer, HTTPMessage * msg, int fd);
 void http_writer_render_content(HTTPWriter * writer, HTTPMessage * msg, int fd);
+void http_writer_render_file(
+    HTTPWriter * writer,
+    int file_fd,
+    off_t offset,
+    size_t length,
+    int fd
+    );
 
 
 #endif
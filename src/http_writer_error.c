@@ -0,0 +1,60 @@
+
+
+#include <assert.h>
+#include <baselib/baselib.h>
+#include <stdio.h>
+
+#include "http_writer_error.h"
+
+
+char * http_writer_error_get_message(HTTPWriterError error)
+{
+  switch (error)
+  {
+    case HTTP_WRITER_ERROR_NONE:
+      return "no error";
+    case HTTP_WRITER_ERROR_TIMED_OUT:
+      return "write timed out";
+    case HTTP_WRITER_ERROR_WRITE_FAILED:
+      return "write error";
+
+    default:
+      return "unspecified error";
+  }
+}
+
+size_t http_writer_error_print(
+    HTTPWriterError error,
+    int error_number,
+    char * buffer,
+    size_t buffer_length
+    )
+{
+  int length;
+
+  assert(buffer);
+  assert(buffer_length);
+
+  if (error == HTTP_WRITER_ERROR_WRITE_FAILED && error_number)
+    length = snprintf(
+        buffer, buffer_length, "%s: %s",
+        http_writer_error_get_message(error),
+        errors_get_errno_name(error_number)
+        );
+  else
+    length = snprintf(
+        buffer, buffer_length, "%s",
+        http_writer_error_get_message(error)
+        );
+
+  if (length < 0)
+  {
+    buffer[0] = '\0';
+    return 0;
+  }
+  else if ((size_t) length >= buffer_length)
+    return buffer_length - 1;
+  else
+    return (size_t) length;
+}
+
@@ -0,0 +1,27 @@
+
+
+#ifndef __CHTTP_HTTP_WRITER_ERROR_H
+#define __CHTTP_HTTP_WRITER_ERROR_H
+
+#include <sys/types.h>
+
+
+enum HTTPWriterError
+{
+  HTTP_WRITER_ERROR_NONE         = 0,
+  HTTP_WRITER_ERROR_TIMED_OUT    = 1,
+  HTTP_WRITER_ERROR_WRITE_FAILED = 2,
+};
+typedef enum HTTPWriterError HTTPWriterError;
+
+
+char * http_writer_error_get_message(HTTPWriterError error);
+size_t http_writer_error_print(
+    HTTPWriterError error,
+    int error_number,
+    char * buffer,
+    size_t buffer_length
+    );
+
+#endif
+